@@ -0,0 +1,405 @@
+/*
+ * Bit sliced AES using NEON instructions
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Eight blocks are processed at once, transposed so that q[i] holds bit i
+ * of every byte of every block: byte j of q[i] holds bit i of byte j of
+ * each of the eight blocks.  SubBytes is then evaluated with logic gates
+ * (the Boyar-Peralta circuit) on whole registers, ShiftRows is a byte
+ * permutation of each register and MixColumns is a byte rotation within
+ * each column plus xors between registers, so no step depends on the data
+ * through a table lookup.
+ *
+ * This file is built with -mfpu=neon and must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see asm/neon.h.
+ */
+
+#include <arm_neon.h>
+
+#include "aesbs.h"
+
+#define XOR(a, b)	veorq_u8(a, b)
+#define AND(a, b)	vandq_u8(a, b)
+#define NOT(a)		vmvnq_u8(a)
+
+/* byte permutations of ShiftRows and InvShiftRows */
+static const uint8_t aesbs_sr[16] = {
+	0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11
+};
+static const uint8_t aesbs_isr[16] = {
+	0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3
+};
+
+#define SWAPMOVE(a, b, n, m) do {					\
+	uint8x16_t __t = AND(XOR(vshrq_n_u8(b, n), a), m);		\
+	(a) = XOR(a, __t);						\
+	(b) = XOR(b, vshlq_n_u8(__t, n));				\
+} while (0)
+
+/*
+ * Transpose the 8x8 bit matrix at each byte position of x[]: bit i of
+ * x[k] ends up as bit 7 - k of x[7 - i].  The transpose is its own
+ * inverse.
+ */
+static inline void aesbs_ortho(uint8x16_t x[8])
+{
+	uint8x16_t m1 = vdupq_n_u8(0x55), m2 = vdupq_n_u8(0x33),
+		   m4 = vdupq_n_u8(0x0f);
+
+	SWAPMOVE(x[0], x[1], 1, m1);
+	SWAPMOVE(x[2], x[3], 1, m1);
+	SWAPMOVE(x[4], x[5], 1, m1);
+	SWAPMOVE(x[6], x[7], 1, m1);
+
+	SWAPMOVE(x[0], x[2], 2, m2);
+	SWAPMOVE(x[1], x[3], 2, m2);
+	SWAPMOVE(x[4], x[6], 2, m2);
+	SWAPMOVE(x[5], x[7], 2, m2);
+
+	SWAPMOVE(x[0], x[4], 4, m4);
+	SWAPMOVE(x[1], x[5], 4, m4);
+	SWAPMOVE(x[2], x[6], 4, m4);
+	SWAPMOVE(x[3], x[7], 4, m4);
+}
+
+static inline void aesbs_load(uint8x16_t q[8], const uint8_t *in)
+{
+	uint8x16_t x[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		x[i] = vld1q_u8(in + 16 * i);
+	aesbs_ortho(x);
+	for (i = 0; i < 8; i++)
+		q[i] = x[7 - i];
+}
+
+static inline void aesbs_store(uint8_t *out, uint8x16_t q[8])
+{
+	uint8x16_t x[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		x[7 - i] = q[i];
+	aesbs_ortho(x);
+	for (i = 0; i < 8; i++)
+		vst1q_u8(out + 16 * i, x[i]);
+}
+
+static inline void aesbs_add_round_key(uint8x16_t q[8], const uint8_t *rk)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] = XOR(q[i], vld1q_u8(rk + 16 * i));
+}
+
+static inline uint8x16_t aesbs_permute(uint8x16_t x, uint8x16_t idx)
+{
+	uint8x8x2_t t;
+
+	t.val[0] = vget_low_u8(x);
+	t.val[1] = vget_high_u8(x);
+	return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)),
+			   vtbl2_u8(t, vget_high_u8(idx)));
+}
+
+static inline void aesbs_shift_rows(uint8x16_t q[8], const uint8_t *perm)
+{
+	uint8x16_t idx = vld1q_u8(perm);
+	int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] = aesbs_permute(q[i], idx);
+}
+
+/* S-box of Boyar and Peralta, 113 gates, q[0] is the least significant bit */
+static void aesbs_sbox(uint8x16_t q[8])
+{
+	uint8x16_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint8x16_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	uint8x16_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	uint8x16_t y20, y21;
+	uint8x16_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	uint8x16_t z10, z11, z12, z13, z14, z15, z16, z17;
+	uint8x16_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	uint8x16_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	uint8x16_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	uint8x16_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	uint8x16_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	uint8x16_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	uint8x16_t t60, t61, t62, t63, t64, t65, t66, t67;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* top linear transformation */
+	y14 = XOR(x3, x5);
+	y13 = XOR(x0, x6);
+	y9 = XOR(x0, x3);
+	y8 = XOR(x0, x5);
+	t0 = XOR(x1, x2);
+	y1 = XOR(t0, x7);
+	y4 = XOR(y1, x3);
+	y12 = XOR(y13, y14);
+	y2 = XOR(y1, x0);
+	y5 = XOR(y1, x6);
+	y3 = XOR(y5, y8);
+	t1 = XOR(x4, y12);
+	y15 = XOR(t1, x5);
+	y20 = XOR(t1, x1);
+	y6 = XOR(y15, x7);
+	y10 = XOR(y15, t0);
+	y11 = XOR(y20, y9);
+	y7 = XOR(x7, y11);
+	y17 = XOR(y10, y11);
+	y19 = XOR(y10, y8);
+	y16 = XOR(t0, y11);
+	y21 = XOR(y13, y16);
+	y18 = XOR(x0, y16);
+
+	/* non-linear section */
+	t2 = AND(y12, y15);
+	t3 = AND(y3, y6);
+	t4 = XOR(t3, t2);
+	t5 = AND(y4, x7);
+	t6 = XOR(t5, t2);
+	t7 = AND(y13, y16);
+	t8 = AND(y5, y1);
+	t9 = XOR(t8, t7);
+	t10 = AND(y2, y7);
+	t11 = XOR(t10, t7);
+	t12 = AND(y9, y11);
+	t13 = AND(y14, y17);
+	t14 = XOR(t13, t12);
+	t15 = AND(y8, y10);
+	t16 = XOR(t15, t12);
+	t17 = XOR(t4, t14);
+	t18 = XOR(t6, t16);
+	t19 = XOR(t9, t14);
+	t20 = XOR(t11, t16);
+	t21 = XOR(t17, y20);
+	t22 = XOR(t18, y19);
+	t23 = XOR(t19, y21);
+	t24 = XOR(t20, y18);
+
+	t25 = XOR(t21, t22);
+	t26 = AND(t21, t23);
+	t27 = XOR(t24, t26);
+	t28 = AND(t25, t27);
+	t29 = XOR(t28, t22);
+	t30 = XOR(t23, t24);
+	t31 = XOR(t22, t26);
+	t32 = AND(t31, t30);
+	t33 = XOR(t32, t24);
+	t34 = XOR(t23, t33);
+	t35 = XOR(t27, t33);
+	t36 = AND(t24, t35);
+	t37 = XOR(t36, t34);
+	t38 = XOR(t27, t36);
+	t39 = AND(t29, t38);
+	t40 = XOR(t25, t39);
+
+	t41 = XOR(t40, t37);
+	t42 = XOR(t29, t33);
+	t43 = XOR(t29, t40);
+	t44 = XOR(t33, t37);
+	t45 = XOR(t42, t41);
+	z0 = AND(t44, y15);
+	z1 = AND(t37, y6);
+	z2 = AND(t33, x7);
+	z3 = AND(t43, y16);
+	z4 = AND(t40, y1);
+	z5 = AND(t29, y7);
+	z6 = AND(t42, y11);
+	z7 = AND(t45, y17);
+	z8 = AND(t41, y10);
+	z9 = AND(t44, y12);
+	z10 = AND(t37, y3);
+	z11 = AND(t33, y4);
+	z12 = AND(t43, y13);
+	z13 = AND(t40, y5);
+	z14 = AND(t29, y2);
+	z15 = AND(t42, y9);
+	z16 = AND(t45, y14);
+	z17 = AND(t41, y8);
+
+	/* bottom linear transformation */
+	t46 = XOR(z15, z16);
+	t47 = XOR(z10, z11);
+	t48 = XOR(z5, z13);
+	t49 = XOR(z9, z10);
+	t50 = XOR(z2, z12);
+	t51 = XOR(z2, z5);
+	t52 = XOR(z7, z8);
+	t53 = XOR(z0, z3);
+	t54 = XOR(z6, z7);
+	t55 = XOR(z16, z17);
+	t56 = XOR(z12, t48);
+	t57 = XOR(t50, t53);
+	t58 = XOR(z4, t46);
+	t59 = XOR(z3, t54);
+	t60 = XOR(t46, t57);
+	t61 = XOR(z14, t57);
+	t62 = XOR(t52, t58);
+	t63 = XOR(t49, t58);
+	t64 = XOR(z4, t59);
+	t65 = XOR(t61, t62);
+	t66 = XOR(z1, t63);
+	q[7] = XOR(t59, t63);
+	q[1] = XOR(t56, NOT(t62));
+	q[0] = XOR(t48, NOT(t60));
+	t67 = XOR(t64, t65);
+	q[4] = XOR(t53, t66);
+	q[3] = XOR(t51, t66);
+	q[2] = XOR(t47, t65);
+	q[6] = XOR(t64, NOT(q[4]));
+	q[5] = XOR(t55, NOT(t67));
+}
+
+/*
+ * Inverse affine transformation of the S-box, including its constant:
+ * InvSubBytes(x) = A'(SubBytes(A'(x))) where A' is the inverse of the
+ * affine map, as SubBytes is that map applied to the field inverse.
+ */
+static inline void aesbs_inv_affine(uint8x16_t q[8])
+{
+	uint8x16_t q0 = NOT(q[0]), q1 = NOT(q[1]), q2 = q[2], q3 = q[3],
+		   q4 = q[4], q5 = NOT(q[5]), q6 = NOT(q[6]), q7 = q[7];
+
+	q[7] = XOR(XOR(q1, q4), q6);
+	q[6] = XOR(XOR(q0, q3), q5);
+	q[5] = XOR(XOR(q7, q2), q4);
+	q[4] = XOR(XOR(q6, q1), q3);
+	q[3] = XOR(XOR(q5, q0), q2);
+	q[2] = XOR(XOR(q4, q7), q1);
+	q[1] = XOR(XOR(q3, q6), q0);
+	q[0] = XOR(XOR(q2, q5), q7);
+}
+
+static void aesbs_inv_sbox(uint8x16_t q[8])
+{
+	aesbs_inv_affine(q);
+	aesbs_sbox(q);
+	aesbs_inv_affine(q);
+}
+
+/* rotate the bytes of each column by one and two rows */
+static inline uint8x16_t aesbs_rot1(uint8x16_t x)
+{
+	uint32x4_t w = vreinterpretq_u32_u8(x);
+
+	return vreinterpretq_u8_u32(vsliq_n_u32(vshrq_n_u32(w, 8), w, 24));
+}
+
+static inline uint8x16_t aesbs_rot2(uint8x16_t x)
+{
+	return vreinterpretq_u8_u16(vrev32q_u16(vreinterpretq_u16_u8(x)));
+}
+
+/* multiply each byte by x in GF(2^8), modulo x^8 + x^4 + x^3 + x + 1 */
+static inline void aesbs_xtime(uint8x16_t d[8], const uint8x16_t s[8])
+{
+	uint8x16_t hi = s[7];
+
+	d[7] = s[6];
+	d[6] = s[5];
+	d[5] = s[4];
+	d[4] = XOR(s[3], hi);
+	d[3] = XOR(s[2], hi);
+	d[2] = s[1];
+	d[1] = XOR(s[0], hi);
+	d[0] = hi;
+}
+
+/* b[r] = 2a[r] + 3a[r+1] + a[r+2] + a[r+3] = 2c[r] + a[r+1] + c[r+2] */
+static void aesbs_mix_columns(uint8x16_t q[8])
+{
+	uint8x16_t c[8], c2[8], r1;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		r1 = aesbs_rot1(q[i]);
+		c[i] = XOR(q[i], r1);
+		q[i] = r1;
+	}
+	aesbs_xtime(c2, c);
+	for (i = 0; i < 8; i++)
+		q[i] = XOR(XOR(q[i], c2[i]), aesbs_rot2(c[i]));
+}
+
+/*
+ * The inverse matrix factors into the forward one times {04}x^2 + {05},
+ * so InvMixColumns(a) = MixColumns(a + 4(a + rot2(a))).
+ */
+static void aesbs_inv_mix_columns(uint8x16_t q[8])
+{
+	uint8x16_t d[8], d2[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		d[i] = XOR(q[i], aesbs_rot2(q[i]));
+	aesbs_xtime(d2, d);
+	aesbs_xtime(d, d2);
+	for (i = 0; i < 8; i++)
+		q[i] = XOR(q[i], d[i]);
+	aesbs_mix_columns(q);
+}
+
+void aesbs_encrypt8(const uint8_t *rk, int rounds, uint8_t *out,
+		    const uint8_t *in)
+{
+	uint8x16_t q[8];
+	int r;
+
+	aesbs_load(q, in);
+	aesbs_add_round_key(q, rk);
+	for (r = 1; r < rounds; r++) {
+		aesbs_sbox(q);
+		aesbs_shift_rows(q, aesbs_sr);
+		aesbs_mix_columns(q);
+		aesbs_add_round_key(q, rk + r * AESBS_RK_SIZE);
+	}
+	aesbs_sbox(q);
+	aesbs_shift_rows(q, aesbs_sr);
+	aesbs_add_round_key(q, rk + rounds * AESBS_RK_SIZE);
+	aesbs_store(out, q);
+}
+
+void aesbs_decrypt8(const uint8_t *rk, int rounds, uint8_t *out,
+		    const uint8_t *in)
+{
+	uint8x16_t q[8];
+	int r;
+
+	aesbs_load(q, in);
+	aesbs_add_round_key(q, rk + rounds * AESBS_RK_SIZE);
+	for (r = rounds - 1; r > 0; r--) {
+		aesbs_shift_rows(q, aesbs_isr);
+		aesbs_inv_sbox(q);
+		aesbs_add_round_key(q, rk + r * AESBS_RK_SIZE);
+		aesbs_inv_mix_columns(q);
+	}
+	aesbs_shift_rows(q, aesbs_isr);
+	aesbs_inv_sbox(q);
+	aesbs_add_round_key(q, rk);
+	aesbs_store(out, q);
+}
@@ -0,0 +1,486 @@
+/*
+ * Cryptographic API.
+ *
+ * Glue code for the bit sliced NEON AES implementation: CBC decryption, CTR
+ * and XTS, which can run eight blocks through the cipher at a time.  CBC
+ * encryption is inherently serial and is left to the fallback, as are
+ * callers in interrupt context.
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define pr_fmt(fmt)	KBUILD_MODNAME ": " fmt
+
+#include <crypto/aes.h>
+#include <crypto/algapi.h>
+#include <crypto/gf128mul.h>
+#include <linux/err.h>
+#include <linux/hardirq.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <asm/neon.h>
+
+#include "aesbs.h"
+
+#define AESBS_MAX_RK	((AES_MAX_KEYLENGTH_U32 / 4) * AESBS_RK_SIZE)
+#define AESBS_BLOCKS	(AESBS_CHUNK / AES_BLOCK_SIZE)
+
+struct aesbs_ctx {
+	struct crypto_blkcipher *fallback;
+	int rounds;
+	u8 rk[AESBS_MAX_RK] __aligned(16);
+};
+
+struct aesbs_xts_ctx {
+	struct aesbs_ctx key;		/* must be first */
+	u8 twkey[AESBS_MAX_RK] __aligned(16);
+};
+
+/*
+ * Expand @in_key and store each round key as eight bit planes of 16 bytes,
+ * byte j of plane i being 0xff if bit i of byte j of the round key is set.
+ */
+static int aesbs_expand_key(u8 *rk, int *rounds, const u8 *in_key,
+			    unsigned int key_len)
+{
+	struct crypto_aes_ctx aes;
+	int r, i, j, ret;
+	u8 b;
+
+	ret = crypto_aes_expand_key(&aes, in_key, key_len);
+	if (ret)
+		return ret;
+
+	*rounds = 6 + key_len / 4;
+	for (r = 0; r <= *rounds; r++) {
+		for (j = 0; j < AES_BLOCK_SIZE; j++) {
+			b = aes.key_enc[4 * r + j / 4] >> (8 * (j % 4));
+			for (i = 0; i < 8; i++)
+				rk[r * AESBS_RK_SIZE + i * 16 + j] =
+					(b >> i) & 1 ? 0xff : 0;
+		}
+	}
+
+	memset(&aes, 0, sizeof(aes));
+	return 0;
+}
+
+static int aesbs_fallback_setkey(struct crypto_tfm *tfm, const u8 *key,
+				 unsigned int len)
+{
+	struct aesbs_ctx *ctx = crypto_tfm_ctx(tfm);
+	int ret;
+
+	ctx->fallback->base.crt_flags &= ~CRYPTO_TFM_REQ_MASK;
+	ctx->fallback->base.crt_flags |= (tfm->crt_flags & CRYPTO_TFM_REQ_MASK);
+
+	ret = crypto_blkcipher_setkey(ctx->fallback, key, len);
+	if (ret) {
+		tfm->crt_flags &= ~CRYPTO_TFM_RES_MASK;
+		tfm->crt_flags |= (ctx->fallback->base.crt_flags &
+				   CRYPTO_TFM_RES_MASK);
+	}
+	return ret;
+}
+
+static int aesbs_setkey(struct crypto_tfm *tfm, const u8 *key,
+			unsigned int len)
+{
+	struct aesbs_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	if (aesbs_expand_key(ctx->rk, &ctx->rounds, key, len)) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	return aesbs_fallback_setkey(tfm, key, len);
+}
+
+static int aesbs_xts_setkey(struct crypto_tfm *tfm, const u8 *key,
+			    unsigned int len)
+{
+	struct aesbs_xts_ctx *ctx = crypto_tfm_ctx(tfm);
+	int rounds;
+
+	/* the data key comes first, the tweak key second */
+	if ((len % 2) ||
+	    aesbs_expand_key(ctx->key.rk, &ctx->key.rounds, key, len / 2) ||
+	    aesbs_expand_key(ctx->twkey, &rounds, key + len / 2, len / 2)) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	return aesbs_fallback_setkey(tfm, key, len);
+}
+
+static int aesbs_fallback_encrypt(struct blkcipher_desc *desc,
+				  struct scatterlist *dst,
+				  struct scatterlist *src, unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct crypto_blkcipher *tfm = desc->tfm;
+	int ret;
+
+	desc->tfm = ctx->fallback;
+	ret = crypto_blkcipher_encrypt_iv(desc, dst, src, nbytes);
+	desc->tfm = tfm;
+	return ret;
+}
+
+static int aesbs_fallback_decrypt(struct blkcipher_desc *desc,
+				  struct scatterlist *dst,
+				  struct scatterlist *src, unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct crypto_blkcipher *tfm = desc->tfm;
+	int ret;
+
+	desc->tfm = ctx->fallback;
+	ret = crypto_blkcipher_decrypt_iv(desc, dst, src, nbytes);
+	desc->tfm = tfm;
+	return ret;
+}
+
+/*
+ * The helpers below each handle one step of a walk and return the bytes
+ * left over.  Blocks go through a buffer on the stack, which also makes
+ * them safe for src == dst and pads the last run to eight blocks.
+ */
+static unsigned int __aesbs_cbc_decrypt(struct aesbs_ctx *ctx,
+					struct blkcipher_walk *walk)
+{
+	unsigned int nbytes = walk->nbytes, blocks, len;
+	u8 *src = walk->src.virt.addr, *dst = walk->dst.virt.addr;
+	u8 in[AESBS_CHUNK], out[AESBS_CHUNK];
+
+	while (nbytes >= AES_BLOCK_SIZE) {
+		blocks = min_t(unsigned int, nbytes / AES_BLOCK_SIZE,
+			       AESBS_BLOCKS);
+		len = blocks * AES_BLOCK_SIZE;
+
+		memcpy(in, src, len);
+		aesbs_decrypt8(ctx->rk, ctx->rounds, out, in);
+		crypto_xor(out, walk->iv, AES_BLOCK_SIZE);
+		crypto_xor(out + AES_BLOCK_SIZE, in, len - AES_BLOCK_SIZE);
+		memcpy(walk->iv, in + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+		memcpy(dst, out, len);
+
+		src += len;
+		dst += len;
+		nbytes -= len;
+	}
+	return nbytes;
+}
+
+/* Also handles a partial final block, so @nbytes need not be a multiple */
+static void __aesbs_ctr_crypt(struct aesbs_ctx *ctx, u8 *ctrblk, u8 *dst,
+			      const u8 *src, unsigned int nbytes)
+{
+	u8 ctr[AESBS_CHUNK], ks[AESBS_CHUNK];
+	unsigned int blocks, len, i;
+
+	while (nbytes) {
+		len = min_t(unsigned int, nbytes, AESBS_CHUNK);
+		blocks = DIV_ROUND_UP(len, AES_BLOCK_SIZE);
+
+		for (i = 0; i < blocks; i++) {
+			memcpy(ctr + i * AES_BLOCK_SIZE, ctrblk, AES_BLOCK_SIZE);
+			crypto_inc(ctrblk, AES_BLOCK_SIZE);
+		}
+		aesbs_encrypt8(ctx->rk, ctx->rounds, ks, ctr);
+
+		if (dst != src)
+			memcpy(dst, src, len);
+		crypto_xor(dst, ks, len);
+
+		src += len;
+		dst += len;
+		nbytes -= len;
+	}
+}
+
+static unsigned int __aesbs_xts_crypt(struct aesbs_ctx *ctx,
+				      struct blkcipher_walk *walk, bool enc)
+{
+	unsigned int nbytes = walk->nbytes, blocks, len, i;
+	u8 *src = walk->src.virt.addr, *dst = walk->dst.virt.addr;
+	u8 buf[AESBS_CHUNK], t[AESBS_CHUNK];
+	be128 tweak;
+
+	memcpy(&tweak, walk->iv, AES_BLOCK_SIZE);
+	while (nbytes >= AES_BLOCK_SIZE) {
+		blocks = min_t(unsigned int, nbytes / AES_BLOCK_SIZE,
+			       AESBS_BLOCKS);
+		len = blocks * AES_BLOCK_SIZE;
+
+		for (i = 0; i < blocks; i++) {
+			memcpy(t + i * AES_BLOCK_SIZE, &tweak, AES_BLOCK_SIZE);
+			gf128mul_x_ble(&tweak, &tweak);
+		}
+
+		memcpy(buf, src, len);
+		crypto_xor(buf, t, len);
+		if (enc)
+			aesbs_encrypt8(ctx->rk, ctx->rounds, buf, buf);
+		else
+			aesbs_decrypt8(ctx->rk, ctx->rounds, buf, buf);
+		crypto_xor(buf, t, len);
+		memcpy(dst, buf, len);
+
+		src += len;
+		dst += len;
+		nbytes -= len;
+	}
+	memcpy(walk->iv, &tweak, AES_BLOCK_SIZE);
+	return nbytes;
+}
+
+static int aesbs_cbc_decrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	if (in_interrupt())
+		return aesbs_fallback_decrypt(desc, dst, src, nbytes);
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+
+	while ((nbytes = walk.nbytes)) {
+		kernel_neon_begin();
+		nbytes = __aesbs_cbc_decrypt(ctx, &walk);
+		kernel_neon_end();
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+
+	return err;
+}
+
+static int aesbs_ctr_crypt(struct blkcipher_desc *desc,
+			   struct scatterlist *dst, struct scatterlist *src,
+			   unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	if (in_interrupt())
+		return aesbs_fallback_encrypt(desc, dst, src, nbytes);
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AES_BLOCK_SIZE);
+
+	while ((nbytes = walk.nbytes) >= AES_BLOCK_SIZE) {
+		kernel_neon_begin();
+		__aesbs_ctr_crypt(ctx, walk.iv, walk.dst.virt.addr,
+				  walk.src.virt.addr,
+				  nbytes & ~(AES_BLOCK_SIZE - 1));
+		kernel_neon_end();
+		nbytes &= AES_BLOCK_SIZE - 1;
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	if (walk.nbytes) {
+		kernel_neon_begin();
+		__aesbs_ctr_crypt(ctx, walk.iv, walk.dst.virt.addr,
+				  walk.src.virt.addr, walk.nbytes);
+		kernel_neon_end();
+		err = blkcipher_walk_done(desc, &walk, 0);
+	}
+
+	return err;
+}
+
+static int aesbs_xts_crypt(struct blkcipher_desc *desc,
+			   struct scatterlist *dst, struct scatterlist *src,
+			   unsigned int nbytes, bool enc)
+{
+	struct aesbs_xts_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	u8 buf[AESBS_CHUNK] = { 0 };
+	int err;
+
+	if (in_interrupt())
+		return enc ? aesbs_fallback_encrypt(desc, dst, src, nbytes) :
+			     aesbs_fallback_decrypt(desc, dst, src, nbytes);
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+	if (!walk.nbytes)
+		return err;
+
+	/* the initial tweak is the IV encrypted with the tweak key */
+	memcpy(buf, walk.iv, AES_BLOCK_SIZE);
+	kernel_neon_begin();
+	aesbs_encrypt8(ctx->twkey, ctx->key.rounds, buf, buf);
+	kernel_neon_end();
+	memcpy(walk.iv, buf, AES_BLOCK_SIZE);
+
+	while ((nbytes = walk.nbytes)) {
+		kernel_neon_begin();
+		nbytes = __aesbs_xts_crypt(&ctx->key, &walk, enc);
+		kernel_neon_end();
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+
+	return err;
+}
+
+static int aesbs_xts_encrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	return aesbs_xts_crypt(desc, dst, src, nbytes, true);
+}
+
+static int aesbs_xts_decrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	return aesbs_xts_crypt(desc, dst, src, nbytes, false);
+}
+
+static int aesbs_init_tfm(struct crypto_tfm *tfm)
+{
+	const char *name = tfm->__crt_alg->cra_name;
+	struct aesbs_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	ctx->fallback = crypto_alloc_blkcipher(name, 0,
+				CRYPTO_ALG_ASYNC | CRYPTO_ALG_NEED_FALLBACK);
+	if (IS_ERR(ctx->fallback)) {
+		pr_err("Error allocating fallback algo %s\n", name);
+		return PTR_ERR(ctx->fallback);
+	}
+
+	return 0;
+}
+
+static void aesbs_exit_tfm(struct crypto_tfm *tfm)
+{
+	struct aesbs_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	crypto_free_blkcipher(ctx->fallback);
+	ctx->fallback = NULL;
+}
+
+static struct crypto_alg aesbs_algs[] = { {
+	.cra_name		= "cbc(aes)",
+	.cra_driver_name	= "cbc-aes-neonbs",
+	.cra_priority		= 200,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER |
+				  CRYPTO_ALG_NEED_FALLBACK,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_ctx),
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aesbs_algs[0].cra_list),
+	.cra_init		= aesbs_init_tfm,
+	.cra_exit		= aesbs_exit_tfm,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_setkey,
+			.encrypt	= aesbs_fallback_encrypt,
+			.decrypt	= aesbs_cbc_decrypt,
+		},
+	},
+}, {
+	.cra_name		= "ctr(aes)",
+	.cra_driver_name	= "ctr-aes-neonbs",
+	.cra_priority		= 200,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER |
+				  CRYPTO_ALG_NEED_FALLBACK,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct aesbs_ctx),
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aesbs_algs[1].cra_list),
+	.cra_init		= aesbs_init_tfm,
+	.cra_exit		= aesbs_exit_tfm,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_setkey,
+			.encrypt	= aesbs_ctr_crypt,
+			.decrypt	= aesbs_ctr_crypt,
+		},
+	},
+}, {
+	.cra_name		= "xts(aes)",
+	.cra_driver_name	= "xts-aes-neonbs",
+	.cra_priority		= 200,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER |
+				  CRYPTO_ALG_NEED_FALLBACK,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_xts_ctx),
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aesbs_algs[2].cra_list),
+	.cra_init		= aesbs_init_tfm,
+	.cra_exit		= aesbs_exit_tfm,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+			.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_xts_setkey,
+			.encrypt	= aesbs_xts_encrypt,
+			.decrypt	= aesbs_xts_decrypt,
+		},
+	},
+} };
+
+static int __init aesbs_mod_init(void)
+{
+	int i, ret;
+
+	if (!cpu_has_neon()) {
+		pr_info("NEON is not available.\n");
+		return -ENODEV;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(aesbs_algs); i++) {
+		ret = crypto_register_alg(&aesbs_algs[i]);
+		if (ret)
+			goto err;
+	}
+	return 0;
+
+err:
+	while (--i >= 0)
+		crypto_unregister_alg(&aesbs_algs[i]);
+	return ret;
+}
+
+static void __exit aesbs_mod_exit(void)
+{
+	int i;
+
+	for (i = ARRAY_SIZE(aesbs_algs) - 1; i >= 0; i--)
+		crypto_unregister_alg(&aesbs_algs[i]);
+}
+
+module_init(aesbs_mod_init);
+module_exit(aesbs_mod_exit);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Bit sliced AES in CBC, CTR and XTS modes, NEON accelerated");
+MODULE_ALIAS("cbc(aes)");
+MODULE_ALIAS("ctr(aes)");
+MODULE_ALIAS("xts(aes)");
@@ -0,0 +1,31 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __ARM_CRYPTO_AESBS_H
+#define __ARM_CRYPTO_AESBS_H
+
+/*
+ * Shared between the NEON core and its glue, which see different type
+ * headers, so only plain C types here.
+ */
+
+/* bytes of one bit sliced round key: 8 bit planes of 16 bytes */
+#define AESBS_RK_SIZE		128
+/* bytes processed per call: 8 blocks */
+#define AESBS_CHUNK		128
+
+void aesbs_encrypt8(const unsigned char *rk, int rounds, unsigned char *out,
+		    const unsigned char *in);
+void aesbs_decrypt8(const unsigned char *rk, int rounds, unsigned char *out,
+		    const unsigned char *in);
+
+#endif /* __ARM_CRYPTO_AESBS_H */
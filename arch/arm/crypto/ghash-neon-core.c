@@ -0,0 +1,177 @@
+/*
+ * GHASH using NEON polynomial multiplies
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * ARMv7 NEON only multiplies 8x8 bit polynomials, so a 64x64 bit carry-less
+ * multiply is put together from ten of those after Camara, Gouvea, Lopez
+ * and Dahab, and the 128x128 bit one from three 64x64 bit ones (Karatsuba).
+ *
+ * GHASH numbers the bits of a byte from the most significant one.  Rather
+ * than multiply in that reflected domain, the bits of each byte are
+ * reversed on the way in and out, so that a block loaded little endian is
+ * the polynomial with bit k as coefficient of x^k, and the product is
+ * reduced modulo x^128 + x^7 + x^2 + x + 1 with plain shifts.
+ *
+ * This file is built with -mfpu=neon and must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see asm/neon.h.
+ */
+
+#include <arm_neon.h>
+
+#include "ghash-neon.h"
+
+static const uint8_t ghash_rev4[16] = {
+	0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+	0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+};
+
+static inline uint8x8_t ghash_tbl16(uint8x16_t t, uint8x8_t idx)
+{
+	uint8x8x2_t tt;
+
+	tt.val[0] = vget_low_u8(t);
+	tt.val[1] = vget_high_u8(t);
+	return vtbl2_u8(tt, idx);
+}
+
+/* reverse the bits of each byte */
+static inline uint64x2_t ghash_load(const uint8_t *p, uint8x16_t rev4)
+{
+	uint8x16_t x = vld1q_u8(p);
+	uint8x16_t lo = vandq_u8(x, vdupq_n_u8(0x0f));
+	uint8x16_t hi = vshrq_n_u8(x, 4);
+	uint8x16_t rlo, rhi;
+
+	rlo = vcombine_u8(ghash_tbl16(rev4, vget_low_u8(lo)),
+			  ghash_tbl16(rev4, vget_high_u8(lo)));
+	rhi = vcombine_u8(ghash_tbl16(rev4, vget_low_u8(hi)),
+			  ghash_tbl16(rev4, vget_high_u8(hi)));
+	return vreinterpretq_u64_u8(vorrq_u8(vshlq_n_u8(rlo, 4), rhi));
+}
+
+static inline void ghash_store(uint8_t *p, uint64x2_t x, uint8x16_t rev4)
+{
+	uint8_t tmp[16];
+
+	vst1q_u8(tmp, vreinterpretq_u8_u64(x));
+	vst1q_u8(p, vreinterpretq_u8_u64(ghash_load(tmp, rev4)));
+}
+
+static inline uint8x16_t ghash_p8(uint8x8_t a, uint8x8_t b)
+{
+	return vreinterpretq_u8_p16(vmull_p8(vreinterpret_p8_u8(a),
+					     vreinterpret_p8_u8(b)));
+}
+
+static inline uint8x16_t ghash_fold(uint8x16_t t, uint64x1_t mask)
+{
+	uint64x2_t w = vreinterpretq_u64_u8(t);
+	uint64x1_t l = vget_low_u64(w), h = vget_high_u64(w);
+
+	l = vreinterpret_u64_u8(veor_u8(vreinterpret_u8_u64(l),
+					vreinterpret_u8_u64(h)));
+	h = vreinterpret_u64_u8(vand_u8(vreinterpret_u8_u64(h),
+					vreinterpret_u8_u64(mask)));
+	l = vreinterpret_u64_u8(veor_u8(vreinterpret_u8_u64(l),
+					vreinterpret_u8_u64(h)));
+	return vreinterpretq_u8_u64(vcombine_u64(l, h));
+}
+
+/* 64x64 -> 128 bit carry-less multiply */
+static inline uint64x2_t ghash_mul64(uint64x1_t a64, uint64x1_t b64)
+{
+	uint8x8_t a = vreinterpret_u8_u64(a64), b = vreinterpret_u8_u64(b64);
+	uint8x16_t l, m, n, k, d;
+
+	/* L = A1*B + A*B1, the products of bytes one apart */
+	l = veorq_u8(ghash_p8(vext_u8(a, a, 1), b),
+		     ghash_p8(a, vext_u8(b, b, 1)));
+	/* M = A2*B + A*B2 */
+	m = veorq_u8(ghash_p8(vext_u8(a, a, 2), b),
+		     ghash_p8(a, vext_u8(b, b, 2)));
+	/* N = A3*B + A*B3 */
+	n = veorq_u8(ghash_p8(vext_u8(a, a, 3), b),
+		     ghash_p8(a, vext_u8(b, b, 3)));
+	/* K = A*B4 */
+	k = ghash_p8(a, vext_u8(b, b, 4));
+	/* D = A*B */
+	d = ghash_p8(a, b);
+
+	l = ghash_fold(l, vcreate_u64(0x0000ffffffffffffULL));
+	m = ghash_fold(m, vcreate_u64(0x00000000ffffffffULL));
+	n = ghash_fold(n, vcreate_u64(0x000000000000ffffULL));
+	k = ghash_fold(k, vcreate_u64(0));
+
+	l = vextq_u8(l, l, 15);
+	m = vextq_u8(m, m, 14);
+	n = vextq_u8(n, n, 13);
+	k = vextq_u8(k, k, 12);
+
+	d = veorq_u8(d, veorq_u8(l, m));
+	d = veorq_u8(d, veorq_u8(n, k));
+	return vreinterpretq_u64_u8(d);
+}
+
+/* x * h modulo x^128 + x^7 + x^2 + x + 1 */
+static inline uint64x2_t ghash_mul(uint64x2_t x, uint64x2_t h)
+{
+	uint64x2_t zero = vdupq_n_u64(0);
+	uint64x2_t lo, hi, mid, t, c, cv;
+
+	/* Karatsuba: three 64x64 bit products */
+	lo = ghash_mul64(vget_low_u64(x), vget_low_u64(h));
+	hi = ghash_mul64(vget_high_u64(x), vget_high_u64(h));
+	mid = ghash_mul64(vreinterpret_u64_u8(veor_u8(
+			vreinterpret_u8_u64(vget_low_u64(x)),
+			vreinterpret_u8_u64(vget_high_u64(x)))),
+			  vreinterpret_u64_u8(veor_u8(
+			vreinterpret_u8_u64(vget_low_u64(h)),
+			vreinterpret_u8_u64(vget_high_u64(h)))));
+	mid = veorq_u64(mid, veorq_u64(lo, hi));
+
+	/* the 256 bit product is hi:lo with mid added at bit 64 */
+	lo = veorq_u64(lo, vextq_u64(zero, mid, 1));
+	hi = veorq_u64(hi, vextq_u64(mid, zero, 1));
+
+	/*
+	 * x^128 = x^7 + x^2 + x + 1: add hi * (x^7 + x^2 + x + 1), whose bits
+	 * above 127 are c, and those bits times (x^7 + x^2 + x + 1) again.
+	 */
+	t = veorq_u64(veorq_u64(hi, vshlq_n_u64(hi, 1)),
+		      veorq_u64(vshlq_n_u64(hi, 2), vshlq_n_u64(hi, 7)));
+	c = veorq_u64(vshrq_n_u64(hi, 63),
+		      veorq_u64(vshrq_n_u64(hi, 62), vshrq_n_u64(hi, 57)));
+	/* the carries out of the low half go into the high half */
+	t = veorq_u64(t, vextq_u64(zero, c, 1));
+	cv = vextq_u64(c, zero, 1);
+	cv = veorq_u64(veorq_u64(cv, vshlq_n_u64(cv, 1)),
+		       veorq_u64(vshlq_n_u64(cv, 2), vshlq_n_u64(cv, 7)));
+	return veorq_u64(lo, veorq_u64(t, cv));
+}
+
+void ghash_neon_update(unsigned char *dg, const unsigned char *h,
+		       const unsigned char *src, int blocks)
+{
+	uint8x16_t rev4 = vld1q_u8(ghash_rev4);
+	uint64x2_t k = vreinterpretq_u64_u8(vld1q_u8(h));
+	uint64x2_t x = ghash_load(dg, rev4);
+
+	while (blocks--) {
+		x = veorq_u64(x, ghash_load(src, rev4));
+		x = ghash_mul(x, k);
+		src += GHASH_BLOCK_SIZE;
+	}
+	ghash_store(dg, x, rev4);
+}
@@ -0,0 +1,27 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __ARM_CRYPTO_GHASH_NEON_H
+#define __ARM_CRYPTO_GHASH_NEON_H
+
+#define GHASH_BLOCK_SIZE	16
+#define GHASH_DIGEST_SIZE	16
+
+/*
+ * Hash @blocks blocks of @src into the digest @dg, which is kept in the
+ * byte order of ghash-generic.  @h is the key with the bits of each byte
+ * reversed.
+ */
+void ghash_neon_update(unsigned char *dg, const unsigned char *h,
+		       const unsigned char *src, int blocks);
+
+#endif /* __ARM_CRYPTO_GHASH_NEON_H */
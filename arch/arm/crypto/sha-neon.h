@@ -0,0 +1,26 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __ARM_CRYPTO_SHA_NEON_H
+#define __ARM_CRYPTO_SHA_NEON_H
+
+/*
+ * Run the compression function over @blocks 64 byte blocks of @data.
+ * The message schedule is computed four words at a time in NEON registers
+ * and the rounds in ARM registers, so the two overlap.
+ */
+void sha1_neon_transform(unsigned int *state, const unsigned char *data,
+			 int blocks);
+void sha256_neon_transform(unsigned int *state, const unsigned char *data,
+			   int blocks);
+
+#endif /* __ARM_CRYPTO_SHA_NEON_H */
@@ -0,0 +1,102 @@
+/*
+ * SHA-1 compression function with a NEON message schedule
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * This file is built with -mfpu=neon and must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see asm/neon.h.
+ */
+
+#include <arm_neon.h>
+
+#include "sha-neon.h"
+
+#define ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define F1(b, c, d)	((d) ^ ((b) & ((c) ^ (d))))
+#define F2(b, c, d)	((b) ^ (c) ^ (d))
+#define F3(b, c, d)	(((b) & (c)) | ((d) & ((b) | (c))))
+
+static inline uint32x4_t sha1_rol1(uint32x4_t x)
+{
+	return vsliq_n_u32(vshrq_n_u32(x, 31), x, 1);
+}
+
+/*
+ * W[t] = rol1(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]) for the four words
+ * from t = 4n.  W[t+3] needs W[t] of the same vector, so it is computed
+ * without it first and fixed up after.
+ */
+static inline uint32x4_t sha1_schedule(const uint32x4_t *v, int n)
+{
+	uint32x4_t zero = vdupq_n_u32(0);
+	uint32x4_t t;
+
+	t = veorq_u32(v[n - 4], vextq_u32(v[n - 4], v[n - 3], 2));
+	t = veorq_u32(t, veorq_u32(v[n - 2], vextq_u32(v[n - 1], zero, 1)));
+	t = sha1_rol1(t);
+	return veorq_u32(t, sha1_rol1(vextq_u32(zero, t, 1)));
+}
+
+void sha1_neon_transform(uint32_t *state, const uint8_t *data, int blocks)
+{
+	static const uint32_t k[4] = {
+		0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+	};
+	uint32x4_t v[20];
+	uint32_t wk[80];
+	uint32_t a, b, c, d, e, tmp;
+	int n, t;
+
+	while (blocks--) {
+		for (n = 0; n < 20; n++) {
+			if (n < 4)
+				v[n] = vreinterpretq_u32_u8(vrev32q_u8(
+						vld1q_u8(data + 16 * n)));
+			else
+				v[n] = sha1_schedule(v, n);
+			vst1q_u32(wk + 4 * n,
+				  vaddq_u32(v[n], vdupq_n_u32(k[n / 5])));
+		}
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+
+		for (t = 0; t < 80; t++) {
+			if (t < 20)
+				tmp = F1(b, c, d);
+			else if (t < 40 || t >= 60)
+				tmp = F2(b, c, d);
+			else
+				tmp = F3(b, c, d);
+			tmp += ROL(a, 5) + e + wk[t];
+			e = d;
+			d = c;
+			c = ROL(b, 30);
+			b = a;
+			a = tmp;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+
+		data += 64;
+	}
+}
@@ -0,0 +1,132 @@
+/*
+ * SHA-256 compression function with a NEON message schedule
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * This file is built with -mfpu=neon and must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see asm/neon.h.
+ */
+
+#include <arm_neon.h>
+
+#include "sha-neon.h"
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+#define CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#define E0(x)		(ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define E1(x)		(ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define VROR(x, n)	vsriq_n_u32(vshlq_n_u32(x, 32 - (n)), x, n)
+
+static inline uint32x4_t sha256_s0(uint32x4_t x)
+{
+	return veorq_u32(veorq_u32(VROR(x, 7), VROR(x, 18)),
+			 vshrq_n_u32(x, 3));
+}
+
+static inline uint32x4_t sha256_s1(uint32x4_t x)
+{
+	return veorq_u32(veorq_u32(VROR(x, 17), VROR(x, 19)),
+			 vshrq_n_u32(x, 10));
+}
+
+/*
+ * W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16] for the four words
+ * from t = 4n.  The upper two need W[t] and W[t+1] of the same vector, so
+ * s1 is added in two halves.
+ */
+static inline uint32x4_t sha256_schedule(const uint32x4_t *v, int n)
+{
+	uint32x4_t zero = vdupq_n_u32(0);
+	uint32x4_t t;
+
+	t = vaddq_u32(v[n - 4], sha256_s0(vextq_u32(v[n - 4], v[n - 3], 1)));
+	t = vaddq_u32(t, vextq_u32(v[n - 2], v[n - 1], 1));
+	t = vaddq_u32(t, sha256_s1(vextq_u32(v[n - 1], zero, 2)));
+	return vaddq_u32(t, sha256_s1(vextq_u32(zero, t, 2)));
+}
+
+void sha256_neon_transform(uint32_t *state, const uint8_t *data, int blocks)
+{
+	uint32x4_t v[16];
+	uint32_t wk[64];
+	uint32_t a, b, c, d, e, f, g, h, t1, t2;
+	int n, t;
+
+	while (blocks--) {
+		for (n = 0; n < 16; n++) {
+			if (n < 4)
+				v[n] = vreinterpretq_u32_u8(vrev32q_u8(
+						vld1q_u8(data + 16 * n)));
+			else
+				v[n] = sha256_schedule(v, n);
+			vst1q_u32(wk + 4 * n,
+				  vaddq_u32(v[n], vld1q_u32(sha256_k + 4 * n)));
+		}
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		for (t = 0; t < 64; t++) {
+			t1 = h + E1(e) + CH(e, f, g) + wk[t];
+			t2 = E0(a) + MAJ(a, b, c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+
+		data += 64;
+	}
+}
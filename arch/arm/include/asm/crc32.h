@@ -0,0 +1,57 @@
+/*
+ * arch/arm/include/asm/crc32.h
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef __ASM_ARM_CRC32_H
+#define __ASM_ARM_CRC32_H
+
+#include <linux/hardirq.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <asm/neon.h>
+
+/*
+ * Shorter buffers are left to the lookup tables.  Longer ones are done in
+ * chunks, as preemption is off while the NEON unit is in use.
+ */
+#define CRC32_NEON_MIN		64
+#define CRC32_NEON_CHUNK	4096
+
+/* arch/arm/lib/crc32-neon.c, @len at least 16 and a multiple of 16 */
+u32 __crc32_le_neon(u32 crc, unsigned char const *p, unsigned int len);
+u32 __crc32c_le_neon(u32 crc, unsigned char const *p, unsigned int len);
+
+/*
+ * Run the NEON @fn over all of @p but the last *@len % 16 bytes, which are
+ * left at *@p for the caller, unless @p is short or NEON cannot be used
+ * here.  Returns the CRC so far.
+ */
+static inline u32 crc32_neon(u32 crc, unsigned char const **p, size_t *len,
+		u32 (*fn)(u32, unsigned char const *, unsigned int))
+{
+	if (*len < CRC32_NEON_MIN || in_interrupt())
+		return crc;
+
+	while (*len >= 16) {
+		unsigned int n = min_t(size_t, *len, CRC32_NEON_CHUNK) & ~15;
+
+		kernel_neon_begin();
+		crc = fn(crc, *p, n);
+		kernel_neon_end();
+		*p += n;
+		*len -= n;
+	}
+	return crc;
+}
+
+#endif /* __ASM_ARM_CRC32_H */
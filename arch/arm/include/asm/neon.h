@@ -0,0 +1,38 @@
+/*
+ * arch/arm/include/asm/neon.h
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <linux/bug.h>
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+#ifdef __ARM_NEON__
+
+/*
+ * NEON code must live in a compilation unit of its own, built with
+ * -mfpu=neon, and be called from a unit that is not, between
+ * kernel_neon_begin() and kernel_neon_end().  Otherwise GCC is free to
+ * move NEON instructions, or generate them, outside of that window.
+ */
+#define kernel_neon_begin()	BUILD_BUG()
+
+#else
+void kernel_neon_begin(void);
+#endif
+void kernel_neon_end(void);
+
+#endif /* __ASM_ARM_NEON_H */
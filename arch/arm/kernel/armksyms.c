@@ -48,6 +48,14 @@ extern void __aeabi_ulcmp(void);
 
 extern void fpundefinstr(void);
 
+/* NEON cores from arch/arm/lib, for xor.ko and crc32.ko */
+extern void __xor_neon_2(void);
+extern void __xor_neon_3(void);
+extern void __xor_neon_4(void);
+extern void __xor_neon_5(void);
+extern void __crc32_le_neon(void);
+extern void __crc32c_le_neon(void);
+
 	/* platform dependent support */
 EXPORT_SYMBOL(arm_delay_ops);
 
@@ -160,3 +168,15 @@ EXPORT_SYMBOL(__gnu_mcount_nc);
 #ifdef CONFIG_ARM_PATCH_PHYS_VIRT
 EXPORT_SYMBOL(__pv_phys_offset);
 #endif
+
+#if defined(CONFIG_KERNEL_MODE_NEON) && IS_ENABLED(CONFIG_XOR_BLOCKS)
+EXPORT_SYMBOL_GPL(__xor_neon_2);
+EXPORT_SYMBOL_GPL(__xor_neon_3);
+EXPORT_SYMBOL_GPL(__xor_neon_4);
+EXPORT_SYMBOL_GPL(__xor_neon_5);
+#endif
+
+#ifdef CONFIG_CRC32_NEON
+EXPORT_SYMBOL_GPL(__crc32_le_neon);
+EXPORT_SYMBOL_GPL(__crc32c_le_neon);
+#endif
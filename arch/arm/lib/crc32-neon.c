@@ -0,0 +1,204 @@
+/*
+ * CRC32 and CRC32c by folding with NEON polynomial multiplies
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * The buffer is folded 16 bytes at a time into a 128 bit remainder, four
+ * of them in parallel for long buffers, and that is reduced to the CRC
+ * with a Barrett reduction, after Gopal et al., "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction".
+ *
+ * All the folding constants fit in 32 bits, so rather than put together
+ * a 64x64 bit carry-less multiply from the 8x8 bit ones ARMv7 NEON has,
+ * as ghash-neon does, a 64x32 bit one takes just four.  The constants are
+ * x^(n-1) mod P instead of x^n mod P, as the product of two bit reflected
+ * values comes out one place short, and are kept as their four bytes.
+ *
+ * This file is built with -mfpu=neon and must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see asm/neon.h.
+ */
+
+#include <arm_neon.h>
+
+struct crc32_neon_consts {
+	uint32_t fold4[2];	/* x^543, x^479: by 64 bytes */
+	uint32_t fold1[2];	/* x^159, x^95: by 16 bytes */
+	uint32_t fold64;	/* x^63: 96 bits to 64 */
+	uint32_t mu;		/* x^64 / P, but for its x^0 term */
+	uint32_t mu_x0;		/* that term */
+	uint32_t poly;		/* P, but for its x^0 term */
+};
+
+static const struct crc32_neon_consts crc32_neon_le = {
+	.fold4	= { 0x8f352d95, 0x1d9513d7 },
+	.fold1	= { 0xae689191, 0xccaa009e },
+	.fold64	= 0xb8bc6765,
+	.mu	= 0xf7011641,
+	.mu_x0	= 1,
+	.poly	= 0xdb710641,
+};
+
+static const struct crc32_neon_consts crc32c_neon_le = {
+	.fold4	= { 0x740eef02, 0x9e4addf8 },
+	.fold1	= { 0xf20c0dfe, 0x493c7d27 },
+	.fold64	= 0xdd45aab8,
+	.mu	= 0xdea713f1,
+	.mu_x0	= 0,
+	.poly	= 0x05ec76f1,
+};
+
+struct crc32_neon_k {
+	uint8x8_t b[4];		/* each byte of a constant, in all lanes */
+};
+
+static inline struct crc32_neon_k crc32_neon_k(uint32_t k)
+{
+	struct crc32_neon_k r;
+
+	r.b[0] = vdup_n_u8(k);
+	r.b[1] = vdup_n_u8(k >> 8);
+	r.b[2] = vdup_n_u8(k >> 16);
+	r.b[3] = vdup_n_u8(k >> 24);
+	return r;
+}
+
+static inline uint16x8_t crc32_neon_p8(uint8x8_t a, uint8x8_t b)
+{
+	return vreinterpretq_u16_p16(vmull_p8(vreinterpret_p8_u8(a),
+					      vreinterpret_p8_u8(b)));
+}
+
+/* @v shifted up by @n bytes, as a 128 bit value */
+#define crc32_neon_shl(v, n)	\
+	vextq_u8(vdupq_n_u8(0), vcombine_u8(v, vdup_n_u8(0)), 16 - (n))
+
+/*
+ * 64x32 -> 96 bit carry-less multiply.  Byte i of @a times byte j of the
+ * constant lands at byte i + j, its high half at i + j + 1.
+ */
+static inline uint64x2_t crc32_neon_mul(uint64x1_t a64,
+					const struct crc32_neon_k *k)
+{
+	uint8x8_t a = vreinterpret_u8_u64(a64);
+	uint16x8_t t0 = crc32_neon_p8(a, k->b[0]);
+	uint16x8_t t1 = crc32_neon_p8(a, k->b[1]);
+	uint16x8_t t2 = crc32_neon_p8(a, k->b[2]);
+	uint16x8_t t3 = crc32_neon_p8(a, k->b[3]);
+	uint8x8_t s1, s2, s3, s4;
+	uint8x16_t r;
+
+	s1 = veor_u8(vmovn_u16(t1), vshrn_n_u16(t0, 8));
+	s2 = veor_u8(vmovn_u16(t2), vshrn_n_u16(t1, 8));
+	s3 = veor_u8(vmovn_u16(t3), vshrn_n_u16(t2, 8));
+	s4 = vshrn_n_u16(t3, 8);
+
+	r = vcombine_u8(vmovn_u16(t0), vdup_n_u8(0));
+	r = veorq_u8(r, crc32_neon_shl(s1, 1));
+	r = veorq_u8(r, crc32_neon_shl(s2, 2));
+	r = veorq_u8(r, crc32_neon_shl(s3, 3));
+	r = veorq_u8(r, crc32_neon_shl(s4, 4));
+	return vreinterpretq_u64_u8(r);
+}
+
+/* @v times x^128, plus @d */
+static inline uint64x2_t crc32_neon_fold(uint64x2_t v,
+					 const struct crc32_neon_k *k,
+					 uint64x2_t d)
+{
+	return veorq_u64(veorq_u64(crc32_neon_mul(vget_low_u64(v), &k[0]),
+				   crc32_neon_mul(vget_high_u64(v), &k[1])),
+			 d);
+}
+
+static inline uint64x2_t crc32_neon_load(const uint8_t *p)
+{
+	return vreinterpretq_u64_u8(vld1q_u8(p));
+}
+
+static inline uint64x1_t crc32_neon_lo32(uint64x1_t v)
+{
+	return vreinterpret_u64_u8(vand_u8(vreinterpret_u8_u64(v),
+		vreinterpret_u8_u64(vcreate_u64(0xffffffffULL))));
+}
+
+static uint32_t crc32_neon(uint32_t crc, const uint8_t *p, unsigned int len,
+			   const struct crc32_neon_consts *c)
+{
+	struct crc32_neon_k k1[2], k;
+	uint64x2_t v0, v1, v2, v3, zero = vdupq_n_u64(0);
+	uint64x1_t x, t;
+
+	k1[0] = crc32_neon_k(c->fold1[0]);
+	k1[1] = crc32_neon_k(c->fold1[1]);
+
+	v0 = veorq_u64(crc32_neon_load(p),
+		       vcombine_u64(vcreate_u64(crc), vcreate_u64(0)));
+	if (len >= 64) {
+		struct crc32_neon_k k4[2];
+
+		k4[0] = crc32_neon_k(c->fold4[0]);
+		k4[1] = crc32_neon_k(c->fold4[1]);
+
+		v1 = crc32_neon_load(p + 16);
+		v2 = crc32_neon_load(p + 32);
+		v3 = crc32_neon_load(p + 48);
+		for (p += 64, len -= 64; len >= 64; p += 64, len -= 64) {
+			v0 = crc32_neon_fold(v0, k4, crc32_neon_load(p));
+			v1 = crc32_neon_fold(v1, k4, crc32_neon_load(p + 16));
+			v2 = crc32_neon_fold(v2, k4, crc32_neon_load(p + 32));
+			v3 = crc32_neon_fold(v3, k4, crc32_neon_load(p + 48));
+		}
+		v0 = crc32_neon_fold(v0, k1, v1);
+		v0 = crc32_neon_fold(v0, k1, v2);
+		v0 = crc32_neon_fold(v0, k1, v3);
+	} else {
+		p += 16;
+		len -= 16;
+	}
+	for (; len >= 16; p += 16, len -= 16)
+		v0 = crc32_neon_fold(v0, k1, crc32_neon_load(p));
+
+	/* 128 bits to 96, then 64 */
+	v0 = veorq_u64(crc32_neon_mul(vget_low_u64(v0), &k1[1]),
+		       vextq_u64(v0, zero, 1));
+	k = crc32_neon_k(c->fold64);
+	x = vget_low_u64(veorq_u64(crc32_neon_mul(crc32_neon_lo32(
+				vget_low_u64(v0)), &k),
+		vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(v0),
+					      vdupq_n_u8(0), 4))));
+
+	/* Barrett: the CRC is x plus (x * mu / x^32) * P, over x^32 */
+	k = crc32_neon_k(c->mu);
+	t = crc32_neon_lo32(x);
+	t = veor_u64(vget_low_u64(crc32_neon_mul(t, &k)),
+		     c->mu_x0 ? vshl_n_u64(t, 32) : vcreate_u64(0));
+	k = crc32_neon_k(c->poly);
+	t = crc32_neon_lo32(t);
+	t = veor_u64(vget_low_u64(crc32_neon_mul(t, &k)), vshl_n_u64(t, 32));
+	return vget_lane_u64(veor_u64(x, t), 0) >> 32;
+}
+
+/*
+ * CRC32 and CRC32c of @len bytes at @p, at least 16 and a multiple of 16,
+ * continuing from @crc.
+ */
+uint32_t __crc32_le_neon(uint32_t crc, const uint8_t *p, unsigned int len)
+{
+	return crc32_neon(crc, p, len, &crc32_neon_le);
+}
+
+uint32_t __crc32c_le_neon(uint32_t crc, const uint8_t *p, unsigned int len)
+{
+	return crc32_neon(crc, p, len, &crc32c_neon_le);
+}
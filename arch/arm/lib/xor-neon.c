@@ -0,0 +1,102 @@
+/*
+ * xor_blocks() with NEON
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * 32 bytes a line, as for the generic 8regs and 32regs templates.
+ *
+ * This file is built with -mfpu=neon and must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see asm/neon.h.
+ */
+
+#include <arm_neon.h>
+
+#define XOR_NEON_LINE	32
+
+#define XOR_NEON_LOAD(p, a, b)	do {			\
+		a = vld1q_u64((const uint64_t *)(p));	\
+		b = vld1q_u64((const uint64_t *)(p) + 2); \
+	} while (0)
+
+#define XOR_NEON_XOR(p, a, b)	do {			\
+		uint64x2_t _x, _y;			\
+							\
+		XOR_NEON_LOAD(p, _x, _y);		\
+		a = veorq_u64(a, _x);			\
+		b = veorq_u64(b, _y);			\
+		(p) += XOR_NEON_LINE / sizeof(*(p));	\
+	} while (0)
+
+#define XOR_NEON_STORE(p, a, b)	do {			\
+		vst1q_u64((uint64_t *)(p), a);		\
+		vst1q_u64((uint64_t *)(p) + 2, b);	\
+		(p) += XOR_NEON_LINE / sizeof(*(p));	\
+	} while (0)
+
+void __xor_neon_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	unsigned long lines = bytes / XOR_NEON_LINE;
+	uint64x2_t a, b;
+
+	do {
+		XOR_NEON_LOAD(p1, a, b);
+		XOR_NEON_XOR(p2, a, b);
+		XOR_NEON_STORE(p1, a, b);
+	} while (--lines);
+}
+
+void __xor_neon_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		  unsigned long *p3)
+{
+	unsigned long lines = bytes / XOR_NEON_LINE;
+	uint64x2_t a, b;
+
+	do {
+		XOR_NEON_LOAD(p1, a, b);
+		XOR_NEON_XOR(p2, a, b);
+		XOR_NEON_XOR(p3, a, b);
+		XOR_NEON_STORE(p1, a, b);
+	} while (--lines);
+}
+
+void __xor_neon_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		  unsigned long *p3, unsigned long *p4)
+{
+	unsigned long lines = bytes / XOR_NEON_LINE;
+	uint64x2_t a, b;
+
+	do {
+		XOR_NEON_LOAD(p1, a, b);
+		XOR_NEON_XOR(p2, a, b);
+		XOR_NEON_XOR(p3, a, b);
+		XOR_NEON_XOR(p4, a, b);
+		XOR_NEON_STORE(p1, a, b);
+	} while (--lines);
+}
+
+void __xor_neon_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		  unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	unsigned long lines = bytes / XOR_NEON_LINE;
+	uint64x2_t a, b;
+
+	do {
+		XOR_NEON_LOAD(p1, a, b);
+		XOR_NEON_XOR(p2, a, b);
+		XOR_NEON_XOR(p3, a, b);
+		XOR_NEON_XOR(p4, a, b);
+		XOR_NEON_XOR(p5, a, b);
+		XOR_NEON_STORE(p1, a, b);
+	} while (--lines);
+}
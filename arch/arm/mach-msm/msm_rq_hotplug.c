@@ -0,0 +1,310 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+/*
+ * Core hotplug driven by the run queue and load stats, in the kernel
+ *
+ * Every sample_ms the average number of runnable tasks since the last
+ * sample, from sched_get_nr_running_avg(), and the load of the online
+ * CPUs at their maximum frequency, from msm_rq_stats, are compared with
+ * per CPU thresholds, scaled by 100 for the former and in percent for the
+ * latter:
+ *
+ *  - if either needs more CPUs than are online to stay within up_nr or
+ *    up_load, as many as it needs are brought up at once, so that a burst
+ *    of work is met in one step rather than one CPU a sample;
+ *  - if both would stay under the lower down_nr and down_load with one CPU
+ *    fewer, for down_samples samples in a row, one CPU is taken down.
+ *
+ * The gap between the up and down thresholds, and the samples a CPU must
+ * have been idle for, keep it from bouncing; a down threshold is only
+ * accepted below its up threshold.  Each decision is traced as
+ * msm_rq_hotplug:rq_hotplug_decision, each CPU brought up or down as
+ * msm_rq_hotplug:rq_hotplug_cpu.
+ *
+ * The sample work is deferrable, so an idle system is not woken up for
+ * it.  This replaces the mpdecision daemon, which must not run as well.
+ */
+
+#define pr_fmt(fmt) "rq_hotplug: " fmt
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/rq_stats.h>
+#define CREATE_TRACE_POINTS
+#include "trace_msm_rq_hotplug.h"
+
+#define DEFAULT_SAMPLE_MS	50
+#define DEFAULT_UP_NR		110
+#define DEFAULT_DOWN_NR		70
+#define DEFAULT_UP_LOAD		80
+#define DEFAULT_DOWN_LOAD	45
+#define DEFAULT_DOWN_SAMPLES	10
+
+struct rq_hotplug {
+	unsigned int enabled;
+	unsigned int sample_ms;
+	unsigned int up_nr;
+	unsigned int down_nr;
+	unsigned int up_load;
+	unsigned int down_load;
+	unsigned int down_samples;
+	unsigned int min_cpus;
+	unsigned int max_cpus;
+	/* samples in a row one CPU fewer would have done */
+	unsigned int down_count;
+	struct delayed_work work;
+	struct mutex lock;
+};
+
+static struct rq_hotplug rq_hp = {
+	.enabled	= 1,
+	.sample_ms	= DEFAULT_SAMPLE_MS,
+	.up_nr		= DEFAULT_UP_NR,
+	.down_nr	= DEFAULT_DOWN_NR,
+	.up_load	= DEFAULT_UP_LOAD,
+	.down_load	= DEFAULT_DOWN_LOAD,
+	.down_samples	= DEFAULT_DOWN_SAMPLES,
+	.min_cpus	= 1,
+	.lock		= __MUTEX_INITIALIZER(rq_hp.lock),
+};
+
+static void rq_hotplug_cpu(unsigned int cpu, bool up)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = up ? cpu_up(cpu) : cpu_down(cpu);
+	trace_rq_hotplug_cpu(cpu, up, ret,
+		(uint32_t) ktime_to_us(ktime_sub(ktime_get(), start)));
+	if (ret)
+		pr_debug("cpu%u %s failed: %d\n", cpu, up ? "up" : "down", ret);
+}
+
+/* Bring CPUs up until @target are online, or one fails */
+static void rq_hotplug_up(unsigned int target)
+{
+	unsigned int cpu;
+
+	for_each_present_cpu(cpu) {
+		if (num_online_cpus() >= target)
+			break;
+		if (cpu_online(cpu))
+			continue;
+		rq_hotplug_cpu(cpu, true);
+		if (!cpu_online(cpu))
+			break;
+	}
+}
+
+/* Take the highest numbered CPU down, never CPU0 */
+static void rq_hotplug_down(void)
+{
+	unsigned int cpu, last = 0;
+
+	for_each_online_cpu(cpu)
+		last = cpu;
+	if (last)
+		rq_hotplug_cpu(last, false);
+}
+
+static void rq_hotplug_work_fn(struct work_struct *work)
+{
+	unsigned int load = 0, online, up, down, target;
+	int nr, iowait, cpu;
+
+	mutex_lock(&rq_hp.lock);
+	if (!rq_hp.enabled)
+		goto out;
+
+	sched_get_nr_running_avg(&nr, &iowait);
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		load += rq_stats_cpu_load(cpu);
+	online = num_online_cpus();
+	put_online_cpus();
+
+	/* CPUs needed to stay within the up thresholds */
+	up = max(DIV_ROUND_UP(nr, rq_hp.up_nr),
+		 DIV_ROUND_UP(load, rq_hp.up_load));
+	/* and fewest that stay under the down thresholds */
+	down = max(nr / rq_hp.down_nr + 1, load / rq_hp.down_load + 1);
+
+	target = online;
+	if (up > online) {
+		target = up;
+		rq_hp.down_count = 0;
+	} else if (down < online) {
+		if (++rq_hp.down_count >= rq_hp.down_samples) {
+			target = online - 1;
+			rq_hp.down_count = 0;
+		}
+	} else {
+		rq_hp.down_count = 0;
+	}
+	target = clamp(target, rq_hp.min_cpus, rq_hp.max_cpus);
+
+	/* hotplug is off limits across suspend */
+	if (rq_info.hotplug_disabled)
+		target = online;
+
+	trace_rq_hotplug_decision(nr, iowait, load, online, target);
+
+	if (target > online)
+		rq_hotplug_up(target);
+	else if (target < online)
+		rq_hotplug_down();
+
+	queue_delayed_work(rq_wq, &rq_hp.work,
+			   msecs_to_jiffies(rq_hp.sample_ms));
+out:
+	mutex_unlock(&rq_hp.lock);
+}
+
+static ssize_t show_enabled(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", rq_hp.enabled);
+}
+
+static ssize_t store_enabled(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	static DEFINE_MUTEX(lock_enabled);
+	unsigned int val;
+
+	if (sscanf(buf, "%u", &val) != 1)
+		return -EINVAL;
+	val = !!val;
+
+	mutex_lock(&lock_enabled);
+	mutex_lock(&rq_hp.lock);
+	if (val == rq_hp.enabled) {
+		mutex_unlock(&rq_hp.lock);
+		goto out;
+	}
+	rq_hp.enabled = val;
+	rq_hp.down_count = 0;
+	mutex_unlock(&rq_hp.lock);
+
+	/* the work takes rq_hp.lock, and stops once it sees !enabled */
+	if (val)
+		queue_delayed_work(rq_wq, &rq_hp.work, 0);
+	else
+		cancel_delayed_work_sync(&rq_hp.work);
+out:
+	mutex_unlock(&lock_enabled);
+	return count;
+}
+
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, S_IWUSR | S_IRUGO, show_enabled, store_enabled);
+
+/* Tunables that must lie within [min, max], evaluated under rq_hp.lock */
+#define RQ_HOTPLUG_ATTR(name, min, max)					\
+static ssize_t show_##name(struct kobject *kobj,			\
+		struct kobj_attribute *attr, char *buf)			\
+{									\
+	return snprintf(buf, PAGE_SIZE, "%u\n", rq_hp.name);		\
+}									\
+									\
+static ssize_t store_##name(struct kobject *kobj,			\
+		struct kobj_attribute *attr, const char *buf,		\
+		size_t count)						\
+{									\
+	unsigned int val;						\
+	ssize_t ret = count;						\
+									\
+	if (sscanf(buf, "%u", &val) != 1)				\
+		return -EINVAL;						\
+	mutex_lock(&rq_hp.lock);					\
+	if (val < (min) || val > (max))					\
+		ret = -EINVAL;						\
+	else								\
+		rq_hp.name = val;					\
+	mutex_unlock(&rq_hp.lock);					\
+	return ret;							\
+}									\
+									\
+static struct kobj_attribute name##_attr =				\
+	__ATTR(name, S_IWUSR | S_IRUGO, show_##name, store_##name)
+
+RQ_HOTPLUG_ATTR(sample_ms, 10, 10000);
+/* a down threshold at or above its up threshold would defeat the hysteresis */
+RQ_HOTPLUG_ATTR(up_nr, rq_hp.down_nr + 1, UINT_MAX);
+RQ_HOTPLUG_ATTR(down_nr, 1, rq_hp.up_nr - 1);
+RQ_HOTPLUG_ATTR(up_load, rq_hp.down_load + 1, 100);
+RQ_HOTPLUG_ATTR(down_load, 1, rq_hp.up_load - 1);
+RQ_HOTPLUG_ATTR(down_samples, 1, UINT_MAX);
+RQ_HOTPLUG_ATTR(min_cpus, 1, rq_hp.max_cpus);
+RQ_HOTPLUG_ATTR(max_cpus, rq_hp.min_cpus, num_possible_cpus());
+
+static struct attribute *rq_hotplug_attrs[] = {
+	&enabled_attr.attr,
+	&sample_ms_attr.attr,
+	&up_nr_attr.attr,
+	&down_nr_attr.attr,
+	&up_load_attr.attr,
+	&down_load_attr.attr,
+	&down_samples_attr.attr,
+	&min_cpus_attr.attr,
+	&max_cpus_attr.attr,
+	NULL,
+};
+
+static struct attribute_group rq_hotplug_attr_group = {
+	.name = "hotplug",
+	.attrs = rq_hotplug_attrs,
+};
+
+static int __init msm_rq_hotplug_init(void)
+{
+	int nr, iowait, cpu, ret;
+
+	/* msm_rq_stats bails out, and leaves nothing to go on, if not SMP */
+	if (!rq_info.init || !rq_info.kobj)
+		return -ENODEV;
+
+	rq_hp.max_cpus = num_possible_cpus();
+	INIT_DELAYED_WORK_DEFERRABLE(&rq_hp.work, rq_hotplug_work_fn);
+
+	/* Create /sys/devices/system/cpu/cpu0/rq-stats/hotplug/... */
+	ret = sysfs_create_group(rq_info.kobj, &rq_hotplug_attr_group);
+	if (ret)
+		return ret;
+
+	/* the first sample should not cover everything since boot */
+	mutex_lock(&rq_hp.lock);
+	sched_get_nr_running_avg(&nr, &iowait);
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		rq_stats_cpu_load(cpu);
+	put_online_cpus();
+	if (rq_hp.enabled)
+		queue_delayed_work(rq_wq, &rq_hp.work,
+				   msecs_to_jiffies(rq_hp.sample_ms));
+	mutex_unlock(&rq_hp.lock);
+
+	return 0;
+}
+late_initcall_sync(msm_rq_hotplug_init);
@@ -152,20 +152,31 @@ static int update_average_load(unsigned int freq, unsigned int cpu)
 	return 0;
 }
 
+/*
+ * Load of @cpu since the last call, as a percentage of what it could do at
+ * its maximum frequency, and start a new window.
+ */
+unsigned int rq_stats_cpu_load(unsigned int cpu)
+{
+	struct cpu_load_data *pcpu = &per_cpu(cpuload, cpu);
+	unsigned int load;
+
+	mutex_lock(&pcpu->cpu_load_mutex);
+	update_average_load(pcpu->cur_freq, cpu);
+	load = pcpu->avg_load_maxfreq;
+	pcpu->avg_load_maxfreq = 0;
+	mutex_unlock(&pcpu->cpu_load_mutex);
+
+	return load;
+}
+
 static unsigned int report_load_at_max_freq(void)
 {
 	int cpu;
-	struct cpu_load_data *pcpu;
 	unsigned int total_load = 0;
 
-	for_each_online_cpu(cpu) {
-		pcpu = &per_cpu(cpuload, cpu);
-		mutex_lock(&pcpu->cpu_load_mutex);
-		update_average_load(pcpu->cur_freq, cpu);
-		total_load += pcpu->avg_load_maxfreq;
-		pcpu->avg_load_maxfreq = 0;
-		mutex_unlock(&pcpu->cpu_load_mutex);
-	}
+	for_each_online_cpu(cpu)
+		total_load += rq_stats_cpu_load(cpu);
 	return total_load;
 }
 
@@ -201,7 +212,17 @@ static int cpu_hotplug_handler(struct notifier_block *nb,
 		if (!this_cpu->cur_freq)
 			this_cpu->cur_freq = acpuclk_get_rate(cpu);
 	case CPU_ONLINE_FROZEN:
+		/*
+		 * Idle time does not advance while offline, so restart the
+		 * window here, or the first sample reads as fully busy.
+		 */
+		mutex_lock(&this_cpu->cpu_load_mutex);
+		this_cpu->prev_cpu_idle = get_cpu_idle_time(cpu,
+						&this_cpu->prev_cpu_wall);
+		this_cpu->prev_cpu_iowait = get_cpu_iowait_time(cpu,
+						&this_cpu->prev_cpu_wall);
 		this_cpu->avg_load_maxfreq = 0;
+		mutex_unlock(&this_cpu->cpu_load_mutex);
 	}
 
 	return NOTIFY_OK;
@@ -0,0 +1,82 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM msm_rq_hotplug
+
+#if !defined(_TRACE_MSM_RQ_HOTPLUG_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_MSM_RQ_HOTPLUG_H_
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(rq_hotplug_decision,
+
+	TP_PROTO(int nr, int iowait, unsigned int load, unsigned int online,
+		unsigned int target),
+
+	TP_ARGS(nr, iowait, load, online, target),
+
+	TP_STRUCT__entry(
+		__field(int, nr)
+		__field(int, iowait)
+		__field(unsigned int, load)
+		__field(unsigned int, online)
+		__field(unsigned int, target)
+	),
+
+	TP_fast_assign(
+		__entry->nr = nr;
+		__entry->iowait = iowait;
+		__entry->load = load;
+		__entry->online = online;
+		__entry->target = target;
+	),
+
+	TP_printk("nr: %d.%02d iowait: %d.%02d load: %u%% online: %u target: %u",
+		__entry->nr / 100, __entry->nr % 100,
+		__entry->iowait / 100, __entry->iowait % 100,
+		__entry->load,
+		__entry->online,
+		__entry->target)
+);
+
+TRACE_EVENT(rq_hotplug_cpu,
+
+	TP_PROTO(unsigned int cpu, bool up, int ret, uint32_t time_us),
+
+	TP_ARGS(cpu, up, ret, time_us),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, cpu)
+		__field(int, up)
+		__field(int, ret)
+		__field(uint32_t, time_us)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = cpu;
+		__entry->up = up;
+		__entry->ret = ret;
+		__entry->time_us = time_us;
+	),
+
+	TP_printk("cpu: %u %s ret: %d time: %uus",
+		__entry->cpu,
+		__entry->up ? "up" : "down",
+		__entry->ret,
+		__entry->time_us)
+);
+#endif
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE trace_msm_rq_hotplug
+#include <trace/define_trace.h>
@@ -11,6 +11,7 @@
 #include <linux/types.h>
 #include <linux/cpu.h>
 #include <linux/cpu_pm.h>
+#include <linux/export.h>
 #include <linux/hardirq.h>
 #include <linux/kernel.h>
 #include <linux/notifier.h>
@@ -547,6 +548,47 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	put_cpu();
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+/*
+ * Kernel mode NEON is only allowed outside of interrupt context and with
+ * preemption disabled, so its register contents never need to be saved.
+ * The VFP state of whichever thread owns the hardware is saved here, and
+ * reloaded lazily on its next VFP instruction.
+ */
+void kernel_neon_begin(void)
+{
+	struct thread_info *thread = current_thread_info();
+	unsigned int cpu;
+	u32 fpexc;
+
+	BUG_ON(in_interrupt());
+	cpu = get_cpu();
+
+	fpexc = fmrx(FPEXC) | FPEXC_EN;
+	fmxr(FPEXC, fpexc);
+
+	/* Under UP the owner may be a thread other than current */
+	if (vfp_state_in_hw(cpu, thread))
+		vfp_save_state(&thread->vfpstate, fpexc);
+#ifndef CONFIG_SMP
+	else if (vfp_current_hw_state[cpu] != NULL)
+		vfp_save_state(vfp_current_hw_state[cpu], fpexc);
+#endif
+	vfp_current_hw_state[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* Disable the unit again, so the next user VFP access traps */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
 /*
  * Save the current VFP state into the provided structures and prepare
  * for entry into a new function (signal handler).
@@ -677,14 +719,15 @@ static int proc_read_status(char *page, char **start, off_t off, int count,
 
 /*
  * VFP support code initialisation.
+ *
+ * This is a core_initcall so that HWCAP_NEON is set before built-in
+ * users of kernel mode NEON test cpu_has_neon() from their initcalls.
  */
 static int __init vfp_init(void)
 {
 	unsigned int vfpsid;
 	unsigned int cpu_arch = cpu_architecture();
-#ifdef CONFIG_PROC_FS
-	static struct proc_dir_entry *procfs_entry;
-#endif
+
 	if (cpu_arch >= CPU_ARCH_ARMv6)
 		on_each_cpu(vfp_enable, NULL, 1);
 
@@ -754,16 +797,26 @@ static int __init vfp_init(void)
 		}
 	}
 
+	return 0;
+}
+
+core_initcall(vfp_init);
+
 #ifdef CONFIG_PROC_FS
+/* /proc/cpu only exists from fs_initcall on */
+static int __init vfp_procfs_init(void)
+{
+	struct proc_dir_entry *procfs_entry;
+
 	procfs_entry = create_proc_entry("cpu/vfp_bounce", S_IRUGO, NULL);
 
 	if (procfs_entry)
 		procfs_entry->read_proc = proc_read_status;
 	else
 		pr_err("Failed to create procfs node for VFP bounce reporting\n");
-#endif
 
 	return 0;
 }
 
-late_initcall(vfp_init);
+late_initcall(vfp_procfs_init);
+#endif
@@ -99,6 +99,32 @@ static const struct row_queue_params row_queues_def[] = {
 #define ROW_IDLE_TIME_MSEC 5
 #define ROW_READ_FREQ_MSEC 20
 
+/*
+ * Values for adapting the dispatch quanta and read idling to the measured
+ * read latency. Every ROW_ADAPT_INTERVAL completions on a READ queue that
+ * idles, its average completion latency is compared with the target.
+ * The configured quanta are scaled by at most 2^ROW_QUANTUM_MAX_SHIFT
+ * either way, and idling is not made longer than ROW_IDLE_TIME_MAX_MSEC.
+ */
+#define ROW_READ_LAT_TARGET_USEC	20000
+#define ROW_ADAPT_INTERVAL		32
+#define ROW_QUANTUM_MAX_SHIFT		3
+#define ROW_IDLE_TIME_MAX_MSEC		20
+
+/* Latency histogram buckets, bucket i counts requests under 2^(i+7) usec */
+#define ROW_LAT_HIST_BUCKETS		16
+#define ROW_LAT_HIST_SHIFT		7
+
+static const char * const row_queue_names[] = {
+	"hp_read",
+	"hp_swrite",
+	"rp_read",
+	"rp_swrite",
+	"rp_write",
+	"lp_read",
+	"lp_swrite",
+};
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
@@ -111,6 +137,24 @@ struct rowq_idling_data {
 	bool			begin_idling;
 };
 
+/**
+ * struct rowq_stats - completion statistics of a queue
+ * @nr_completed:	number of requests completed
+ * @wait_us:		average time from insertion to dispatch (usec)
+ * @lat_us:		average time from insertion to completion (usec)
+ * @lat_hist:		histogram of the completion latency
+ *
+ * The averages are moving averages with a weight of 1/8 for each new
+ * request. The difference between @lat_us and @wait_us is the average
+ * time the device took to serve a request of this queue.
+ */
+struct rowq_stats {
+	unsigned int		nr_completed;
+	unsigned int		wait_us;
+	unsigned int		lat_us;
+	unsigned int		lat_hist[ROW_LAT_HIST_BUCKETS];
+};
+
 /**
  * struct row_queue - requests grouping structure
  * @rdata:		parent row_data structure
@@ -121,7 +165,10 @@ struct rowq_idling_data {
  * @nr_req:		number of requests in queue
  * @dispatch quantum:	number of requests this queue may
  *			dispatch in a dispatch cycle
+ * @quantum_shift:	log2 of the factor disp_quantum is scaled by
+ *			to meet the read latency target
  * @idle_data:		data for idling on queues
+ * @stats:		completion statistics
  *
  */
 struct row_queue {
@@ -133,14 +180,19 @@ struct row_queue {
 
 	unsigned int		nr_req;
 	int			disp_quantum;
+	int			quantum_shift;
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	struct rowq_stats	stats;
 };
 
 /**
  * struct idling_data - data for idling on empty rqueue
  * @idle_time_ms:		idling duration (msec)
+ * @idle_adj_ms:	added to idle_time_ms to meet the read latency
+ *			target (msec)
  * @freq_ms:		min time between two requests that
  *			triger idling (msec)
  * @hr_timer:	idling timer
@@ -150,6 +202,7 @@ struct row_queue {
  */
 struct idling_data {
 	s64				idle_time_ms;
+	s64				idle_adj_ms;
 	s64				freq_ms;
 
 	struct hrtimer			hr_timer;
@@ -187,6 +240,8 @@ struct starvation_data {
  * @reg_prio_starvation: starvation data for REGULAR priority queues
  * @low_prio_starvation: starvation data for LOW priority queues
  * @cycle_flags:	used for marking unserved queueus
+ * @read_lat_target_us: target for the completion latency of READ
+ *			requests (usec), 0 disables adapting to it
  *
  */
 struct row_data {
@@ -206,9 +261,13 @@ struct row_data {
 	struct starvation_data		low_prio_starvation;
 
 	unsigned int			cycle_flags;
+
+	unsigned int			read_lat_target_us;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elv.priv[0]))
+/* Time the request was inserted, in usec */
+#define RQ_ROW_TIME(rq) ((unsigned long) (rq)->elv.priv[1])
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -247,6 +306,96 @@ static inline void __maybe_unused row_dump_queues_stat(struct row_data *rd)
 }
 
 /******************** Static helper functions ***********************/
+static inline unsigned long row_now_us(void)
+{
+	return (unsigned long)ktime_to_us(ktime_get());
+}
+
+static inline unsigned int row_ewma(unsigned int avg, unsigned int sample)
+{
+	return avg - (avg >> 3) + (sample >> 3);
+}
+
+/* Dispatch quantum of @rqueue, the configured one scaled by quantum_shift */
+static inline int row_quantum(struct row_queue *rqueue)
+{
+	int shift = rqueue->quantum_shift;
+
+	if (shift < 0)
+		return max(rqueue->disp_quantum >> -shift, 1);
+	if (rqueue->disp_quantum > INT_MAX >> shift)
+		return INT_MAX;
+	return rqueue->disp_quantum << shift;
+}
+
+/* Read idling time (msec), the configured one plus idle_adj_ms */
+static inline s64 row_idle_time_ms(struct row_data *rd)
+{
+	return rd->rd_idle_data.idle_time_ms + rd->rd_idle_data.idle_adj_ms;
+}
+
+static void row_shift_quantum(struct row_queue *rqueue, int delta)
+{
+	rqueue->quantum_shift = clamp(rqueue->quantum_shift + delta,
+		-ROW_QUANTUM_MAX_SHIFT, ROW_QUANTUM_MAX_SHIFT);
+}
+
+/*
+ * row_adapt_quanta() - Adapt dispatch quanta and read idling to the
+ *			 read latency target
+ * @rd:		pointer to struct row_data
+ * @rqueue:	READ queue whose latency is checked
+ *
+ * If the requests of @rqueue complete slower than the target, give the
+ * queue a bigger share of its priority class and idle longer on it, so
+ * that writes are less likely to get in the way. If they complete well
+ * within the target, move back toward the configured values.
+ *
+ * Only the offsets from the configured quanta and idling time are
+ * changed, never the values set through sysfs.
+ */
+static void row_adapt_quanta(struct row_data *rd, struct row_queue *rqueue)
+{
+	unsigned int target = rd->read_lat_target_us;
+	int start_idx, end_idx, i;
+
+	if (!target)
+		return;
+
+	if (rqueue->prio < ROWQ_REG_PRIO_IDX) {
+		start_idx = ROWQ_HIGH_PRIO_IDX;
+		end_idx = ROWQ_REG_PRIO_IDX;
+	} else {
+		start_idx = ROWQ_REG_PRIO_IDX;
+		end_idx = ROWQ_LOW_PRIO_IDX;
+	}
+
+	if (rqueue->stats.lat_us > target) {
+		row_shift_quantum(rqueue, 1);
+		for (i = start_idx; i < end_idx; i++)
+			if (i != rqueue->prio)
+				row_shift_quantum(&rd->row_queues[i], -1);
+		if (row_idle_time_ms(rd) < ROW_IDLE_TIME_MAX_MSEC)
+			rd->rd_idle_data.idle_adj_ms++;
+	} else if (rqueue->stats.lat_us < target / 2) {
+		if (rqueue->quantum_shift > 0)
+			rqueue->quantum_shift--;
+		for (i = start_idx; i < end_idx; i++)
+			if (i != rqueue->prio &&
+			    rd->row_queues[i].quantum_shift < 0)
+				rd->row_queues[i].quantum_shift++;
+		if (rd->rd_idle_data.idle_adj_ms > 0)
+			rd->rd_idle_data.idle_adj_ms--;
+	} else {
+		return;
+	}
+
+	row_log_rowq(rd, rqueue->prio,
+		"latency %uus (target %uus): quantum %d, idle %dms",
+		rqueue->stats.lat_us, target, row_quantum(rqueue),
+		(int)row_idle_time_ms(rd));
+}
+
 static void kick_queue(struct work_struct *work)
 {
 	struct idling_data *read_data =
@@ -336,6 +485,7 @@ static void row_add_request(struct request_queue *q,
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rqueue->nr_req++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	rq->elv.priv[1] = (void *)row_now_us();
 
 	if (rq->cmd_flags & REQ_URGENT) {
 		WARN_ON(1);
@@ -450,6 +600,16 @@ static int row_reinsert_req(struct request_queue *q,
 static void row_completed_req(struct request_queue *q, struct request *rq)
 {
 	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+	unsigned long lat_us = row_now_us() - RQ_ROW_TIME(rq);
+
+	rqueue->stats.lat_us = row_ewma(rqueue->stats.lat_us, lat_us);
+	rqueue->stats.lat_hist[min(fls(lat_us >> ROW_LAT_HIST_SHIFT),
+				   ROW_LAT_HIST_BUCKETS - 1)]++;
+	rqueue->stats.nr_completed++;
+	if (row_queues_def[rqueue->prio].idling_enabled &&
+	    !(rqueue->stats.nr_completed % ROW_ADAPT_INTERVAL))
+		row_adapt_quanta(rd, rqueue);
 
 	 if (rq->cmd_flags & REQ_URGENT) {
 		if (!rd->urgent_in_flight) {
@@ -522,6 +682,8 @@ static void row_dispatch_insert(struct row_data *rd, struct request *rq)
 	struct row_queue *rqueue = RQ_ROWQ(rq);
 
 	row_remove_request(rd, rq);
+	rqueue->stats.wait_us = row_ewma(rqueue->stats.wait_us,
+					 row_now_us() - RQ_ROW_TIME(rq));
 	elv_dispatch_sort(rd->dispatch_queue, rq);
 	if (rq->cmd_flags & REQ_URGENT) {
 		WARN_ON(rd->urgent_in_flight);
@@ -642,7 +804,7 @@ check_idling:
 
 initiate_idling:
 	hrtimer_start(&rd->rd_idle_data.hr_timer,
-		ktime_set(0, rd->rd_idle_data.idle_time_ms * NSEC_PER_MSEC),
+		ktime_set(0, row_idle_time_ms(rd) * NSEC_PER_MSEC),
 		HRTIMER_MODE_REL);
 
 	rd->rd_idle_data.idling_queue_idx = i;
@@ -660,7 +822,7 @@ static void row_restart_cycle(struct row_data *rd,
 	row_dump_queues_stat(rd);
 	for (i = start_idx; i < end_idx; i++) {
 		if (rd->row_queues[i].nr_dispatched <
-		    rd->row_queues[i].disp_quantum)
+		    row_quantum(&rd->row_queues[i]))
 			row_mark_rowq_unserved(rd, i);
 		rd->row_queues[i].nr_dispatched = 0;
 	}
@@ -688,7 +850,7 @@ static int row_get_next_queue(struct request_queue *q, struct row_data *rd,
 	do {
 		if (list_empty(&rd->row_queues[i].fifo) ||
 		    rd->row_queues[i].nr_dispatched >=
-		    rd->row_queues[i].disp_quantum) {
+		    row_quantum(&rd->row_queues[i])) {
 			i++;
 			if (i == end_idx && restart) {
 				/* Restart cycle for this priority class */
@@ -805,6 +967,7 @@ static void *row_init_queue(struct request_queue *q)
 			ROW_REG_STARVATION_TOLLERANCE;
 	rdata->low_prio_starvation.starvation_limit =
 			ROW_LOW_STARVATION_TOLLERANCE;
+	rdata->read_lat_target_us = ROW_READ_LAT_TARGET_USEC;
 	/*
 	 * Currently idling is enabled only for READ queues. If we want to
 	 * enable it for write queues also, note that idling frequency will
@@ -981,6 +1144,7 @@ SHOW_FUNCTION(row_reg_starv_limit_show,
 	rowd->reg_prio_starvation.starvation_limit);
 SHOW_FUNCTION(row_low_starv_limit_show,
 	rowd->low_prio_starvation.starvation_limit);
+SHOW_FUNCTION(row_read_lat_target_show, rowd->read_lat_target_us);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)			\
@@ -1030,6 +1194,55 @@ STORE_FUNCTION(row_low_starv_limit_store,
 
 #undef STORE_FUNCTION
 
+/*
+ * A new read latency target, or none, starts again from the configured
+ * quanta and idling time.
+ */
+static ssize_t row_read_lat_target_store(struct elevator_queue *e,
+		const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	int data;
+	int ret = row_var_store(&data, page, count);
+	int i;
+
+	rowd->read_lat_target_us = max(data, 0);
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		rowd->row_queues[i].quantum_shift = 0;
+	rowd->rd_idle_data.idle_adj_ms = 0;
+	return ret;
+}
+
+/*
+ * row_latency_show() - Show the completion statistics of all queues
+ *
+ * One line per queue: name, completed requests, average completion
+ * latency, time waiting in the scheduler and service time (usec), the
+ * current dispatch quantum and the completion latency histogram.
+ */
+static ssize_t row_latency_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct rowq_stats *stats;
+	int len = 0;
+	int i, j;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		stats = &rowd->row_queues[i].stats;
+		len += snprintf(page + len, PAGE_SIZE - len,
+			"%s %u %u %u %u %d", row_queue_names[i],
+			stats->nr_completed, stats->lat_us, stats->wait_us,
+			stats->lat_us > stats->wait_us ?
+				stats->lat_us - stats->wait_us : 0,
+			row_quantum(&rowd->row_queues[i]));
+		for (j = 0; j < ROW_LAT_HIST_BUCKETS; j++)
+			len += snprintf(page + len, PAGE_SIZE - len, " %u",
+				stats->lat_hist[j]);
+		len += snprintf(page + len, PAGE_SIZE - len, "\n");
+	}
+	return len;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
@@ -1046,6 +1259,8 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(rd_idle_data_freq),
 	ROW_ATTR(reg_starv_limit),
 	ROW_ATTR(low_starv_limit),
+	ROW_ATTR(read_lat_target),
+	__ATTR(latency, S_IRUGO, row_latency_show, NULL),
 	__ATTR_NULL
 };
 
@@ -0,0 +1,226 @@
+/*
+ * crypto/comp_bench.c
+ *
+ * Compression benchmark. Loading the module reads up to 'pages' pages of
+ * the file at 'path' and compresses and decompresses them one page at a
+ * time, the way zswap and zram do, with each of the crypto_comp algorithms
+ * in 'algs'. Each algorithm reports its ratio and the compression and
+ * decompression rate of the best of 'passes' passes, e.g.
+ *
+ *	insmod comp_bench.ko algs=lzo,lz4,deflate path=/data/app.bin
+ *
+ * Every page is checked to decompress back to what was compressed.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+static char *algs = "lzo,lz4,deflate";
+static char *path = "/system/lib/libc.so";
+static int pages = 256;
+static int passes = 3;
+
+module_param(algs, charp, S_IRUGO);
+module_param(path, charp, S_IRUGO);
+module_param(pages, int, S_IRUGO);
+module_param(passes, int, S_IRUGO);
+
+#define COMP_BENCH_MAX_PAGES	65536
+/* room for the compressed form of any page, as for zswap's buffers */
+#define COMP_BENCH_SLOT		(2 * PAGE_SIZE)
+
+struct comp_bench {
+	u8		*src;		/* the input, nr pages */
+	u8		*dst;		/* a COMP_BENCH_SLOT per page */
+	unsigned int	*dlen;		/* compressed size per page */
+	u8		*out;		/* one decompressed page */
+	int		nr;
+};
+
+/* Read up to @pages pages of @path, a short last page is zero filled */
+static int comp_bench_read(struct comp_bench *b, const char *path)
+{
+	struct file *filp;
+	loff_t pos = 0;
+	int ret = 0;
+
+	filp = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+	if (IS_ERR(filp))
+		return PTR_ERR(filp);
+
+	for (b->nr = 0; b->nr < pages; b->nr++) {
+		u8 *page = b->src + b->nr * PAGE_SIZE;
+
+		ret = kernel_read(filp, pos, (char *) page, PAGE_SIZE);
+		if (ret <= 0)
+			break;
+		if (ret < PAGE_SIZE)
+			memset(page + ret, 0, PAGE_SIZE - ret);
+		pos += ret;
+		ret = 0;
+	}
+	filp_close(filp, NULL);
+	if (ret < 0)
+		return ret;
+	return b->nr ? 0 : -ENODATA;
+}
+
+static int comp_bench_pass(struct crypto_comp *tfm, struct comp_bench *b,
+			   s64 *comp_ns, s64 *decomp_ns, u64 *total)
+{
+	ktime_t start;
+	int i, ret;
+
+	*total = 0;
+	start = ktime_get();
+	for (i = 0; i < b->nr; i++) {
+		b->dlen[i] = COMP_BENCH_SLOT;
+		ret = crypto_comp_compress(tfm, b->src + i * PAGE_SIZE,
+					   PAGE_SIZE,
+					   b->dst + i * COMP_BENCH_SLOT,
+					   &b->dlen[i]);
+		if (ret)
+			return ret;
+		*total += b->dlen[i];
+	}
+	*comp_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < b->nr; i++) {
+		unsigned int len = PAGE_SIZE;
+
+		ret = crypto_comp_decompress(tfm, b->dst + i * COMP_BENCH_SLOT,
+					     b->dlen[i], b->out, &len);
+		if (ret)
+			return ret;
+	}
+	*decomp_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	/* and again outside the timing, to check every page */
+	for (i = 0; i < b->nr; i++) {
+		unsigned int len = PAGE_SIZE;
+
+		ret = crypto_comp_decompress(tfm, b->dst + i * COMP_BENCH_SLOT,
+					     b->dlen[i], b->out, &len);
+		if (ret)
+			return ret;
+		if (len != PAGE_SIZE ||
+		    memcmp(b->out, b->src + i * PAGE_SIZE, PAGE_SIZE))
+			return -EILSEQ;
+	}
+	cond_resched();
+	return 0;
+}
+
+/* in KB/s, as MB/s would truncate the slow end to nothing */
+static u64 comp_bench_rate(u64 bytes, s64 ns)
+{
+	return ns > 0 ? div64_u64(bytes * NSEC_PER_SEC, ns) >> 10 : 0;
+}
+
+static int comp_bench_alg(const char *alg, struct comp_bench *b)
+{
+	struct crypto_comp *tfm;
+	s64 comp_ns, decomp_ns, best_comp = 0, best_decomp = 0;
+	u64 bytes = (u64) b->nr * PAGE_SIZE, total = 0;
+	int i, ret = 0;
+
+	tfm = crypto_alloc_comp(alg, 0, 0);
+	if (IS_ERR(tfm)) {
+		pr_err("comp_bench: %s: not available: %ld\n", alg,
+		       PTR_ERR(tfm));
+		return PTR_ERR(tfm);
+	}
+
+	for (i = 0; i < passes; i++) {
+		ret = comp_bench_pass(tfm, b, &comp_ns, &decomp_ns, &total);
+		if (ret) {
+			pr_err("comp_bench: %s: pass %d failed: %d\n", alg, i,
+			       ret);
+			goto out;
+		}
+		if (!i || comp_ns < best_comp)
+			best_comp = comp_ns;
+		if (!i || decomp_ns < best_decomp)
+			best_decomp = decomp_ns;
+	}
+
+	pr_info("comp_bench: %s: %d pages to %llu bytes, ratio %llu.%02llu%%, "
+		"compress %llu KB/s, decompress %llu KB/s\n",
+		crypto_comp_name(tfm), b->nr, total,
+		div64_u64(total * 100, bytes),
+		div64_u64(total * 10000, bytes) % 100,
+		comp_bench_rate(bytes, best_comp),
+		comp_bench_rate(bytes, best_decomp));
+out:
+	crypto_free_comp(tfm);
+	return ret;
+}
+
+static int __init comp_bench_init(void)
+{
+	struct comp_bench b = { };
+	char *list, *p, *alg;
+	int ret;
+
+	if (passes <= 0 || pages <= 0 || pages > COMP_BENCH_MAX_PAGES)
+		return -EINVAL;
+
+	list = kstrdup(algs, GFP_KERNEL);
+	b.src = vmalloc(pages * PAGE_SIZE);
+	b.dst = vmalloc(pages * COMP_BENCH_SLOT);
+	b.dlen = vmalloc(pages * sizeof(*b.dlen));
+	b.out = vmalloc(PAGE_SIZE);
+	if (!list || !b.src || !b.dst || !b.dlen || !b.out) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = comp_bench_read(&b, path);
+	if (ret) {
+		pr_err("comp_bench: reading %s: %d\n", path, ret);
+		goto out;
+	}
+	pr_info("comp_bench: %d pages of %s\n", b.nr, path);
+
+	/* an algorithm that fails is reported, the others still run */
+	p = list;
+	while ((alg = strsep(&p, ",")) != NULL) {
+		if (*alg && comp_bench_alg(alg, &b) && !ret)
+			ret = -EIO;
+	}
+out:
+	vfree(b.out);
+	vfree(b.dlen);
+	vfree(b.dst);
+	vfree(b.src);
+	kfree(list);
+	return ret;
+}
+
+static void __exit comp_bench_exit(void)
+{
+}
+
+module_init(comp_bench_init);
+module_exit(comp_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compression benchmark");
@@ -943,6 +943,15 @@ static inline int tcrypt_test(const char *alg)
 	return ret;
 }
 
+/* AES backends compared by mode 504, by driver name */
+static const struct {
+	const char *cbc, *ctr, *xts;
+} aes_speed_drivers[] = {
+	{ "cbc(aes-generic)", "ctr(aes-generic)", "xts(aes-generic)" },
+	{ "cbc-aes-neonbs", "ctr-aes-neonbs", "xts-aes-neonbs" },
+	{ "qcrypto-cbc-aes", "qcrypto-ctr-aes", "qcrypto-xts-aes" },
+};
+
 static int do_test(int m)
 {
 	int i;
@@ -1414,6 +1423,10 @@ static int do_test(int m)
 		test_hash_speed("ghash-generic", sec, hash_speed_template_16);
 		if (mode > 300 && mode < 400) break;
 
+	case 319:
+		test_hash_speed("ghash-neon", sec, hash_speed_template_16);
+		if (mode > 300 && mode < 400) break;
+
 	case 399:
 		break;
 
@@ -1488,6 +1501,24 @@ static int do_test(int m)
 		test_ahash_speed("rmd320", sec, generic_hash_speed_template);
 		if (mode > 400 && mode < 500) break;
 
+	case 418:
+		/* the software and crypto engine backends side by side */
+		test_ahash_speed("sha1-generic", sec,
+				 generic_hash_speed_template);
+		test_ahash_speed("sha1-neon", sec, generic_hash_speed_template);
+		test_ahash_speed("qcrypto-sha1", sec,
+				 generic_hash_speed_template);
+		if (mode > 400 && mode < 500) break;
+
+	case 419:
+		test_ahash_speed("sha256-generic", sec,
+				 generic_hash_speed_template);
+		test_ahash_speed("sha256-neon", sec,
+				 generic_hash_speed_template);
+		test_ahash_speed("qcrypto-sha256", sec,
+				 generic_hash_speed_template);
+		if (mode > 400 && mode < 500) break;
+
 	case 499:
 		break;
 
@@ -1563,6 +1594,22 @@ static int do_test(int m)
 				   speed_template_32_64);
 		break;
 
+	case 504:
+		/* the software and crypto engine backends side by side */
+		for (i = 0; i < ARRAY_SIZE(aes_speed_drivers); i++) {
+			test_acipher_speed(aes_speed_drivers[i].cbc, ENCRYPT,
+					   sec, NULL, 0, speed_template_16_32);
+			test_acipher_speed(aes_speed_drivers[i].cbc, DECRYPT,
+					   sec, NULL, 0, speed_template_16_32);
+			test_acipher_speed(aes_speed_drivers[i].ctr, ENCRYPT,
+					   sec, NULL, 0, speed_template_16_32);
+			test_acipher_speed(aes_speed_drivers[i].xts, ENCRYPT,
+					   sec, NULL, 0, speed_template_32_64);
+			test_acipher_speed(aes_speed_drivers[i].xts, DECRYPT,
+					   sec, NULL, 0, speed_template_32_64);
+		}
+		break;
+
 	case 1000:
 		test_available();
 		break;
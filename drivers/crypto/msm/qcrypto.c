@@ -24,6 +24,7 @@
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
 #include <linux/debugfs.h>
+#include <linux/ktime.h>
 
 #include <crypto/ctr.h>
 #include <crypto/des.h>
@@ -44,7 +45,7 @@
 
 #define MAX_CRYPTO_DEVICE 3
 #define DEBUG_MAX_FNAME  16
-#define DEBUG_MAX_RW_BUF 1024
+#define DEBUG_MAX_RW_BUF 2048
 
 struct crypto_stat {
 	u32 aead_sha1_aes_enc;
@@ -71,6 +72,16 @@ struct crypto_stat {
 	u32 sha256_hmac_digest;
 	u32 sha_hmac_op_success;
 	u32 sha_hmac_op_fail;
+	u32 disp_ce;
+	u32 disp_ce_spread;
+	u32 disp_sw_small;
+	u32 disp_sw_busy;
+	u32 ce_done;
+	u64 ce_lat_total_us;
+	u32 ce_lat_max_us;
+	u32 sw_done;
+	u64 sw_lat_total_us;
+	u32 sw_lat_max_us;
 };
 static struct crypto_stat _qcrypto_stat[MAX_CRYPTO_DEVICE];
 static struct dentry *_debug_dent;
@@ -111,6 +122,24 @@ struct crypto_priv {
 	struct tasklet_struct done_tasklet;
 };
 
+/* probed engines, indexed by platform device id */
+static struct crypto_priv *qcrypto_engines[MAX_CRYPTO_DEVICE];
+
+/*
+ * Requests of up to sw_max_bytes are done on the CPU: for those, setting
+ * up the CE descriptors and taking the completion interrupt costs more
+ * than the operation.  So are all requests once every engine they could
+ * go to has ce_max_depth requests outstanding.  0 disables either.
+ */
+static unsigned int sw_max_bytes = 512;
+module_param(sw_max_bytes, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(sw_max_bytes, "Requests up to this size are done on the CPU");
+
+static unsigned int ce_max_depth = 8;
+module_param(ce_max_depth, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(ce_max_depth,
+		"Requests queued on each engine before using the CPU");
+
 
 /*-------------------------------------------------------------------------
 * Resource Locking Service
@@ -204,6 +233,12 @@ struct qcrypto_alg {
 /* max of AES_BLOCK_SIZE, DES3_EDE_BLOCK_SIZE */
 #define QCRYPTO_MAX_IV_LENGTH	16
 
+/* engine a request was queued on, and when */
+struct qcrypto_req_disp {
+	struct crypto_priv *cp;
+	ktime_t start;
+};
+
 struct qcrypto_cipher_ctx {
 	u8 auth_key[QCRYPTO_MAX_KEY_SIZE];
 	u8 iv[QCRYPTO_MAX_IV_LENGTH];
@@ -215,6 +250,13 @@ struct qcrypto_cipher_ctx {
 	unsigned int auth_key_len;
 
 	struct crypto_priv *cp;
+
+	/* other engines ablkcipher requests may be spread to */
+	unsigned long engines;
+
+	/* synchronous implementation for requests done on the CPU */
+	struct crypto_blkcipher *sw_tfm;
+	bool sw_key_ok;
 };
 
 struct qcrypto_cipher_req_ctx {
@@ -235,6 +277,7 @@ struct qcrypto_cipher_req_ctx {
 	struct scatterlist ssg;		/* Source Data sg  */
 	unsigned char *data;		/* Incoming data pointer*/
 
+	struct qcrypto_req_disp disp;
 };
 
 #define SHA_MAX_BLOCK_SIZE      SHA256_BLOCK_SIZE
@@ -273,6 +316,9 @@ struct qcrypto_sha_ctx {
 	struct scatterlist *sg;
 	struct scatterlist tmp_sg;
 	struct crypto_priv *cp;
+
+	/* synchronous implementation for digests done on the CPU */
+	struct crypto_shash *sw_tfm;
 };
 
 struct qcrypto_sha_req_ctx {
@@ -287,6 +333,8 @@ struct qcrypto_sha_req_ctx {
 	struct scatterlist dsg;		/* Data sg */
 	unsigned char *data;		/* Incoming data pointer*/
 	unsigned char *data2;		/* Updated data pointer*/
+
+	struct qcrypto_req_disp disp;
 };
 
 static void _byte_stream_to_words(uint32_t *iv, unsigned char *b,
@@ -393,6 +441,116 @@ static void qcrypto_ce_high_bw_req(struct crypto_priv *cp, bool high_bw_req)
 	mutex_unlock(&qcrypto_sent_bw_req);
 }
 
+/*
+ * Engines with the same features and key support can run each other's
+ * ablkcipher requests, the key being passed along with each request.
+ */
+static bool _qcrypto_engine_compatible(struct crypto_priv *home,
+				struct crypto_priv *cp)
+{
+	return cp != home &&
+		!memcmp(&cp->ce_support, &home->ce_support,
+				sizeof(cp->ce_support)) &&
+		cp->platform_support.hw_key_support ==
+				home->platform_support.hw_key_support &&
+		cp->platform_support.ce_shared ==
+				home->platform_support.ce_shared;
+}
+
+/*
+ * Vote for (or drop) bandwidth on the engines other than @home that a tfm
+ * may spread its requests to, as its init already does on @home.  On the
+ * way up, *engines is set to those, on the way down it is what is undone.
+ */
+static void _qcrypto_spread_bw_req(struct crypto_priv *home,
+				unsigned long *engines, bool high_bw_req)
+{
+	struct crypto_priv *cp;
+	int i;
+
+	if (high_bw_req) {
+		*engines = 0;
+		for (i = 0; i < MAX_CRYPTO_DEVICE; i++) {
+			cp = qcrypto_engines[i];
+			if (cp && _qcrypto_engine_compatible(home, cp))
+				*engines |= 1UL << i;
+		}
+	}
+
+	for (i = 0; i < MAX_CRYPTO_DEVICE; i++) {
+		if (!(*engines & (1UL << i)))
+			continue;
+		cp = qcrypto_engines[i];
+		if (cp->platform_support.bus_scale_table != NULL)
+			qcrypto_ce_high_bw_req(cp, high_bw_req);
+	}
+
+	if (!high_bw_req)
+		*engines = 0;
+}
+
+static unsigned int _qcrypto_engine_depth(struct crypto_priv *cp)
+{
+	return cp->queue.qlen + (cp->req != NULL);
+}
+
+/*
+ * The engine of @home and @engines with the fewest requests outstanding,
+ * @home on a tie.  The depths are sampled without the engine locks, which
+ * is good enough for balancing.
+ */
+static struct crypto_priv *_qcrypto_select_engine(struct crypto_priv *home,
+				unsigned long engines, unsigned int *depth)
+{
+	struct crypto_priv *best = home;
+	unsigned int d;
+	int i;
+
+	*depth = _qcrypto_engine_depth(home);
+	for (i = 0; i < MAX_CRYPTO_DEVICE && *depth; i++) {
+		if (!(engines & (1UL << i)))
+			continue;
+		d = _qcrypto_engine_depth(qcrypto_engines[i]);
+		if (d < *depth) {
+			*depth = d;
+			best = qcrypto_engines[i];
+		}
+	}
+	return best;
+}
+
+/* Should a request of @nbytes be done on the CPU rather than the CE? */
+static bool _qcrypto_sw_route(struct crypto_priv *home, unsigned long engines,
+				unsigned int nbytes)
+{
+	struct crypto_stat *pstat = &_qcrypto_stat[home->pdev->id];
+	unsigned int depth;
+
+	if (nbytes <= sw_max_bytes) {
+		pstat->disp_sw_small++;
+		return true;
+	}
+	if (ce_max_depth) {
+		_qcrypto_select_engine(home, engines, &depth);
+		if (depth >= ce_max_depth) {
+			pstat->disp_sw_busy++;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void _qcrypto_account_lat(u32 *done, u64 *total, u32 *max,
+				ktime_t start)
+{
+	u32 us = min_t(s64, ktime_us_delta(ktime_get(), start), UINT_MAX);
+
+	(*done)++;
+	*total += us;
+	if (us > *max)
+		*max = us;
+}
+
 static int _start_qcrypto_process(struct crypto_priv *cp);
 
 static int qcrypto_count_sg(struct scatterlist *sg, int nbytes)
@@ -458,6 +616,10 @@ static int _qcrypto_cipher_cra_init(struct crypto_tfm *tfm)
 	if (ctx->cp->platform_support.bus_scale_table != NULL)
 		qcrypto_ce_high_bw_req(ctx->cp, true);
 
+	ctx->engines = 0;
+	ctx->sw_tfm = NULL;
+	ctx->sw_key_ok = false;
+
 	return 0;
 };
 
@@ -492,6 +654,7 @@ static int _qcrypto_ahash_cra_init(struct crypto_tfm *tfm)
 	}
 
 	sha_ctx->ahash_req = NULL;
+	sha_ctx->sw_tfm = NULL;
 	if (sha_ctx->cp->platform_support.bus_scale_table != NULL)
 		qcrypto_ce_high_bw_req(sha_ctx->cp, true);
 
@@ -514,10 +677,31 @@ static void _qcrypto_ahash_cra_exit(struct crypto_tfm *tfm)
 		ahash_request_free(sha_ctx->ahash_req);
 		sha_ctx->ahash_req = NULL;
 	}
+	if (sha_ctx->sw_tfm != NULL) {
+		crypto_free_shash(sha_ctx->sw_tfm);
+		sha_ctx->sw_tfm = NULL;
+	}
 	if (sha_ctx->cp->platform_support.bus_scale_table != NULL)
 		qcrypto_ce_high_bw_req(sha_ctx->cp, false);
 };
 
+static int _qcrypto_ahash_sha_cra_init(struct crypto_tfm *tfm)
+{
+	struct qcrypto_sha_ctx *sha_ctx = crypto_tfm_ctx(tfm);
+	int ret;
+
+	ret = _qcrypto_ahash_cra_init(tfm);
+	if (ret)
+		return ret;
+
+	/* without one, every digest goes to the CE */
+	sha_ctx->sw_tfm = crypto_alloc_shash(crypto_tfm_alg_name(tfm), 0, 0);
+	if (IS_ERR(sha_ctx->sw_tfm))
+		sha_ctx->sw_tfm = NULL;
+
+	return 0;
+};
+
 
 static void _crypto_sha_hmac_ahash_req_complete(
 	struct crypto_async_request *req, int err);
@@ -550,8 +734,23 @@ static int _qcrypto_ahash_hmac_cra_init(struct crypto_tfm *tfm)
 
 static int _qcrypto_cra_ablkcipher_init(struct crypto_tfm *tfm)
 {
+	struct qcrypto_cipher_ctx *ctx = crypto_tfm_ctx(tfm);
+	int ret;
+
 	tfm->crt_ablkcipher.reqsize = sizeof(struct qcrypto_cipher_req_ctx);
-	return _qcrypto_cipher_cra_init(tfm);
+	ret = _qcrypto_cipher_cra_init(tfm);
+	if (ret)
+		return ret;
+
+	_qcrypto_spread_bw_req(ctx->cp, &ctx->engines, true);
+
+	/* without one, every request goes to the CE */
+	ctx->sw_tfm = crypto_alloc_blkcipher(crypto_tfm_alg_name(tfm), 0,
+						CRYPTO_ALG_ASYNC);
+	if (IS_ERR(ctx->sw_tfm))
+		ctx->sw_tfm = NULL;
+
+	return 0;
 };
 
 static int _qcrypto_cra_aead_init(struct crypto_tfm *tfm)
@@ -564,6 +763,11 @@ static void _qcrypto_cra_ablkcipher_exit(struct crypto_tfm *tfm)
 {
 	struct qcrypto_cipher_ctx *ctx = crypto_tfm_ctx(tfm);
 
+	if (ctx->sw_tfm != NULL) {
+		crypto_free_blkcipher(ctx->sw_tfm);
+		ctx->sw_tfm = NULL;
+	}
+	_qcrypto_spread_bw_req(ctx->cp, &ctx->engines, false);
 	if (ctx->cp->platform_support.bus_scale_table != NULL)
 		qcrypto_ce_high_bw_req(ctx->cp, false);
 };
@@ -579,6 +783,7 @@ static void _qcrypto_cra_aead_exit(struct crypto_tfm *tfm)
 static int _disp_stats(int id)
 {
 	struct crypto_stat *pstat;
+	u64 ce_avg = 0, sw_avg = 0;
 	int len = 0;
 
 	if (id < 0) {
@@ -586,6 +791,10 @@ static int _disp_stats(int id)
 		return len;
 	}
 	pstat = &_qcrypto_stat[id];
+	if (pstat->ce_done)
+		ce_avg = div_u64(pstat->ce_lat_total_us, pstat->ce_done);
+	if (pstat->sw_done)
+		sw_avg = div_u64(pstat->sw_lat_total_us, pstat->sw_done);
 	len = snprintf(_debug_read_buf, DEBUG_MAX_RW_BUF - 1,
 			"\nQualcomm crypto accelerator %d Statistics:\n",
 				id + 1);
@@ -670,6 +879,25 @@ static int _disp_stats(int id)
 	len += snprintf(_debug_read_buf + len, DEBUG_MAX_RW_BUF - len - 1,
 			"   SHA HMAC operation success          : %d\n",
 					pstat->sha_hmac_op_success);
+
+	len += snprintf(_debug_read_buf + len, DEBUG_MAX_RW_BUF - len - 1,
+			"   Dispatched to CE             : %d\n",
+					pstat->disp_ce);
+	len += snprintf(_debug_read_buf + len, DEBUG_MAX_RW_BUF - len - 1,
+			"   Dispatched to other CE       : %d\n",
+					pstat->disp_ce_spread);
+	len += snprintf(_debug_read_buf + len, DEBUG_MAX_RW_BUF - len - 1,
+			"   Dispatched to CPU, small     : %d\n",
+					pstat->disp_sw_small);
+	len += snprintf(_debug_read_buf + len, DEBUG_MAX_RW_BUF - len - 1,
+			"   Dispatched to CPU, CE busy   : %d\n",
+					pstat->disp_sw_busy);
+	len += snprintf(_debug_read_buf + len, DEBUG_MAX_RW_BUF - len - 1,
+			"   CE latency avg/max (us)      : %llu/%u over %u\n",
+			ce_avg, pstat->ce_lat_max_us, pstat->ce_done);
+	len += snprintf(_debug_read_buf + len, DEBUG_MAX_RW_BUF - len - 1,
+			"   CPU latency avg/max (us)     : %llu/%u over %u\n",
+			sw_avg, pstat->sw_lat_max_us, pstat->sw_done);
 	return len;
 }
 
@@ -684,6 +912,9 @@ static int _qcrypto_remove(struct platform_device *pdev)
 	if (!cp)
 		return 0;
 
+	if (qcrypto_engines[pdev->id] == cp)
+		qcrypto_engines[pdev->id] = NULL;
+
 	if (cp->platform_support.bus_scale_table != NULL)
 		msm_bus_scale_unregister_client(cp->bus_scale_handle);
 
@@ -723,6 +954,20 @@ static int _qcrypto_check_aes_keylen(struct crypto_ablkcipher *cipher,
 	return 0;
 }
 
+/* Key the CPU implementation too; requests go to the CE if it refuses */
+static void _qcrypto_sw_setkey(struct crypto_tfm *tfm, const u8 *key,
+		unsigned int len)
+{
+	struct qcrypto_cipher_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	if (ctx->sw_tfm == NULL)
+		return;
+	crypto_blkcipher_clear_flags(ctx->sw_tfm, ~0);
+	crypto_blkcipher_set_flags(ctx->sw_tfm,
+				tfm->crt_flags & CRYPTO_TFM_REQ_MASK);
+	ctx->sw_key_ok = !crypto_blkcipher_setkey(ctx->sw_tfm, key, len);
+}
+
 static int _qcrypto_setkey_aes(struct crypto_ablkcipher *cipher, const u8 *key,
 		unsigned int len)
 {
@@ -736,6 +981,7 @@ static int _qcrypto_setkey_aes(struct crypto_ablkcipher *cipher, const u8 *key,
 		ctx->enc_key_len = len;
 		memcpy(ctx->enc_key, key, len);
 	}
+	_qcrypto_sw_setkey(tfm, key, len);
 	return 0;
 };
 
@@ -753,6 +999,7 @@ static int _qcrypto_setkey_aes_xts(struct crypto_ablkcipher *cipher,
 		ctx->enc_key_len = len;
 		memcpy(ctx->enc_key, key, len);
 	}
+	_qcrypto_sw_setkey(tfm, key, len);
 	return 0;
 };
 
@@ -776,6 +1023,7 @@ static int _qcrypto_setkey_des(struct crypto_ablkcipher *cipher, const u8 *key,
 
 	ctx->enc_key_len = len;
 	memcpy(ctx->enc_key, key, len);
+	_qcrypto_sw_setkey(tfm, key, len);
 	return 0;
 };
 
@@ -791,13 +1039,36 @@ static int _qcrypto_setkey_3des(struct crypto_ablkcipher *cipher, const u8 *key,
 	};
 	ctx->enc_key_len = len;
 	memcpy(ctx->enc_key, key, len);
+	_qcrypto_sw_setkey(tfm, key, len);
 	return 0;
 };
 
+static struct qcrypto_req_disp *_qcrypto_req_disp(
+		struct crypto_async_request *async_req)
+{
+	struct qcrypto_cipher_req_ctx *rctx;
+	struct qcrypto_sha_req_ctx *sha_rctx;
+
+	switch (crypto_tfm_alg_type(async_req->tfm)) {
+	case CRYPTO_ALG_TYPE_ABLKCIPHER:
+		rctx = ablkcipher_request_ctx(
+				ablkcipher_request_cast(async_req));
+		return &rctx->disp;
+	case CRYPTO_ALG_TYPE_AHASH:
+		sha_rctx = ahash_request_ctx(ahash_request_cast(async_req));
+		return &sha_rctx->disp;
+	default:
+		rctx = aead_request_ctx(container_of(async_req,
+					struct aead_request, base));
+		return &rctx->disp;
+	}
+}
+
 static void req_done(unsigned long data)
 {
 	struct crypto_async_request *areq;
 	struct crypto_priv *cp = (struct crypto_priv *)data;
+	struct crypto_stat *pstat = &_qcrypto_stat[cp->pdev->id];
 	unsigned long flags;
 
 	spin_lock_irqsave(&cp->lock, flags);
@@ -805,8 +1076,12 @@ static void req_done(unsigned long data)
 	cp->req = NULL;
 	spin_unlock_irqrestore(&cp->lock, flags);
 
-	if (areq)
+	if (areq) {
+		_qcrypto_account_lat(&pstat->ce_done, &pstat->ce_lat_total_us,
+				&pstat->ce_lat_max_us,
+				_qcrypto_req_disp(areq)->start);
 		areq->complete(areq, cp->res);
+	}
 	_start_qcrypto_process(cp);
 };
 
@@ -913,7 +1188,8 @@ static void _qce_ablk_cipher_complete(void *cookie, unsigned char *icb,
 	struct ablkcipher_request *areq = (struct ablkcipher_request *) cookie;
 	struct crypto_ablkcipher *ablk = crypto_ablkcipher_reqtfm(areq);
 	struct qcrypto_cipher_ctx *ctx = crypto_tfm_ctx(areq->base.tfm);
-	struct crypto_priv *cp = ctx->cp;
+	struct qcrypto_cipher_req_ctx *disp_rctx = ablkcipher_request_ctx(areq);
+	struct crypto_priv *cp = disp_rctx->disp.cp;
 	struct crypto_stat *pstat;
 
 	pstat = &_qcrypto_stat[cp->pdev->id];
@@ -1407,12 +1683,96 @@ again:
 	return ret;
 };
 
+static int _qcrypto_sw_ablkcipher(struct crypto_priv *cp,
+				struct ablkcipher_request *req)
+{
+	struct qcrypto_cipher_ctx *ctx = crypto_tfm_ctx(req->base.tfm);
+	struct qcrypto_cipher_req_ctx *rctx = ablkcipher_request_ctx(req);
+	struct crypto_stat *pstat = &_qcrypto_stat[cp->pdev->id];
+	struct blkcipher_desc desc;
+	ktime_t start = ktime_get();
+	int ret;
+
+	desc.tfm = ctx->sw_tfm;
+	desc.info = req->info;
+	desc.flags = 0;
+
+	if (rctx->dir == QCE_ENCRYPT)
+		ret = crypto_blkcipher_encrypt_iv(&desc, req->dst, req->src,
+						req->nbytes);
+	else
+		ret = crypto_blkcipher_decrypt_iv(&desc, req->dst, req->src,
+						req->nbytes);
+
+	_qcrypto_account_lat(&pstat->sw_done, &pstat->sw_lat_total_us,
+				&pstat->sw_lat_max_us, start);
+	if (ret)
+		pstat->ablk_cipher_op_fail++;
+	else
+		pstat->ablk_cipher_op_success++;
+	return ret;
+}
+
+static int _qcrypto_sw_ahash_digest(struct crypto_priv *cp,
+				struct ahash_request *req)
+{
+	struct qcrypto_sha_ctx *sha_ctx = crypto_tfm_ctx(req->base.tfm);
+	struct crypto_stat *pstat = &_qcrypto_stat[cp->pdev->id];
+	struct {
+		struct shash_desc shash;
+		char ctx[crypto_shash_descsize(sha_ctx->sw_tfm)];
+	} desc;
+	ktime_t start = ktime_get();
+	int ret;
+
+	desc.shash.tfm = sha_ctx->sw_tfm;
+	desc.shash.flags = 0;
+	ret = shash_ahash_digest(req, &desc.shash);
+
+	_qcrypto_account_lat(&pstat->sw_done, &pstat->sw_lat_total_us,
+				&pstat->sw_lat_max_us, start);
+	if (ret)
+		pstat->sha_op_fail++;
+	else
+		pstat->sha_op_success++;
+	return ret;
+}
+
+/*
+ * Queue @req on the engine of its tfm, @cp, or for an ablkcipher on the
+ * least busy compatible engine, or do it on the CPU right away.
+ */
 static int _qcrypto_queue_req(struct crypto_priv *cp,
 				struct crypto_async_request *req)
 {
+	struct crypto_stat *pstat = &_qcrypto_stat[cp->pdev->id];
+	struct qcrypto_req_disp *disp = _qcrypto_req_disp(req);
+	struct crypto_priv *home = cp;
+	unsigned long engines = 0;
+	unsigned int depth;
 	int ret;
 	unsigned long flags;
 
+	if (crypto_tfm_alg_type(req->tfm) == CRYPTO_ALG_TYPE_ABLKCIPHER) {
+		struct ablkcipher_request *areq = ablkcipher_request_cast(req);
+		struct qcrypto_cipher_ctx *ctx = crypto_tfm_ctx(req->tfm);
+
+		/* a hardware key only exists on the tfm's own engine */
+		if (ctx->enc_key_len) {
+			engines = ctx->engines;
+			if (ctx->sw_key_ok &&
+			    _qcrypto_sw_route(cp, engines, areq->nbytes))
+				return _qcrypto_sw_ablkcipher(cp, areq);
+		}
+		cp = _qcrypto_select_engine(cp, engines, &depth);
+	}
+
+	disp->cp = cp;
+	disp->start = ktime_get();
+	pstat->disp_ce++;
+	if (cp != home)
+		pstat->disp_ce_spread++;
+
 	if (cp->platform_support.ce_shared) {
 		ret = qcrypto_lock_ce(cp);
 		if (ret)
@@ -2560,6 +2920,9 @@ static int _sha_digest(struct ahash_request *req)
 	struct crypto_priv *cp = sha_ctx->cp;
 	int ret = 0;
 
+	if (sha_ctx->sw_tfm != NULL && _qcrypto_sw_route(cp, 0, req->nbytes))
+		return _qcrypto_sw_ahash_digest(cp, req);
+
 	if (cp->ce_support.aligned_only) {
 		if (_copy_source(req))
 			return -ENOMEM;
@@ -2909,7 +3272,7 @@ static struct ahash_alg _qcrypto_ahash_algos[] = {
 				.cra_alignmask	 = 0,
 				.cra_type	 = &crypto_ahash_type,
 				.cra_module	 = THIS_MODULE,
-				.cra_init	 = _qcrypto_ahash_cra_init,
+				.cra_init	 = _qcrypto_ahash_sha_cra_init,
 				.cra_exit	 = _qcrypto_ahash_cra_exit,
 			},
 		},
@@ -2936,7 +3299,7 @@ static struct ahash_alg _qcrypto_ahash_algos[] = {
 				.cra_alignmask	 = 0,
 				.cra_type	 = &crypto_ahash_type,
 				.cra_module	 = THIS_MODULE,
-				.cra_init	 = _qcrypto_ahash_cra_init,
+				.cra_init	 = _qcrypto_ahash_sha_cra_init,
 				.cra_exit	 = _qcrypto_ahash_cra_exit,
 			},
 		},
@@ -3402,6 +3765,8 @@ static int  _qcrypto_probe(struct platform_device *pdev)
 		}
 	}
 
+	qcrypto_engines[pdev->id] = cp;
+
 	/* register crypto cipher algorithms the device supports */
 	for (i = 0; i < ARRAY_SIZE(_qcrypto_ablk_cipher_algos); i++) {
 		struct qcrypto_alg *q_alg;
@@ -147,7 +147,8 @@ static void ion_buffer_add(struct ion_device *dev,
 
 static int ion_buffer_alloc_dirty(struct ion_buffer *buffer);
 
-static bool ion_heap_drain_freelist(struct ion_heap *heap);
+static size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size,
+				      bool shrinker);
 /* this function should only be called while dev->lock is held */
 static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 				     struct ion_device *dev,
@@ -174,7 +175,7 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 		if (!(heap->flags & ION_HEAP_FLAG_DEFER_FREE))
 			goto err2;
 
-		ion_heap_drain_freelist(heap);
+		ion_heap_freelist_drain(heap, 0, false);
 		ret = heap->ops->allocate(heap, buffer, len, align,
 					  flags);
 		if (ret)
@@ -267,7 +268,8 @@ static void ion_buffer_destroy(struct kref *kref)
 
 	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE) {
 		rt_mutex_lock(&heap->lock);
-		list_add(&buffer->list, &heap->free_list);
+		list_add_tail(&buffer->list, &heap->free_list);
+		heap->free_list_size += buffer->size;
 		rt_mutex_unlock(&heap->lock);
 		wake_up(&heap->waitqueue);
 		return;
@@ -1590,6 +1592,12 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 	seq_printf(s, "%16.s %16u\n", "total orphaned",
 		   total_orphaned_size);
 	seq_printf(s, "%16.s %16u\n", "total ", total_size);
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE) {
+		seq_printf(s, "%16.s %16u\n", "deferred free",
+			   heap->free_list_size);
+		seq_printf(s, "%16.s %16llu\n", "shrinker freed",
+			   heap->free_shrunk);
+	}
 	seq_printf(s, "----------------------------------------------------\n");
 
 	if (heap->debug_show)
@@ -1622,47 +1630,80 @@ static size_t ion_heap_free_list_is_empty(struct ion_heap *heap)
 	return is_empty;
 }
 
-static int ion_heap_deferred_free(void *data)
+/*
+ * Destroys buffers from the heap's free list, oldest first, until at
+ * least size bytes were freed or, if size is 0, the list is empty.
+ * The shrinker gives up rather than wait for the list.  Returns the
+ * number of bytes freed.
+ */
+static size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size,
+				      bool shrinker)
 {
-	struct ion_heap *heap = data;
-
-	while (true) {
-		struct ion_buffer *buffer;
-
-		wait_event_freezable(heap->waitqueue,
-				     !ion_heap_free_list_is_empty(heap));
+	struct ion_buffer *buffer;
+	size_t freed = 0;
 
-		rt_mutex_lock(&heap->lock);
+	while (!size || freed < size) {
+		if (!shrinker)
+			rt_mutex_lock(&heap->lock);
+		else if (!rt_mutex_trylock(&heap->lock))
+			break;
 		if (list_empty(&heap->free_list)) {
 			rt_mutex_unlock(&heap->lock);
-			continue;
+			break;
 		}
 		buffer = list_first_entry(&heap->free_list, struct ion_buffer,
 					  list);
 		list_del(&buffer->list);
+		heap->free_list_size -= buffer->size;
+		if (shrinker)
+			heap->free_shrunk += buffer->size;
 		rt_mutex_unlock(&heap->lock);
+
+		if (shrinker)
+			buffer->private_flags |= ION_PRIV_FLAG_SHRINKER_FREE;
+		freed += buffer->size;
 		_ion_buffer_destroy(buffer);
 	}
-
-	return 0;
+	return freed;
 }
 
-static bool ion_heap_drain_freelist(struct ion_heap *heap)
+static int ion_heap_deferred_free(void *data)
 {
-	struct ion_buffer *buffer, *tmp;
+	struct ion_heap *heap = data;
 
-	if (ion_heap_free_list_is_empty(heap))
-		return false;
-	rt_mutex_lock(&heap->lock);
-	list_for_each_entry_safe(buffer, tmp, &heap->free_list, list) {
-		list_del(&buffer->list);
-		_ion_buffer_destroy(buffer);
+	while (true) {
+		wait_event_freezable(heap->waitqueue,
+				     !ion_heap_free_list_is_empty(heap));
+		ion_heap_freelist_drain(heap, 0, false);
 	}
-	BUG_ON(!list_empty(&heap->free_list));
-	rt_mutex_unlock(&heap->lock);
 
+	return 0;
+}
+
+static int ion_heap_shrink(struct shrinker *shrinker,
+			   struct shrink_control *sc)
+{
+	struct ion_heap *heap = container_of(shrinker, struct ion_heap,
+					     shrinker);
+
+	if (!sc->nr_to_scan)
+		return heap->free_list_size / PAGE_SIZE;
 
-	return true;
+	/*
+	 * Most heaps' free ops may allocate, or take locks their allocate
+	 * ops hold while allocating, so only the free thread frees their
+	 * buffers.  Nor is reclaim that can't do I/O or enter the fs the
+	 * place to free into one that can.
+	 */
+	if (!(heap->flags & ION_HEAP_FLAG_SHRINK_FREE)) {
+		wake_up(&heap->waitqueue);
+		return -1;
+	}
+	if ((sc->gfp_mask & (__GFP_FS | __GFP_IO)) != (__GFP_FS | __GFP_IO))
+		return -1;
+	if (!ion_heap_freelist_drain(heap, sc->nr_to_scan * PAGE_SIZE, true))
+		return -1;
+	return heap->free_list_size / PAGE_SIZE;
 }
 
 void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
@@ -1684,6 +1725,10 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 		if (IS_ERR(heap->task))
 			pr_err("%s: creating thread for deferred free failed\n",
 			       __func__);
+		heap->shrinker.shrink = ion_heap_shrink;
+		heap->shrinker.seeks = DEFAULT_SEEKS;
+		heap->shrinker.batch = 0;
+		register_shrinker(&heap->shrinker);
 	}
 
 	heap->dev = dev;
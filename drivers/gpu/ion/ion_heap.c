@@ -164,6 +164,8 @@ struct ion_heap *ion_heap_create(struct ion_platform_heap *heap_data)
 	heap->name = heap_data->name;
 	heap->id = heap_data->id;
 	heap->priv = heap_data->priv;
+	if (heap_data->defer_free)
+		heap->flags |= ION_HEAP_FLAG_DEFER_FREE;
 	return heap;
 }
 
@@ -17,18 +17,48 @@
 #include <linux/debugfs.h>
 #include <linux/dma-mapping.h>
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/fs.h>
+#include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/shrinker.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
 #include "ion_priv.h"
 
 /* #define DEBUG_PAGE_POOL_SHRINKER */
 
+/*
+ * pools is only changed with both refill_lock and pools_lock held, so
+ * either is enough to walk it.  The refill thread holds refill_lock, and
+ * allocates pages, while the shrinker takes pools_lock; so nothing may
+ * allocate memory with pools_lock held.
+ */
 static struct plist_head pools = PLIST_HEAD_INIT(pools);
+static DEFINE_MUTEX(pools_lock);
+static DEFINE_MUTEX(refill_lock);
 static struct shrinker shrinker;
 
+/* bytes each per-cpu cache may hold, high orders get no cache */
+#define ION_PAGE_POOL_PCP_BYTES	(64 * 1024)
+
+/*
+ * Pools with a fill target are topped up by a SCHED_IDLE thread, so that
+ * allocations find pages that are already zeroed and clean in the cache
+ * instead of doing that work in the allocation ioctl.  The thread is
+ * woken when a pool drops below half its target.  It backs off while the
+ * shrinker is taking pages away, and when free memory is low.
+ */
+#define ION_PAGE_POOL_REFILL_BACKOFF	(10 * HZ)
+static struct task_struct *refill_task;
+static DECLARE_WAIT_QUEUE_HEAD(refill_wait);
+static atomic_t refill_pending = ATOMIC_INIT(0);
+static unsigned long refill_resume;
+
 struct ion_page_pool_item {
 	struct page *page;
 	struct list_head list;
@@ -99,34 +129,160 @@ static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
 	return page;
 }
 
+static int ion_page_pool_count(struct ion_page_pool *pool)
+{
+	return pool->high_count + pool->low_count;
+}
+
+static void ion_page_pool_refill_kick(struct ion_page_pool *pool)
+{
+	if (!pool->fill_target ||
+	    ion_page_pool_count(pool) >= pool->fill_target / 2)
+		return;
+	atomic_set(&refill_pending, 1);
+	wake_up(&refill_wait);
+}
+
 void *ion_page_pool_alloc(struct ion_page_pool *pool)
 {
+	struct ion_page_pool_pcp *pcp;
 	struct page *page = NULL;
+	bool slow = false;
 
 	BUG_ON(!pool);
 
+	pcp = get_cpu_ptr(pool->pcp);
+	if (pcp->count) {
+		page = pcp->pages[--pcp->count];
+		pcp->pcp_hits++;
+	}
+	put_cpu_ptr(pool->pcp);
+	if (page)
+		return page;
+
 	mutex_lock(&pool->mutex);
 	if (pool->high_count)
 		page = ion_page_pool_remove(pool, true);
 	else if (pool->low_count)
 		page = ion_page_pool_remove(pool, false);
 	mutex_unlock(&pool->mutex);
+	ion_page_pool_refill_kick(pool);
 
-	if (!page)
+	if (!page) {
 		page = ion_page_pool_alloc_pages(pool);
+		slow = true;
+	}
 
+	pcp = get_cpu_ptr(pool->pcp);
+	if (slow)
+		pcp->slow_allocs++;
+	else
+		pcp->pool_hits++;
+	put_cpu_ptr(pool->pcp);
 	return page;
 }
 
 void ion_page_pool_free(struct ion_page_pool *pool, struct page* page)
 {
+	struct ion_page_pool_pcp *pcp;
 	int ret;
 
+	pcp = get_cpu_ptr(pool->pcp);
+	if (pcp->count < pool->pcp_max) {
+		pcp->pages[pcp->count++] = page;
+		page = NULL;
+	}
+	put_cpu_ptr(pool->pcp);
+	if (!page)
+		return;
+
 	ret = ion_page_pool_add(pool, page);
 	if (ret)
 		ion_page_pool_free_pages(pool, page);
 }
 
+/*
+ * Sets the number of pages the refill thread keeps in the pool.  Pages
+ * are allocated with the pool's gfp_mask, which should include
+ * __GFP_ZERO.
+ */
+void ion_page_pool_set_fill(struct ion_page_pool *pool, unsigned int pages)
+{
+	pool->fill_target = pages;
+	ion_page_pool_refill_kick(pool);
+}
+
+static bool ion_page_pool_low_memory(struct ion_page_pool *pool)
+{
+	/* leave some headroom above the watermarks to the rest of the system */
+	return global_page_state(NR_FREE_PAGES) <
+		(totalram_pages >> 5) + (1 << pool->order);
+}
+
+static void ion_page_pool_refill(struct ion_page_pool *pool)
+{
+	struct page *page;
+
+	while (ion_page_pool_count(pool) < pool->fill_target) {
+		if (kthread_should_stop() || freezing(current) ||
+		    time_before(jiffies, ACCESS_ONCE(refill_resume)) ||
+		    ion_page_pool_low_memory(pool))
+			return;
+		page = ion_page_pool_alloc_pages(pool);
+		if (!page)
+			return;
+		if (ion_page_pool_add(pool, page)) {
+			ion_page_pool_free_pages(pool, page);
+			return;
+		}
+		cond_resched();
+	}
+}
+
+static int ion_page_pool_refill_thread(void *data)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	struct ion_page_pool *pool;
+
+	sched_setscheduler(current, SCHED_IDLE, &param);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(refill_wait,
+				     atomic_read(&refill_pending) ||
+				     kthread_should_stop());
+		/* a pool kicked from here on is refilled by the next pass */
+		atomic_xchg(&refill_pending, 0);
+
+		mutex_lock(&refill_lock);
+		plist_for_each_entry(pool, &pools, list) {
+			if (pool->fill_target)
+				ion_page_pool_refill(pool);
+		}
+		mutex_unlock(&refill_lock);
+	}
+	return 0;
+}
+
+void ion_page_pool_debug_show(struct ion_page_pool *pool, struct seq_file *s)
+{
+	unsigned long pcp_hits = 0, pool_hits = 0, slow_allocs = 0;
+	int cpu, cached = 0;
+
+	for_each_possible_cpu(cpu) {
+		struct ion_page_pool_pcp *pcp = per_cpu_ptr(pool->pcp, cpu);
+
+		cached += pcp->count;
+		pcp_hits += pcp->pcp_hits;
+		pool_hits += pcp->pool_hits;
+		slow_allocs += pcp->slow_allocs;
+	}
+	seq_printf(s, "%d order %u pages in per-cpu caches, fill target %u\n",
+		   cached, pool->order, pool->fill_target);
+	seq_printf(s, "order %u allocations: %lu per-cpu, %lu pool, %lu slow\n",
+		   pool->order, pcp_hits, pool_hits, slow_allocs);
+}
+
 #ifdef DEBUG_PAGE_POOL_SHRINKER
 static int debug_drop_pools_set(void *data, u64 val)
 {
@@ -167,6 +323,7 @@ static int debug_grow_pools_set(void *data, u64 val)
 	struct ion_page_pool *pool;
 	struct page *page;
 
+	mutex_lock(&refill_lock);
 	plist_for_each_entry(pool, &pools, list) {
 		if (val != pool->list.prio)
 			continue;
@@ -174,6 +331,7 @@ static int debug_grow_pools_set(void *data, u64 val)
 		if (page)
 			ion_page_pool_add(pool, page);
 	}
+	mutex_unlock(&refill_lock);
 
 	return 0;
 }
@@ -200,16 +358,15 @@ static int ion_page_pool_shrink(struct shrinker *shrinker,
 {
 	struct ion_page_pool *pool;
 	int nr_freed = 0;
-	int i;
-	bool high;
+	int i, total;
+	bool high = !!(sc->gfp_mask & __GFP_HIGHMEM);
 	int nr_to_scan = sc->nr_to_scan;
 
-	if (sc->gfp_mask & __GFP_HIGHMEM)
-		high = true;
-
+	mutex_lock(&pools_lock);
 	if (nr_to_scan == 0)
-		return ion_page_pool_total(high);
+		goto out;
 
+	ACCESS_ONCE(refill_resume) = jiffies + ION_PAGE_POOL_REFILL_BACKOFF;
 	plist_for_each_entry(pool, &pools, list) {
 		for (i = 0; i < nr_to_scan; i++) {
 			struct page *page;
@@ -230,7 +387,10 @@ static int ion_page_pool_shrink(struct shrinker *shrinker,
 		nr_to_scan -= i;
 	}
 
-	return ion_page_pool_total(high);
+out:
+	total = ion_page_pool_total(high);
+	mutex_unlock(&pools_lock);
+	return total;
 }
 
 struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
@@ -239,6 +399,14 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
 					     GFP_KERNEL);
 	if (!pool)
 		return NULL;
+	pool->pcp = alloc_percpu(struct ion_page_pool_pcp);
+	if (!pool->pcp) {
+		kfree(pool);
+		return NULL;
+	}
+	pool->pcp_max = min(ION_PAGE_POOL_PCP_BYTES >> (PAGE_SHIFT + order),
+			    ION_PAGE_POOL_PCP_MAX);
+	pool->fill_target = 0;
 	pool->high_count = 0;
 	pool->low_count = 0;
 	INIT_LIST_HEAD(&pool->low_items);
@@ -247,14 +415,33 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
 	pool->order = order;
 	mutex_init(&pool->mutex);
 	plist_node_init(&pool->list, order);
+	mutex_lock(&refill_lock);
+	mutex_lock(&pools_lock);
 	plist_add(&pool->list, &pools);
+	mutex_unlock(&pools_lock);
+	mutex_unlock(&refill_lock);
 
 	return pool;
 }
 
 void ion_page_pool_destroy(struct ion_page_pool *pool)
 {
+	int cpu;
+
+	mutex_lock(&refill_lock);
+	mutex_lock(&pools_lock);
 	plist_del(&pool->list, &pools);
+	mutex_unlock(&pools_lock);
+	mutex_unlock(&refill_lock);
+
+	for_each_possible_cpu(cpu) {
+		struct ion_page_pool_pcp *pcp = per_cpu_ptr(pool->pcp, cpu);
+
+		while (pcp->count)
+			ion_page_pool_free_pages(pool,
+						 pcp->pages[--pcp->count]);
+	}
+	free_percpu(pool->pcp);
 	kfree(pool);
 }
 
@@ -264,6 +451,12 @@ static int __init ion_page_pool_init(void)
 	shrinker.seeks = DEFAULT_SEEKS;
 	shrinker.batch = 0;
 	register_shrinker(&shrinker);
+	refill_task = kthread_run(ion_page_pool_refill_thread, NULL,
+				  "ion_pool_refill");
+	if (IS_ERR(refill_task)) {
+		pr_err("%s: creating pool refill thread failed\n", __func__);
+		refill_task = NULL;
+	}
 #ifdef DEBUG_PAGE_POOL_SHRINKER
 	debugfs_create_file("ion_pools_shrink", 0644, NULL, NULL,
 			    &debug_drop_pools_fops);
@@ -275,6 +468,8 @@ static int __init ion_page_pool_init(void)
 
 static void __exit ion_page_pool_exit(void)
 {
+	if (refill_task)
+		kthread_stop(refill_task);
 	unregister_shrinker(&shrinker);
 }
 
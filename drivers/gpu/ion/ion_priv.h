@@ -58,6 +58,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  *			handle, used for debugging
  * @pid:		pid of last client to reference this buffer in a
  *			handle, used for debugging
+ * @private_flags:	internal buffer flags, see ION_PRIV_FLAG_*
 */
 struct ion_buffer {
 	struct kref ref;
@@ -84,8 +85,15 @@ struct ion_buffer {
 	int handle_count;
 	char task_comm[TASK_COMM_LEN];
 	pid_t pid;
+	unsigned long private_flags;
 };
 
+/*
+ * The buffer is being freed by the shrinker: give its memory back to the
+ * system rather than to a heap page pool.
+ */
+#define ION_PRIV_FLAG_SHRINKER_FREE (1 << 0)
+
 /**
  * struct ion_heap_ops - ops to operate on a given heap
  * @allocate:		allocate memory
@@ -127,6 +135,12 @@ struct ion_heap_ops {
  * heap flags - flags between the heaps and core ion code
  */
 #define ION_HEAP_FLAG_DEFER_FREE (1 << 0)
+/*
+ * The heap's free op neither allocates nor takes a lock held while
+ * allocating, so the shrinker may free deferred buffers from reclaim.
+ * Other deferred free heaps only have their free thread woken up.
+ */
+#define ION_HEAP_FLAG_SHRINK_FREE (1 << 1)
 
 /**
  * struct ion_heap - represents a heap in the system
@@ -141,9 +155,12 @@ struct ion_heap_ops {
  * @name:		used for debugging
  * @priv:		private heap data
  * @free_list:		free list head if deferred free is used
- * @lock:		protects the free list
+ * @free_list_size:	bytes of buffers on the free list
+ * @free_shrunk:	bytes the shrinker freed from the free list
+ * @lock:		protects the free list and its counters
  * @waitqueue:		queue to wait on from deferred free thread
  * @task:		task struct of deferred free thread
+ * @shrinker:		drains the free list under memory pressure
  * @debug_show:		called when heap debug file is read to add any
  *			heap specific debug info to output
  *
@@ -162,9 +179,12 @@ struct ion_heap {
 	const char *name;
 	void *priv;
 	struct list_head free_list;
+	size_t free_list_size;
+	u64 free_shrunk;
 	struct rt_mutex lock;
 	wait_queue_head_t waitqueue;
 	struct task_struct *task;
+	struct shrinker shrinker;
 	int (*debug_show)(struct ion_heap *heap, struct seq_file *, void *);
 };
 
@@ -276,6 +296,10 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
  * @gfp_mask:		gfp_mask to use from alloc
  * @order:		order of pages in the pool
  * @list:		plist node for list of pools
+ * @fill_target:	number of pages the refill thread keeps in the pool,
+ *			0 to only keep pages that were freed to it
+ * @pcp:		per-cpu caches in front of the lists
+ * @pcp_max:		number of pages each per-cpu cache holds at most
  *
  * Allows you to keep a pool of pre allocated pages to use from your heap.
  * Keeping a pool of pages that is ready for dma, ie any cached mapping have
@@ -293,11 +317,37 @@ struct ion_page_pool {
 	gfp_t gfp_mask;
 	unsigned int order;
 	struct plist_node list;
+	unsigned int fill_target;
+	struct ion_page_pool_pcp __percpu *pcp;
+	int pcp_max;
+};
+
+#define ION_PAGE_POOL_PCP_MAX	16
+
+/**
+ * struct ion_page_pool_pcp - per-cpu page cache of a pagepool
+ * @count:		number of pages in @pages
+ * @pages:		cached pages, ready for dma like those in the pool
+ * @pcp_hits:		allocations served from this cache
+ * @pool_hits:		allocations served from the pool lists
+ * @slow_allocs:	allocations that had to get and zero new pages
+ *
+ * Only touched by its own cpu with preemption disabled, so it takes no
+ * lock.
+ */
+struct ion_page_pool_pcp {
+	int count;
+	struct page *pages[ION_PAGE_POOL_PCP_MAX];
+	unsigned long pcp_hits;
+	unsigned long pool_hits;
+	unsigned long slow_allocs;
 };
 
 struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
 void ion_page_pool_destroy(struct ion_page_pool *);
 void *ion_page_pool_alloc(struct ion_page_pool *);
 void ion_page_pool_free(struct ion_page_pool *, struct page *);
+void ion_page_pool_set_fill(struct ion_page_pool *pool, unsigned int pages);
+void ion_page_pool_debug_show(struct ion_page_pool *pool, struct seq_file *s);
 
 #endif /* _ION_PRIV_H */
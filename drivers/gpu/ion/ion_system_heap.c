@@ -20,6 +20,7 @@
 #include <linux/err.h>
 #include <linux/highmem.h>
 #include <linux/ion.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
 #include <linux/scatterlist.h>
 #include <linux/seq_file.h>
@@ -51,9 +52,16 @@ static unsigned int order_to_size(int order)
 	return PAGE_SIZE << order;
 }
 
+/* bytes of zeroed pages the refill thread keeps in each low order pool */
+#define ION_SYSTEM_HEAP_POOL_FILL	(4 * 1024 * 1024)
+
+/* bucket i counts allocations that took less than 2^i us, the last the rest */
+#define ION_SYSTEM_HEAP_LAT_BUCKETS	20
+
 struct ion_system_heap {
 	struct ion_heap heap;
 	struct ion_page_pool **pools;
+	atomic_t alloc_latency[ION_SYSTEM_HEAP_LAT_BUCKETS];
 };
 
 struct page_info {
@@ -106,7 +114,7 @@ static void free_buffer_page(struct ion_system_heap *heap,
 	bool split_pages = ion_buffer_fault_user_mappings(buffer);
 	int i;
 
-	if (!cached) {
+	if (!cached && !(buffer->private_flags & ION_PRIV_FLAG_SHRINKER_FREE)) {
 		struct ion_page_pool *pool = heap->pools[order_to_index(order)];
 		ion_page_pool_free(pool, page);
 	} else if (split_pages) {
@@ -162,6 +170,8 @@ static int ion_system_heap_allocate(struct ion_heap *heap,
 	unsigned long size_remaining = PAGE_ALIGN(size);
 	unsigned int max_order = orders[0];
 	bool split_pages = ion_buffer_fault_user_mappings(buffer);
+	ktime_t start = ktime_get();
+	s64 us;
 
 	INIT_LIST_HEAD(&pages);
 	while (size_remaining > 0) {
@@ -205,6 +215,10 @@ static int ion_system_heap_allocate(struct ion_heap *heap,
 	}
 
 	buffer->priv_virt = table;
+
+	us = ktime_us_delta(ktime_get(), start);
+	atomic_inc(&sys_heap->alloc_latency[min_t(int, fls64(us),
+					ION_SYSTEM_HEAP_LAT_BUCKETS - 1)]);
 	return 0;
 err1:
 	kfree(table);
@@ -229,8 +243,9 @@ void ion_system_heap_free(struct ion_buffer *buffer)
 	int i;
 
 	/* uncached pages come from the page pools, zero them before returning
-	   for security purposes (other allocations are zerod at alloc time */
-	if (!cached)
+	   for security purposes (other allocations are zerod at alloc time,
+	   and pages freed by the shrinker go back to the system) */
+	if (!cached && !(buffer->private_flags & ION_PRIV_FLAG_SHRINKER_FREE))
 		ion_heap_buffer_zero(buffer);
 
 	for_each_sg(table->sgl, sg, table->nents, i)
@@ -278,7 +293,15 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 		seq_printf(s, "%d order %u lowmem pages in pool = %lu total\n",
 			   pool->low_count, pool->order,
 			   (1 << pool->order) * PAGE_SIZE * pool->low_count);
+		ion_page_pool_debug_show(pool, s);
 	}
+
+	seq_printf(s, "allocation latency:\n");
+	for (i = 0; i < ION_SYSTEM_HEAP_LAT_BUCKETS - 1; i++)
+		seq_printf(s, "  < %8lu us: %d\n", 1UL << i,
+			   atomic_read(&sys_heap->alloc_latency[i]));
+	seq_printf(s, "  >=%8lu us: %d\n", 1UL << i,
+		   atomic_read(&sys_heap->alloc_latency[i]));
 	return 0;
 }
 
@@ -292,7 +315,7 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 		return ERR_PTR(-ENOMEM);
 	heap->heap.ops = &system_heap_ops;
 	heap->heap.type = ION_HEAP_TYPE_SYSTEM;
-	heap->heap.flags = ION_HEAP_FLAG_DEFER_FREE;
+	heap->heap.flags = ION_HEAP_FLAG_DEFER_FREE | ION_HEAP_FLAG_SHRINK_FREE;
 	heap->pools = kzalloc(sizeof(struct ion_page_pool *) * num_orders,
 			      GFP_KERNEL);
 	if (!heap->pools)
@@ -306,6 +329,10 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 		pool = ion_page_pool_create(gfp_flags, orders[i]);
 		if (!pool)
 			goto err_create_pool;
+		/* high order blocks are too scarce to hold on to in advance */
+		if (orders[i] <= 4)
+			ion_page_pool_set_fill(pool, ION_SYSTEM_HEAP_POOL_FILL /
+					       order_to_size(orders[i]));
 		heap->pools[i] = pool;
 	}
 	heap->heap.debug_show = ion_system_heap_debug_show;
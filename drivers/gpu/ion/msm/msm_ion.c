@@ -841,6 +841,8 @@ static struct ion_platform_data *msm_ion_parse_dt(struct platform_device *pdev)
 			goto free_heaps;
 
 		msm_ion_get_heap_adjacent(node, &pdata->heaps[idx]);
+		pdata->heaps[idx].defer_free = of_property_read_bool(node,
+						"qcom,ion-heap-defer-free");
 
 		++idx;
 	}
@@ -1021,6 +1023,8 @@ static struct ion_heap *msm_ion_heap_create(struct ion_platform_heap *heap_data)
 	heap->name = heap_data->name;
 	heap->id = heap_data->id;
 	heap->priv = heap_data->priv;
+	if (heap_data->defer_free)
+		heap->flags |= ION_HEAP_FLAG_DEFER_FREE;
 	return heap;
 }
 
@@ -34,6 +34,7 @@
 #include "kgsl_debugfs.h"
 #include "kgsl_cffdump.h"
 #include "kgsl_log.h"
+#include "kgsl_pool.h"
 #include "kgsl_sharedmem.h"
 #include "kgsl_device.h"
 #include "kgsl_trace.h"
@@ -3408,6 +3409,7 @@ static void kgsl_core_exit(void)
 	}
 
 	kgsl_memfree_hist_exit();
+	kgsl_pool_exit();
 	unregister_chrdev_region(kgsl_driver.major, KGSL_DEVICE_MAX);
 }
 
@@ -3464,6 +3466,7 @@ static int __init kgsl_core_init(void)
 
 	kgsl_core_debugfs_init();
 
+	kgsl_pool_init();
 	kgsl_sharedmem_init_sysfs();
 	kgsl_cffdump_init();
 
@@ -129,6 +129,10 @@ struct kgsl_driver {
 		unsigned int mapped;
 		unsigned int mapped_max;
 		unsigned int histogram[16];
+		/* chunks of each page order handed out by the page allocator */
+		unsigned int page_order[16];
+		/* allocation latency, entry i counts those under 2^i us */
+		unsigned int alloc_latency[16];
 	} stats;
 };
 
@@ -658,6 +658,15 @@ kgsl_mmu_get_gpuaddr(struct kgsl_pagetable *pagetable,
 		 */
 		if (kgsl_memdesc_get_align(memdesc) > 0)
 			page_align = kgsl_memdesc_get_align(memdesc);
+		/*
+		 * Physically contiguous runs in large buffers, such as
+		 * imported ION buffers, can only use 1M entries if the
+		 * virtual address is aligned the same way. Global buffers
+		 * come from a small pool, so leave them alone.
+		 */
+		if (!kgsl_memdesc_is_global(memdesc) && size >= SZ_1M &&
+		    page_align < ilog2(SZ_1M))
+			page_align = ilog2(SZ_1M);
 		if (kgsl_memdesc_is_global(memdesc)) {
 			/*
 			 * Only the default pagetable has a kgsl_pool, and
@@ -0,0 +1,190 @@
+/* Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/io.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/shrinker.h>
+#include <linux/spinlock.h>
+#include <asm/cacheflush.h>
+
+#include "kgsl.h"
+#include "kgsl_pool.h"
+
+/*
+ * Pools of zeroed, cache-clean pages for GPU allocations, after the ION
+ * page pools.  Pages are zeroed and flushed when they are freed back to
+ * a pool, so an allocation served from a pool skips the map, memset and
+ * flush entirely.  A shrinker gives the pools back under memory pressure.
+ */
+
+/*
+ * struct kgsl_page_pool - pool of free chunks of one order
+ * @order: order of the chunks in the pool
+ * @max_count: number of chunks the pool keeps at most
+ * @count: number of chunks in the pool
+ * @lock: protects @items and @count
+ * @items: the chunks, linked through page->lru
+ */
+struct kgsl_page_pool {
+	unsigned int order;
+	int max_count;
+	int count;
+	spinlock_t lock;
+	struct list_head items;
+};
+
+/* 64K chunks first, they let the IOMMU use large page mappings */
+static struct kgsl_page_pool kgsl_pools[] = {
+	{ .order = 4, .max_count = 128 },	/* 8MB */
+	{ .order = 0, .max_count = 1024 },	/* 4MB */
+};
+
+static struct kgsl_page_pool *kgsl_pool_find(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		if (kgsl_pools[i].order == order)
+			return &kgsl_pools[i];
+	return NULL;
+}
+
+static struct page *kgsl_pool_remove(struct kgsl_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (pool->count) {
+		page = list_first_entry(&pool->items, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+	}
+	spin_unlock(&pool->lock);
+	return page;
+}
+
+/**
+ * kgsl_pool_alloc_page - allocate a chunk of 2^order pages
+ * @order: order of the chunk
+ * @gfp_mask: flags to allocate with if the pool is empty
+ * @zeroed: set to true if the chunk came from a pool and is already zeroed
+ * and clean in the cache, false if the caller has to zero it
+ */
+struct page *kgsl_pool_alloc_page(unsigned int order, gfp_t gfp_mask,
+				  bool *zeroed)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_find(order);
+	struct page *page = NULL;
+
+	if (pool)
+		page = kgsl_pool_remove(pool);
+	*zeroed = page != NULL;
+	if (!page)
+		page = alloc_pages(gfp_mask, order);
+	return page;
+}
+
+/**
+ * kgsl_pool_free_page - free a chunk allocated by kgsl_pool_alloc_page()
+ * @page: first page of the chunk
+ * @order: order of the chunk
+ *
+ * Keeps the chunk in its pool if there is room and nobody else holds a
+ * reference to it, zeroing and flushing it first.
+ */
+void kgsl_pool_free_page(struct page *page, unsigned int order)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_find(order);
+	int i;
+
+	if (!pool || pool->count >= pool->max_count ||
+	    page_count(page) != 1) {
+		__free_pages(page, order);
+		return;
+	}
+
+	for (i = 0; i < (1 << order); i++) {
+		void *ptr = kmap_atomic(nth_page(page, i));
+
+		memset(ptr, 0, PAGE_SIZE);
+		dmac_flush_range(ptr, ptr + PAGE_SIZE);
+		kunmap_atomic(ptr);
+	}
+	outer_flush_range(page_to_phys(page),
+			  page_to_phys(page) + (PAGE_SIZE << order));
+
+	spin_lock(&pool->lock);
+	list_add_tail(&page->lru, &pool->items);
+	pool->count++;
+	spin_unlock(&pool->lock);
+}
+
+/* Return the number of bytes held in the pools */
+unsigned int kgsl_pool_size(void)
+{
+	unsigned int size = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		size += kgsl_pools[i].count * (PAGE_SIZE << kgsl_pools[i].order);
+	return size;
+}
+
+static int kgsl_pool_shrink(struct shrinker *shrinker,
+			    struct shrink_control *sc)
+{
+	int nr_to_scan = sc->nr_to_scan;
+	struct page *page;
+	int i;
+
+	/* release the largest chunks first, they are the hardest to get */
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools) && nr_to_scan > 0; i++) {
+		while (nr_to_scan > 0) {
+			page = kgsl_pool_remove(&kgsl_pools[i]);
+			if (!page)
+				break;
+			__free_pages(page, kgsl_pools[i].order);
+			nr_to_scan -= 1 << kgsl_pools[i].order;
+		}
+	}
+	return kgsl_pool_size() >> PAGE_SHIFT;
+}
+
+static struct shrinker kgsl_pool_shrinker = {
+	.shrink = kgsl_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+void kgsl_pool_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		spin_lock_init(&kgsl_pools[i].lock);
+		INIT_LIST_HEAD(&kgsl_pools[i].items);
+	}
+	register_shrinker(&kgsl_pool_shrinker);
+}
+
+void kgsl_pool_exit(void)
+{
+	struct page *page;
+	int i;
+
+	unregister_shrinker(&kgsl_pool_shrinker);
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		while ((page = kgsl_pool_remove(&kgsl_pools[i])))
+			__free_pages(page, kgsl_pools[i].order);
+}
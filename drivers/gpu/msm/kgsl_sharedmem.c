@@ -18,8 +18,10 @@
 #include <linux/slab.h>
 #include <linux/kmemleak.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
 
 #include "kgsl.h"
+#include "kgsl_pool.h"
 #include "kgsl_sharedmem.h"
 #include "kgsl_cffdump.h"
 #include "kgsl_device.h"
@@ -223,6 +225,8 @@ static int kgsl_drv_memstat_show(struct device *dev,
 		val = kgsl_driver.stats.mapped;
 	else if (!strncmp(attr->attr.name, "mapped_max", 10))
 		val = kgsl_driver.stats.mapped_max;
+	else if (!strncmp(attr->attr.name, "page_pool", 9))
+		val = kgsl_pool_size();
 
 	return snprintf(buf, PAGE_SIZE, "%u\n", val);
 }
@@ -231,12 +235,18 @@ static int kgsl_drv_histogram_show(struct device *dev,
 				   struct device_attribute *attr,
 				   char *buf)
 {
+	unsigned int *histogram = kgsl_driver.stats.histogram;
 	int len = 0;
 	int i;
 
+	if (!strncmp(attr->attr.name, "page_order", 10))
+		histogram = kgsl_driver.stats.page_order;
+	else if (!strncmp(attr->attr.name, "alloc_latency", 13))
+		histogram = kgsl_driver.stats.alloc_latency;
+
 	for (i = 0; i < 16; i++)
 		len += snprintf(buf + len, PAGE_SIZE - len, "%d ",
-			kgsl_driver.stats.histogram[i]);
+			histogram[i]);
 
 	len += snprintf(buf + len, PAGE_SIZE - len, "\n");
 	return len;
@@ -251,6 +261,9 @@ DEVICE_ATTR(coherent_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(histogram, 0444, kgsl_drv_histogram_show, NULL);
+DEVICE_ATTR(page_pool, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(page_order, 0444, kgsl_drv_histogram_show, NULL);
+DEVICE_ATTR(alloc_latency, 0444, kgsl_drv_histogram_show, NULL);
 
 static const struct device_attribute *drv_attr_list[] = {
 	&dev_attr_vmalloc,
@@ -262,6 +275,9 @@ static const struct device_attribute *drv_attr_list[] = {
 	&dev_attr_mapped,
 	&dev_attr_mapped_max,
 	&dev_attr_histogram,
+	&dev_attr_page_pool,
+	&dev_attr_page_order,
+	&dev_attr_alloc_latency,
 	NULL
 };
 
@@ -376,7 +392,8 @@ static void kgsl_page_alloc_free(struct kgsl_memdesc *memdesc)
 	}
 	if (memdesc->sg)
 		for_each_sg(memdesc->sg, sg, sglen, i)
-			__free_pages(sg_page(sg), get_order(sg->length));
+			kgsl_pool_free_page(sg_page(sg),
+					    get_order(sg->length));
 }
 
 static int kgsl_contiguous_vmflags(struct kgsl_memdesc *memdesc)
@@ -549,11 +566,18 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	void *ptr;
 	unsigned int align;
 	int step = ((VMALLOC_END - VMALLOC_START)/8) >> PAGE_SHIFT;
+	ktime_t start = ktime_get();
+	s64 us;
 
 	align = (memdesc->flags & KGSL_MEMALIGN_MASK) >> KGSL_MEMALIGN_SHIFT;
 
-	page_size = (align >= ilog2(SZ_64K) && size >= SZ_64K)
-			? SZ_64K : PAGE_SIZE;
+	/*
+	 * With the IOMMU, 64K chunks are worth trying for any large buffer
+	 * since they can be mapped with 64K entries and cut TLB misses.
+	 */
+	page_size = ((align >= ilog2(SZ_64K) ||
+		      kgsl_mmu_get_mmutype() == KGSL_MMU_TYPE_IOMMU) &&
+		     size >= SZ_64K) ? SZ_64K : PAGE_SIZE;
 	/* update align flags for what we actually use */
 	if (page_size != PAGE_SIZE)
 		kgsl_memdesc_set_align(memdesc, ilog2(page_size));
@@ -608,6 +632,7 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	while (len > 0) {
 		struct page *page;
 		unsigned int gfp_mask = __GFP_HIGHMEM;
+		bool zeroed;
 		int j;
 
 		/* don't waste space at the end of the allocation*/
@@ -624,7 +649,8 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 		else
 			gfp_mask |= GFP_KERNEL;
 
-		page = alloc_pages(gfp_mask, get_order(page_size));
+		page = kgsl_pool_alloc_page(get_order(page_size), gfp_mask,
+					    &zeroed);
 
 		if (page == NULL) {
 			if (page_size != PAGE_SIZE) {
@@ -640,9 +666,12 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 			goto done;
 		}
 
-		for (j = 0; j < page_size >> PAGE_SHIFT; j++)
-			pages[pcount++] = nth_page(page, j);
+		/* pages from the pool are already zeroed and flushed */
+		if (!zeroed)
+			for (j = 0; j < page_size >> PAGE_SHIFT; j++)
+				pages[pcount++] = nth_page(page, j);
 
+		kgsl_driver.stats.page_order[get_order(page_size)]++;
 		sg_set_page(&memdesc->sg[sglen++], page, page_size, 0);
 		len -= page_size;
 	}
@@ -722,6 +751,9 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	if (order < 16)
 		kgsl_driver.stats.histogram[order]++;
 
+	us = ktime_us_delta(ktime_get(), start);
+	kgsl_driver.stats.alloc_latency[min_t(int, fls64(us), 15)]++;
+
 done:
 	if (pages_size > PAGE_SIZE * 2)
 		vfree(pages);
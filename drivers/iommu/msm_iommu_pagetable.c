@@ -372,6 +372,30 @@ static phys_addr_t get_phys_addr(struct scatterlist *sg)
 	return pa;
 }
 
+/*
+ * Return how many bytes starting chunk_offset bytes into sg are physically
+ * contiguous, following the list as long as each entry starts where the
+ * previous one ended, and looking no further than len bytes. Allocators
+ * often hand out neighbouring pages in separate entries; treating them as
+ * one run lets them be mapped with 64K and 1M entries.
+ */
+static unsigned int sg_contiguous_len(struct scatterlist *sg,
+				      unsigned int chunk_offset,
+				      unsigned int len)
+{
+	unsigned int run = sg->length - chunk_offset;
+	phys_addr_t next = get_phys_addr(sg) + sg->length;
+
+	while (run < len) {
+		sg = sg_next(sg);
+		if (!sg || get_phys_addr(sg) != next)
+			break;
+		run += sg->length;
+		next += sg->length;
+	}
+	return min(run, len);
+}
+
 static int check_range(unsigned long *fl_table, unsigned int va,
 				 unsigned int len)
 {
@@ -439,6 +463,7 @@ int msm_iommu_pagetable_map_range(struct msm_iommu_pt *pt, unsigned int va,
 	unsigned long *sl_table = NULL;
 	unsigned long sl_offset, sl_start;
 	unsigned int chunk_size, chunk_offset = 0;
+	unsigned int run = 0;
 	int ret = 0;
 	unsigned int pgprot4k, pgprot64k, pgprot1m, pgprot16m;
 
@@ -464,11 +489,12 @@ int msm_iommu_pagetable_map_range(struct msm_iommu_pt *pt, unsigned int va,
 	while (offset < len) {
 		chunk_size = SZ_4K;
 
-		if (is_fully_aligned(va, pa, sg->length - chunk_offset,
-				     SZ_16M))
+		if (!run)
+			run = sg_contiguous_len(sg, chunk_offset, len - offset);
+
+		if (is_fully_aligned(va, pa, run, SZ_16M))
 			chunk_size = SZ_16M;
-		else if (is_fully_aligned(va, pa, sg->length - chunk_offset,
-					  SZ_1M))
+		else if (is_fully_aligned(va, pa, run, SZ_1M))
 			chunk_size = SZ_1M;
 		/* 64k or 4k determined later */
 
@@ -492,13 +518,15 @@ int msm_iommu_pagetable_map_range(struct msm_iommu_pt *pt, unsigned int va,
 
 			offset += chunk_size;
 			chunk_offset += chunk_size;
+			run -= chunk_size;
 			va += chunk_size;
 			pa += chunk_size;
 
-			if (chunk_offset >= sg->length && offset < len) {
-				chunk_offset = 0;
+			/* a chunk may cover several contiguous entries */
+			while (chunk_offset >= sg->length && offset < len) {
+				chunk_offset -= sg->length;
 				sg = sg_next(sg);
-				pa = get_phys_addr(sg);
+				pa = get_phys_addr(sg) + chunk_offset;
 			}
 			continue;
 		}
@@ -526,8 +554,11 @@ int msm_iommu_pagetable_map_range(struct msm_iommu_pt *pt, unsigned int va,
 			 * the pa and va are aligned
 			 */
 
-			if (is_fully_aligned(va, pa, sg->length - chunk_offset,
-					     SZ_64K))
+			if (!run)
+				run = sg_contiguous_len(sg, chunk_offset,
+							len - offset);
+
+			if (is_fully_aligned(va, pa, run, SZ_64K))
 				chunk_size = SZ_64K;
 			else
 				chunk_size = SZ_4K;
@@ -544,16 +575,16 @@ int msm_iommu_pagetable_map_range(struct msm_iommu_pt *pt, unsigned int va,
 				sl_offset += 16;
 			}
 
-
 			offset += chunk_size;
 			chunk_offset += chunk_size;
+			run -= chunk_size;
 			va += chunk_size;
 			pa += chunk_size;
 
-			if (chunk_offset >= sg->length && offset < len) {
-				chunk_offset = 0;
+			while (chunk_offset >= sg->length && offset < len) {
+				chunk_offset -= sg->length;
 				sg = sg_next(sg);
-				pa = get_phys_addr(sg);
+				pa = get_phys_addr(sg) + chunk_offset;
 			}
 		}
 
@@ -20,6 +20,7 @@
 #include <linux/interrupt.h>
 #include <linux/bitops.h>
 #include <linux/debugfs.h>
+#include <linux/math64.h>
 #include <mach/iommu.h>
 #include <mach/iommu_perfmon.h>
 
@@ -323,6 +324,21 @@ static int iommu_pm_debug_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/* Must be called with pmon->lock held */
+static unsigned long long iommu_pm_read_full_count(struct iommu_pmon *pmon,
+					struct iommu_pmon_counter *counter)
+{
+	struct iommu_info *iommu = &pmon->iommu;
+
+	if (iommu->hw_ops->is_hw_access_OK(pmon)) {
+		iommu->ops->iommu_lock_acquire();
+		counter->value = iommu->hw_ops->read_counter(counter);
+		iommu->ops->iommu_lock_release();
+	}
+	return (unsigned long long) counter->value +
+	       ((unsigned long long)counter->overflow_count * 0x100000000ULL);
+}
+
 static ssize_t iommu_pm_count_value_read(struct file *fp,
 					 char __user *user_buff,
 					 size_t count, loff_t *pos)
@@ -332,20 +348,12 @@ static ssize_t iommu_pm_count_value_read(struct file *fp,
 
 	struct iommu_pmon_counter *counter = fp->private_data;
 	struct iommu_pmon *pmon = counter->cnt_group->pmon;
-	struct iommu_info *iommu = &pmon->iommu;
 	char buf[50];
 	size_t len;
 
 	mutex_lock(&pmon->lock);
 
-	if (iommu->hw_ops->is_hw_access_OK(pmon)) {
-		iommu->ops->iommu_lock_acquire();
-		counter->value = iommu->hw_ops->read_counter(counter);
-		iommu->ops->iommu_lock_release();
-	}
-	full_count = (unsigned long long) counter->value +
-		     ((unsigned long long)counter->overflow_count *
-			0x100000000ULL);
+	full_count = iommu_pm_read_full_count(pmon, counter);
 
 	len = snprintf(buf, 50, "%llu\n", full_count);
 	rd_cnt = simple_read_from_buffer(user_buff, count, pos, buf, len);
@@ -559,6 +567,60 @@ static const struct file_operations available_event_cls_file_ops = {
 	.read = iommu_pm_avail_event_cls_read,
 };
 
+/*
+ * Report the TLB miss rate from the counters that are currently counting
+ * "access" and "tlb_refill" events, summed over all counter groups. Read
+ * it once before and once after a workload, or reset the counters in
+ * between, to compare how well different mappings use the TLB.
+ */
+static ssize_t iommu_pm_tlb_miss_rate_read(struct file *fp,
+					   char __user *user_buff,
+					   size_t count, loff_t *pos)
+{
+	struct iommu_pmon *pmon = fp->private_data;
+	struct iommu_pmon_counter *counter;
+	unsigned long long refills = 0, accesses = 0, rate;
+	int have_refills = 0, have_accesses = 0;
+	char buf[100];
+	size_t len;
+	int i, j;
+
+	mutex_lock(&pmon->lock);
+	for (i = 0; i < pmon->num_groups; i++) {
+		for (j = 0; j < pmon->cnt_grp[i].num_counters; j++) {
+			counter = &pmon->cnt_grp[i].counters[j];
+			if (counter->current_event_class == 0x08) {
+				refills += iommu_pm_read_full_count(pmon,
+								    counter);
+				have_refills = 1;
+			} else if (counter->current_event_class == 0x10) {
+				accesses += iommu_pm_read_full_count(pmon,
+								     counter);
+				have_accesses = 1;
+			}
+		}
+	}
+	mutex_unlock(&pmon->lock);
+
+	if (!have_refills || !have_accesses) {
+		len = snprintf(buf, sizeof(buf),
+			       "set counters to access and tlb_refill\n");
+	} else {
+		/* in hundredths of a percent */
+		rate = accesses ? div64_u64(refills * 10000, accesses) : 0;
+		len = snprintf(buf, sizeof(buf),
+			       "refills %llu accesses %llu miss rate %llu.%02llu%%\n",
+			       refills, accesses, div_u64(rate, 100),
+			       rate - div_u64(rate, 100) * 100);
+	}
+	return simple_read_from_buffer(user_buff, count, pos, buf, len);
+}
+
+static const struct file_operations tlb_miss_rate_file_ops = {
+	.open = iommu_pm_debug_open,
+	.read = iommu_pm_tlb_miss_rate_read,
+};
+
 
 
 static int iommu_pm_create_grp_debugfs_counters_hierarchy(
@@ -708,6 +770,13 @@ int msm_iommu_pm_iommu_register(struct iommu_pmon *pmon_entry)
 		goto free_mem;
 	}
 
+	if (!debugfs_create_file("tlb_miss_rate", 0444,
+			pmon_entry->iommu_dir, pmon_entry,
+			&tlb_miss_rate_file_ops)) {
+		ret = -EIO;
+		goto free_mem;
+	}
+
 	ret = iommu_pm_create_group_debugfs_hierarchy(iommu, pmon_entry);
 	if (ret)
 		goto free_mem;
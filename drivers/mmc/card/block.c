@@ -82,6 +82,17 @@ MODULE_ALIAS("mmc:block");
 #define PCKD_TRGR_LOWER_BOUND		5
 #define PCKD_TRGR_PRECISION_MULTIPLIER	100
 
+/* writes up to this size are dominated by the per command overhead */
+#define PCKD_SMALL_WR_SECTORS		64
+/* a packed command never gets less budget than this */
+#define PCKD_TIME_BUDGET_MIN_US		2000
+/* largest pack_time_budget_ms, keeps the budget in usec within 32 bits */
+#define PCKD_TIME_BUDGET_MAX_MS		10000
+/* reads further apart than this don't shrink the budget */
+#define PCKD_RD_IDLE_US			1000000
+/* weight of a new sample in the moving averages is 1/8 */
+#define PCKD_EWMA_SHIFT			3
+
 static DEFINE_MUTEX(block_mutex);
 
 /*
@@ -134,6 +145,7 @@ struct mmc_blk_data {
 	struct device_attribute num_wr_reqs_to_start_packing;
 	struct device_attribute bkops_check_threshold;
 	struct device_attribute no_pack_for_random;
+	struct device_attribute pack_time_budget_ms;
 	int	area_type;
 };
 
@@ -453,6 +465,54 @@ exit:
 	return ret;
 }
 
+static ssize_t
+pack_time_budget_ms_show(struct device *dev,
+			 struct device_attribute *attr, char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	int ret;
+
+	ret = snprintf(buf, PAGE_SIZE, "%u\n", md->queue.pack_time_budget_ms);
+
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t
+pack_time_budget_ms_store(struct device *dev,
+			  struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	int value;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	struct mmc_card *card = md->queue.card;
+	int ret = count;
+
+	if (!card) {
+		ret = -EINVAL;
+		goto exit;
+	}
+
+	if (sscanf(buf, "%d", &value) != 1 || value < 0 ||
+	    value > PCKD_TIME_BUDGET_MAX_MS) {
+		pr_err("%s: invalid value. old value remains = %u",
+			mmc_hostname(card->host),
+			md->queue.pack_time_budget_ms);
+		ret = -EINVAL;
+		goto exit;
+	}
+
+	md->queue.pack_time_budget_ms = value;
+
+	pr_debug("%s: pack_time_budget_ms: new value = %u",
+		mmc_hostname(card->host),
+		md->queue.pack_time_budget_ms);
+
+exit:
+	mmc_blk_put(md);
+	return ret;
+}
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -2001,6 +2061,70 @@ static int get_packed_trigger(int potential, struct mmc_card *card,
 	return trigger;
 }
 
+static u32 mmc_blk_ewma(u32 avg, u32 sample)
+{
+	if (!avg)
+		return sample;
+	return avg - (avg >> PCKD_EWMA_SHIFT) + (sample >> PCKD_EWMA_SHIFT);
+}
+
+/*
+ * Track how often reads arrive, a packed write command should not keep
+ * the bus much longer than the gap between two reads.
+ */
+static void mmc_blk_update_rd_interval(struct mmc_queue *mq)
+{
+	ktime_t now = ktime_get();
+	s64 delta = ktime_us_delta(now, mq->last_rd_time);
+
+	if (delta > PCKD_RD_IDLE_US)
+		delta = PCKD_RD_IDLE_US;
+	mq->rd_interval_us = mmc_blk_ewma(mq->rd_interval_us, delta);
+	mq->last_rd_time = now;
+}
+
+/*
+ * Track the write cost per sector from completed writes. @now is when
+ * the host finished @mq_rq: the next request, if any, was started then.
+ */
+static void mmc_blk_update_wr_cost(struct mmc_queue *mq,
+				   struct mmc_queue_req *mq_rq, ktime_t now)
+{
+	unsigned int sectors;
+	s64 ns;
+
+	if (mq_rq->packed_cmd != MMC_PACKED_NONE)
+		sectors = mq_rq->packed_blocks;
+	else
+		sectors = mq_rq->brq.data.bytes_xfered >> 9;
+	if (sectors < PCKD_SMALL_WR_SECTORS)
+		return;
+
+	ns = ktime_to_ns(ktime_sub(now, mq_rq->start_time));
+	if (ns <= 0)
+		return;
+	mq->wr_ns_per_sect = mmc_blk_ewma(mq->wr_ns_per_sect,
+					  min_t(u64, div_u64(ns, sectors),
+						UINT_MAX));
+}
+
+/*
+ * Time budget for the next packed write command, in usec. While reads
+ * keep arriving, it shrinks to half their inter-arrival time.
+ */
+static unsigned int mmc_blk_pack_time_budget(struct mmc_queue *mq)
+{
+	unsigned int budget_us = mq->pack_time_budget_ms * USEC_PER_MSEC;
+
+	if (!budget_us || !mq->rd_interval_us ||
+	    ktime_us_delta(ktime_get(), mq->last_rd_time) >= PCKD_RD_IDLE_US)
+		return budget_us;
+
+	return min_t(unsigned int, budget_us,
+		     max_t(unsigned int, mq->rd_interval_us / 2,
+			   PCKD_TIME_BUDGET_MIN_US));
+}
+
 static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 					  struct request *req)
 {
@@ -2014,6 +2138,10 @@ static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 	if (mq->card->ext_csd.rev <= 5)
 		return;
 
+	if (req && rq_data_dir(req) == READ &&
+	    !(req->cmd_flags & (REQ_DISCARD | REQ_FLUSH)))
+		mmc_blk_update_rd_interval(mq);
+
 	/*
 	 * In case the packing control is not supported by the host, it should
 	 * not have an effect on the write packing. Therefore we have to enable
@@ -2049,6 +2177,14 @@ static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 		return;
 	} else if (data_dir == WRITE) {
 		mq->num_of_potential_packed_wr_reqs++;
+		/*
+		 * A run of small sequential writes packs well, let it reach
+		 * the packing trigger sooner.
+		 */
+		if (blk_rq_pos(req) == mq->last_wr_end &&
+		    blk_rq_sectors(req) <= PCKD_SMALL_WR_SECTORS)
+			mq->num_of_potential_packed_wr_reqs++;
+		mq->last_wr_end = blk_rq_pos(req) + blk_rq_sectors(req);
 	}
 
 	if (mq->num_of_potential_packed_wr_reqs >
@@ -2081,6 +2217,7 @@ void mmc_blk_init_packed_statistics(struct mmc_card *card)
 	       sizeof(*card->wr_pack_stats.packing_events));
 	memset(&card->wr_pack_stats.pack_stop_reason, 0,
 		sizeof(card->wr_pack_stats.pack_stop_reason));
+	card->wr_pack_stats.contig_reqs = 0;
 	card->wr_pack_stats.enabled = true;
 	spin_unlock(&card->wr_pack_stats.lock);
 }
@@ -2095,6 +2232,7 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	bool en_rel_wr = card->ext_csd.rel_param & EXT_CSD_WR_REL_PARAM_EN;
 	unsigned int req_sectors = 0, phys_segments = 0;
 	unsigned int max_blk_count, max_phys_segs;
+	unsigned int budget_us;
 	u8 put_back = 0;
 	u8 max_packed_rw = 0;
 	u8 reqs = 0;
@@ -2142,17 +2280,39 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 		phys_segments++;
 	}
 
+	budget_us = mmc_blk_pack_time_budget(mq);
+
 	spin_lock(&stats->lock);
 
 	while (reqs < max_packed_rw - 1) {
+		/*
+		 * Write packing is disabled by mmc_urgent_request() when an
+		 * urgent request arrives, send what was packed so far.
+		 */
+		if (!ACCESS_ONCE(mq->wr_packing_enabled)) {
+			MMC_BLK_UPDATE_STOP_REASON(stats, URGENT_REQ);
+			break;
+		}
+
+		/*
+		 * Leave an urgent request at the head of the queue for the
+		 * next fetch rather than fetching and requeueing it.
+		 */
 		spin_lock_irq(q->queue_lock);
-		next = blk_fetch_request(q);
+		next = blk_peek_request(q);
+		if (next && !(next->cmd_flags & REQ_URGENT))
+			blk_start_request(next);
 		spin_unlock_irq(q->queue_lock);
 		if (!next) {
 			MMC_BLK_UPDATE_STOP_REASON(stats, EMPTY_QUEUE);
 			break;
 		}
 
+		if (next->cmd_flags & REQ_URGENT) {
+			MMC_BLK_UPDATE_STOP_REASON(stats, URGENT_REQ);
+			break;
+		}
+
 		if (mmc_large_sec(card) &&
 				!IS_ALIGNED(blk_rq_sectors(next), 8)) {
 			MMC_BLK_UPDATE_STOP_REASON(stats, LARGE_SEC_ALIGN);
@@ -2202,6 +2362,15 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 			break;
 		}
 
+		/* don't let the packed command outlast its time budget */
+		if (budget_us && mq->wr_ns_per_sect &&
+		    (u64)req_sectors * mq->wr_ns_per_sect >
+		    (u64)budget_us * NSEC_PER_USEC) {
+			MMC_BLK_UPDATE_STOP_REASON(stats, TIME_BUDGET);
+			put_back = 1;
+			break;
+		}
+
 		if (mq->no_pack_for_random) {
 			if ((blk_rq_pos(cur) + blk_rq_sectors(cur)) !=
 			    blk_rq_pos(next)) {
@@ -2217,6 +2386,9 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 				card->bkops_info.sectors_changed +=
 					blk_rq_sectors(next);
 		}
+		if (stats->enabled &&
+		    blk_rq_pos(cur) + blk_rq_sectors(cur) == blk_rq_pos(next))
+			stats->contig_reqs++;
 		list_add_tail(&next->queuelist, &mq->mqrq_cur->packed_list);
 		cur = next;
 		reqs++;
@@ -2233,6 +2405,9 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 			stats->packing_events[reqs + 1]++;
 		if (reqs + 1 == max_packed_rw)
 			MMC_BLK_UPDATE_STOP_REASON(stats, THRESHOLD);
+		stats->time_budget_us = budget_us;
+		stats->wr_ns_per_sect = mq->wr_ns_per_sect;
+		stats->rd_interval_us = mq->rd_interval_us;
 	}
 
 	spin_unlock(&stats->lock);
@@ -2449,6 +2624,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	struct mmc_queue_req *mq_rq;
 	struct request *req;
 	struct mmc_async_req *areq;
+	ktime_t now;
 	const u8 packed_num = 2;
 	u8 reqs = 0;
 
@@ -2472,6 +2648,10 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		} else
 			areq = NULL;
 		areq = mmc_start_req(card->host, areq, (int *) &status);
+		/* the previous request is done and the new one started */
+		now = ktime_get();
+		if (rqc)
+			mq->mqrq_cur->start_time = now;
 		if (!areq) {
 			if (status == MMC_BLK_NEW_REQUEST)
 				mq->flags |= MMC_QUEUE_NEW_REQUEST;
@@ -2506,6 +2686,9 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			 */
 			mmc_blk_reset_success(md, type);
 
+			if (status == MMC_BLK_SUCCESS && type == MMC_BLK_WRITE)
+				mmc_blk_update_wr_cost(mq, mq_rq, now);
+
 			if (mq_rq->packed_cmd != MMC_PACKED_NONE) {
 				ret = mmc_blk_end_packed_req(mq_rq);
 				break;
@@ -2931,6 +3114,8 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 		card = md->queue.card;
 		device_remove_file(disk_to_dev(md->disk),
 				   &md->num_wr_reqs_to_start_packing);
+		device_remove_file(disk_to_dev(md->disk),
+				   &md->pack_time_budget_ms);
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
 			if ((md->area_type & MMC_BLK_DATA_AREA_BOOT) &&
@@ -3031,8 +3216,21 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	if (ret)
 		goto no_pack_for_random_fails;
 
+	md->pack_time_budget_ms.show = pack_time_budget_ms_show;
+	md->pack_time_budget_ms.store = pack_time_budget_ms_store;
+	sysfs_attr_init(&md->pack_time_budget_ms.attr);
+	md->pack_time_budget_ms.attr.name = "pack_time_budget_ms";
+	md->pack_time_budget_ms.attr.mode = S_IRUGO | S_IWUSR;
+	ret = device_create_file(disk_to_dev(md->disk),
+				 &md->pack_time_budget_ms);
+	if (ret)
+		goto pack_time_budget_ms_fails;
+
 	return ret;
 
+pack_time_budget_ms_fails:
+	device_remove_file(disk_to_dev(md->disk),
+			   &md->no_pack_for_random);
 no_pack_for_random_fails:
 	device_remove_file(disk_to_dev(md->disk),
 			   &md->bkops_check_threshold);
@@ -21,6 +21,8 @@
 #include <linux/delay.h>
 #include <linux/test-iosched.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
 #include "queue.h"
 #include <linux/mmc/mmc.h>
 
@@ -70,6 +72,10 @@
 #define NEW_REQ_TEST_SLEEP_TIME 1
 #define NEW_REQ_TEST_NUM_BIOS 64
 #define TEST_REQUEST_NUM_OF_BIOS	3
+/* number of urgent reads sampled by the read latency under write test */
+#define READ_LAT_TEST_NUM_READS		500
+#define READ_LAT_TEST_SLEEP_TIME_MS	2
+#define READ_LAT_TEST_TIMEOUT		120000
 
 #define CHECK_BKOPS_STATS(stats, exp_bkops, exp_hpi, exp_suspend)	\
 				   ((stats.bkops != exp_bkops) ||	\
@@ -156,6 +162,7 @@ enum mmc_block_test_testcases {
 
 	TEST_LONG_SEQUENTIAL_READ,
 	TEST_LONG_SEQUENTIAL_WRITE,
+	TEST_READ_LATENCY_UNDER_WRITE,
 
 	TEST_NEW_REQ_NOTIFICATION,
 };
@@ -188,6 +195,7 @@ struct mmc_block_test_debug {
 	struct dentry *bkops_test;
 	struct dentry *long_sequential_read_test;
 	struct dentry *long_sequential_write_test;
+	struct dentry *read_latency_under_write_test;
 	struct dentry *new_req_notification_test;
 };
 
@@ -226,6 +234,13 @@ struct mmc_block_test_data {
 	wait_queue_head_t bkops_wait_q;
 	/* A counter for the number of test requests completed */
 	unsigned int completed_req_count;
+	/* Read latency under write test: an urgent read is outstanding */
+	bool read_in_flight;
+	/* Read latency under write test: issue time of the outstanding read */
+	ktime_t read_start;
+	/* Read latency under write test: collected samples, in usec */
+	unsigned int read_lat_count;
+	u32 read_lat_us[READ_LAT_TEST_NUM_READS];
 };
 
 static struct mmc_block_test_data *mbtd;
@@ -283,6 +298,14 @@ void print_mmc_packing_stats(struct mmc_card *card)
 		pr_info("%s: %d times: Threshold\n",
 			mmc_hostname(card->host),
 			card->wr_pack_stats.pack_stop_reason[THRESHOLD]);
+	if (card->wr_pack_stats.pack_stop_reason[URGENT_REQ])
+		pr_info("%s: %d times: urgent request\n",
+			mmc_hostname(card->host),
+			card->wr_pack_stats.pack_stop_reason[URGENT_REQ]);
+	if (card->wr_pack_stats.pack_stop_reason[TIME_BUDGET])
+		pr_info("%s: %d times: time budget\n",
+			mmc_hostname(card->host),
+			card->wr_pack_stats.pack_stop_reason[TIME_BUDGET]);
 
 	spin_unlock(&card->wr_pack_stats.lock);
 }
@@ -660,6 +683,8 @@ switch (td->test_info.testcase) {
 		return "\"long sequential read\"";
 	case TEST_LONG_SEQUENTIAL_WRITE:
 		return "\"long sequential write\"";
+	case TEST_READ_LATENCY_UNDER_WRITE:
+		return "\"read latency under write\"";
 	case TEST_NEW_REQ_NOTIFICATION:
 		return "\"new request notification test\"";
 	default:
@@ -3002,6 +3027,209 @@ const struct file_operations long_sequential_write_test_ops = {
 	.read = long_sequential_write_test_read,
 };
 
+static void read_lat_end_io_fn(struct request *rq, int err)
+{
+	struct test_request *test_rq =
+		(struct test_request *)rq->elv.priv[0];
+	struct test_data *ptd = test_get_test_data();
+	s64 lat_us;
+
+	BUG_ON(!test_rq);
+
+	lat_us = ktime_us_delta(ktime_get(), mbtd->read_start);
+	if (mbtd->read_lat_count < READ_LAT_TEST_NUM_READS)
+		mbtd->read_lat_us[mbtd->read_lat_count++] =
+			min_t(s64, lat_us, UINT_MAX);
+
+	spin_lock_irq(&ptd->lock);
+	list_del_init(&test_rq->queuelist);
+	ptd->dispatched_count--;
+	__blk_put_request(ptd->req_q, test_rq->rq);
+	spin_unlock_irq(&ptd->lock);
+
+	kfree(test_rq->bios_buffer);
+	kfree(test_rq);
+	mbtd->read_in_flight = false;
+
+	check_test_completion();
+}
+
+/*
+ * Keep the queue full of large writes, so that the mmc layer packs them,
+ * and issue one urgent single-sector read at a time on top of them. The
+ * time from issuing each read to its completion is sampled. The test fails
+ * if the samples are not all taken within READ_LAT_TEST_TIMEOUT msec.
+ */
+static int run_read_lat_under_write(struct test_data *td)
+{
+	struct request_queue *q = td->req_q;
+	struct test_request *test_rq;
+	unsigned long deadline;
+	unsigned int queued;
+	int ret = 0;
+
+	td->test_count = 0;
+	mbtd->completed_req_count = 0;
+	mbtd->read_lat_count = 0;
+	mbtd->read_in_flight = false;
+
+	test_pr_info("%s: sampling %d urgent reads under write load, "
+		     "first req_id=%d", __func__, READ_LAT_TEST_NUM_READS,
+		     td->wr_rd_next_req_id);
+
+	deadline = jiffies + msecs_to_jiffies(READ_LAT_TEST_TIMEOUT);
+	do {
+		/* the test timer fired, or the test was otherwise ended */
+		if (td->test_state != TEST_RUNNING) {
+			test_pr_err("%s: test ended after %d reads", __func__,
+				    mbtd->read_lat_count);
+			return -ETIMEDOUT;
+		}
+		if (time_after(jiffies, deadline)) {
+			test_pr_err("%s: timed out after %d reads", __func__,
+				    mbtd->read_lat_count);
+			return -ETIMEDOUT;
+		}
+
+		/* same request pool limitation as in the long write test */
+		for (;;) {
+			spin_lock_irq(q->queue_lock);
+			queued = td->test_count + td->dispatched_count;
+			spin_unlock_irq(q->queue_lock);
+			if (queued >= TEST_MAX_REQUESTS)
+				break;
+
+			ret = test_iosched_add_wr_rd_test_req(0, WRITE,
+				  td->start_sector, TEST_MAX_BIOS_PER_REQ,
+				  TEST_PATTERN_5A,
+				  long_seq_write_free_end_io_fn);
+			if (ret) {
+				test_pr_err("%s: failed to create write request",
+					    __func__);
+				return ret;
+			}
+		}
+
+		if (!mbtd->read_in_flight) {
+			test_rq = test_iosched_create_test_req(0, READ,
+				  td->start_sector, 1, TEST_NO_PATTERN,
+				  read_lat_end_io_fn);
+			if (!test_rq) {
+				test_pr_err("%s: failed to create read request",
+					    __func__);
+				return -ENODEV;
+			}
+			mbtd->read_in_flight = true;
+			mbtd->read_start = ktime_get();
+			test_iosched_add_urgent_req(test_rq);
+		}
+
+		blk_run_queue(q);
+		msleep(READ_LAT_TEST_SLEEP_TIME_MS);
+	} while (mbtd->read_lat_count < READ_LAT_TEST_NUM_READS);
+
+	test_pr_info("%s: completed %d write requests", __func__,
+		     mbtd->completed_req_count);
+
+	return ret;
+}
+
+static int read_lat_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static ssize_t read_latency_under_write_test_write(struct file *file,
+				const char __user *buf,
+				size_t count,
+				loff_t *ppos)
+{
+	int ret = 0;
+	int i = 0;
+	int number = -1;
+	unsigned int n;
+	unsigned long mtime, byte_count;
+
+	test_pr_info("%s: -- Read Latency Under Write TEST --", __func__);
+
+	sscanf(buf, "%d", &number);
+
+	if (number <= 0)
+		number = 1;
+
+	memset(&mbtd->test_info, 0, sizeof(struct test_info));
+	mbtd->test_group = TEST_GENERAL_GROUP;
+
+	mbtd->test_info.data = mbtd;
+	mbtd->test_info.get_test_case_str_fn = get_test_case_str;
+	mbtd->test_info.run_test_fn = run_read_lat_under_write;
+	mbtd->test_info.timeout_msec = READ_LAT_TEST_TIMEOUT;
+
+	for (i = 0 ; i < number ; ++i) {
+		test_pr_info("%s: Cycle # %d / %d", __func__, i+1, number);
+		test_pr_info("%s: ====================", __func__);
+
+		mbtd->test_info.test_byte_count = 0;
+		mbtd->test_info.testcase = TEST_READ_LATENCY_UNDER_WRITE;
+		mbtd->is_random = NON_RANDOM_TEST;
+		ret = test_iosched_start_test(&mbtd->test_info);
+		if (ret)
+			break;
+
+		n = mbtd->read_lat_count;
+		if (!n)
+			break;
+		sort(mbtd->read_lat_us, n, sizeof(u32), read_lat_cmp, NULL);
+		test_pr_info("%s: read latency p50 %u usec, p99 %u usec, "
+			     "max %u usec", __func__, mbtd->read_lat_us[n / 2],
+			     mbtd->read_lat_us[n * 99 / 100],
+			     mbtd->read_lat_us[n - 1]);
+
+		mtime = jiffies_to_msecs(mbtd->test_info.test_duration);
+		byte_count = mbtd->test_info.test_byte_count;
+		if (mtime)
+			test_pr_info("%s: Throughput: %lu KiB/sec\n", __func__,
+				     (byte_count / 1024) * 1000 / mtime);
+
+		/* Allow FS requests to be dispatched */
+		msleep(1000);
+	}
+
+	return count;
+}
+
+static ssize_t read_latency_under_write_test_read(struct file *file,
+			       char __user *buffer,
+			       size_t count,
+			       loff_t *offset)
+{
+	memset((void *)buffer, 0, count);
+
+	snprintf(buffer, count,
+		 "\nread_latency_under_write_test\n"
+		 "=========\n"
+		 "Description:\n"
+		 "This test runs the following scenarios\n"
+		 "- Read Latency Under Write Test: this test keeps the queue "
+		 "full of large sequential writes and measures the completion "
+		 "latency of urgent single sector reads issued on top of them, "
+		 "together with the write throughput\n");
+
+	if (message_repeat == 1) {
+		message_repeat = 0;
+		return strnlen(buffer, count);
+	} else
+		return 0;
+}
+
+const struct file_operations read_latency_under_write_test_ops = {
+	.open = test_open,
+	.write = read_latency_under_write_test_write,
+	.read = read_latency_under_write_test_read,
+};
+
 static ssize_t new_req_notification_test_write(struct file *file,
 				const char __user *buf,
 				size_t count,
@@ -3081,6 +3309,7 @@ static void mmc_block_test_debugfs_cleanup(void)
 	debugfs_remove(mbtd->debug.bkops_test);
 	debugfs_remove(mbtd->debug.long_sequential_read_test);
 	debugfs_remove(mbtd->debug.long_sequential_write_test);
+	debugfs_remove(mbtd->debug.read_latency_under_write_test);
 	debugfs_remove(mbtd->debug.new_req_notification_test);
 }
 
@@ -3194,6 +3423,16 @@ static int mmc_block_test_debugfs_init(void)
 	if (!mbtd->debug.long_sequential_write_test)
 		goto err_nomem;
 
+	mbtd->debug.read_latency_under_write_test = debugfs_create_file(
+					"read_latency_under_write_test",
+					S_IRUGO | S_IWUGO,
+					tests_root,
+					NULL,
+					&read_latency_under_write_test_ops);
+
+	if (!mbtd->debug.read_latency_under_write_test)
+		goto err_nomem;
+
 	return 0;
 
 err_nomem:
@@ -30,6 +30,12 @@
  */
 #define DEFAULT_NUM_REQS_TO_START_PACK 17
 
+/*
+ * Upper bound on the time a packed write command is expected to hold the
+ * bus, a read arriving behind it waits at most that long.
+ */
+#define DEFAULT_PACK_TIME_BUDGET_MS 20
+
 /*
  * Prepare a MMC request. This just filters out odd stuff.
  */
@@ -163,6 +169,9 @@ static void mmc_request(struct request_queue *q)
  * current request may be interrupted and re-inserted back to block device
  * request queue.  The next fetched request should be urgent request, this
  * will be ensured by block i/o scheduler.
+ *
+ * Hosts or cards that cannot stop an ongoing request still get the urgent
+ * request ahead of any write packing that is being assembled.
  */
 static void mmc_urgent_request(struct request_queue *q)
 {
@@ -176,6 +185,12 @@ static void mmc_urgent_request(struct request_queue *q)
 	}
 	cntx = &mq->card->host->context_info;
 
+	if (!mq->can_stop_req) {
+		mmc_blk_disable_wr_packing(mq);
+		mmc_request(q);
+		return;
+	}
+
 	/* critical section with mmc_wait_data_done() */
 	spin_lock_irqsave(&cntx->lock, flags);
 
@@ -262,10 +277,9 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	if (!mq->queue)
 		return -ENOMEM;
 
-	if ((host->caps2 & MMC_CAP2_STOP_REQUEST) &&
-			host->ops->stop_request &&
-			mq->card->ext_csd.hpi)
-		blk_urgent_request(mq->queue, mmc_urgent_request);
+	mq->can_stop_req = (host->caps2 & MMC_CAP2_STOP_REQUEST) &&
+			host->ops->stop_request && mq->card->ext_csd.hpi;
+	blk_urgent_request(mq->queue, mmc_urgent_request);
 
 	memset(&mq->mqrq_cur, 0, sizeof(mq->mqrq_cur));
 	memset(&mq->mqrq_prev, 0, sizeof(mq->mqrq_prev));
@@ -279,6 +293,7 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	mq->num_wr_reqs_to_start_packing =
 		min_t(int, (int)card->ext_csd.max_packed_writes,
 		     DEFAULT_NUM_REQS_TO_START_PACK);
+	mq->pack_time_budget_ms = DEFAULT_PACK_TIME_BUDGET_MS;
 
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
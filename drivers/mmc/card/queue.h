@@ -32,6 +32,7 @@ struct mmc_queue_req {
 	int		packed_retries;
 	int		packed_fail_idx;
 	u8		packed_num;
+	ktime_t		start_time;	/* when the request went to the host */
 };
 
 struct mmc_queue {
@@ -53,6 +54,12 @@ struct mmc_queue {
 	int			num_of_potential_packed_wr_reqs;
 	int			num_wr_reqs_to_start_packing;
 	bool			no_pack_for_random;
+	bool			can_stop_req;	/* ongoing request can be stopped */
+	unsigned int		pack_time_budget_ms;	/* 0 disables it */
+	u32			wr_ns_per_sect;	/* write cost, moving average */
+	u32			rd_interval_us;	/* read inter-arrival, average */
+	ktime_t			last_rd_time;
+	sector_t		last_wr_end;
 	int (*err_check_fn) (struct mmc_card *, struct mmc_async_req *);
 	void (*packed_test_fn) (struct request_queue *, struct mmc_queue_req *);
 };
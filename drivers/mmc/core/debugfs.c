@@ -506,6 +506,31 @@ static ssize_t mmc_wr_pack_stats_read(struct file *filp, char __user *ubuf,
 			pack_stats->pack_stop_reason[FUA]);
 		strlcat(ubuf, temp_buf, cnt);
 	}
+	if (pack_stats->pack_stop_reason[URGENT_REQ]) {
+		snprintf(temp_buf, TEMP_BUF_SIZE,
+			 "%s: %d times: urgent request\n",
+			mmc_hostname(card->host),
+			pack_stats->pack_stop_reason[URGENT_REQ]);
+		strlcat(ubuf, temp_buf, cnt);
+	}
+	if (pack_stats->pack_stop_reason[TIME_BUDGET]) {
+		snprintf(temp_buf, TEMP_BUF_SIZE,
+			 "%s: %d times: time budget\n",
+			mmc_hostname(card->host),
+			pack_stats->pack_stop_reason[TIME_BUDGET]);
+		strlcat(ubuf, temp_buf, cnt);
+	}
+
+	snprintf(temp_buf, TEMP_BUF_SIZE,
+		 "%s: %u packed reqs contiguous with the previous one\n",
+		 mmc_hostname(card->host), pack_stats->contig_reqs);
+	strlcat(ubuf, temp_buf, cnt);
+	snprintf(temp_buf, TEMP_BUF_SIZE,
+		 "%s: time budget %u usec, write cost %u ns/sector, "
+		 "read interval %u usec\n", mmc_hostname(card->host),
+		 pack_stats->time_budget_us, pack_stats->wr_ns_per_sect,
+		 pack_stats->rd_interval_us);
+	strlcat(ubuf, temp_buf, cnt);
 
 	spin_unlock(&pack_stats->lock);
 
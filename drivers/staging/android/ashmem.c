@@ -27,8 +27,16 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
+#include <linux/debugfs.h>
+#include <linux/highmem.h>
+#include <linux/lzo.h>
+#include <linux/pagemap.h>
+#include <linux/vmalloc.h>
+#include <linux/zsmalloc.h>
 #include <asm/cacheflush.h>
 
 #define ASHMEM_NAME_PREFIX "dev/ashmem/"
@@ -38,12 +46,13 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN]; /* optional name in /proc/pid/maps */
-	struct list_head unpinned_list;	 /* list of all ashmem areas */
+	struct mutex mutex;		 /* protects the area and its ranges */
+	struct rb_root unpinned_root;	 /* unpinned ranges, by page */
 	struct file *file;		 /* the shmem-based backing file */
 	size_t size;			 /* size of the mapping, in bytes */
 	unsigned long vm_start;		 /* Start address of vm_area
@@ -54,29 +63,59 @@ struct ashmem_area {
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex', `lru' also by `ashmem_lru_lock'
+ *
+ * The ranges of an area never overlap, so keeping them in an rbtree
+ * sorted by page also sorts them by end page, and any interval lookup
+ * is a single O(log n) descent.
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
+	struct ashmem_zdata *zdata;	/* compressed copy of the pages */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/*
+ * ashmem_zdata - compressed copy of a truncated, but not purged, range
+ * Lifecycle: From the shrinker compressing the range until its pin or the
+ * shrinker dropping the copy, which purges the range
+ * Locking: Protected by the range's area `mutex'
+ */
+struct ashmem_zdata {
+	size_t zbytes;			/* compressed bytes held */
+	size_t nr;			/* pages in the range */
+	struct {
+		unsigned long handle;	/* zsmalloc handle, 0 for a hole */
+		unsigned int len;	/* PAGE_SIZE if stored uncompressed */
+	} pages[0];
+};
+
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
+/* LRU list of compressed ranges, protected by ashmem_lru_lock */
+static LIST_HEAD(ashmem_zlru_list);
+
+/* Compressed bytes on that list, protected by ashmem_lru_lock */
+static u64 ashmem_zbytes;
+
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and lru_count
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->mutex -> ashmem_lru_lock
+ *		  asma->mutex -> i_mutex -> i_alloc_sem
+ *
+ * The shrinker walks the LRU under ashmem_lru_lock and only trylocks the
+ * area of a range, so it never waits for pin/unpin of any area.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -85,7 +124,7 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 	((range)->pgend - (range)->pgstart + 1)
 
 #define range_on_lru(range) \
-	((range)->purged == ASHMEM_NOT_PURGED)
+	((range)->purged == ASHMEM_NOT_PURGED && !(range)->zdata)
 
 #define page_range_subsumes_range(range, start, end) \
 	(((range)->pgstart >= (start)) && ((range)->pgend <= (end)))
@@ -100,38 +139,70 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 	(page_in_range(range, start) || page_in_range(range, end) || \
 		page_range_subsumes_range(range, start, end))
 
-#define range_before_page(range, page) \
-	((range)->pgend < (page))
 
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
+/* Caller must hold ashmem_lru_lock */
 static inline void lru_add(struct ashmem_range *range)
 {
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
 }
 
+/* Caller must hold ashmem_lru_lock */
 static inline void lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
 }
 
+/*
+ * range_first - the lowest unpinned range of 'asma' ending at or after
+ * page 'pgstart', or NULL if there is none
+ *
+ * Caller must hold asma->mutex.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma,
+					size_t pgstart)
+{
+	struct rb_node *node = asma->unpinned_root.rb_node;
+	struct ashmem_range *range, *first = NULL;
+
+	while (node) {
+		range = rb_entry(node, struct ashmem_range, node);
+		if (range->pgend >= pgstart) {
+			first = range;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	return first;
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *node = rb_next(&range->node);
+
+	return node ? rb_entry(node, struct ashmem_range, node) : NULL;
+}
+
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
+	struct rb_node **p = &asma->unpinned_root.rb_node;
+	struct rb_node *parent = NULL;
 	struct ashmem_range *range;
 
 	range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
@@ -143,39 +214,444 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	while (*p) {
+		parent = *p;
+		if (start < rb_entry(parent, struct ashmem_range, node)->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned_root);
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_add(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 
 	return 0;
 }
 
+static void zdata_free(struct ashmem_zdata *zdata);
+
+/* Caller must hold range->asma->mutex */
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
-	if (range_on_lru(range))
+	rb_erase(&range->node, &range->asma->unpinned_root);
+	spin_lock(&ashmem_lru_lock);
+	if (range_on_lru(range)) {
 		lru_del(range);
+	} else if (range->zdata) {
+		list_del(&range->lru);
+		ashmem_zbytes -= range->zdata->zbytes;
+	}
+	spin_unlock(&ashmem_lru_lock);
+	zdata_free(range->zdata);
 	kmem_cache_free(ashmem_range_cachep, range);
 }
 
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Only ever moves the ends inwards, so the range keeps its place in the
+ * tree. Caller must hold range->asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
 {
 	size_t pre = range_size(range);
 
+	spin_lock(&ashmem_lru_lock);
 	range->pgstart = start;
 	range->pgend = end;
 
 	if (range_on_lru(range))
 		lru_count -= pre - range_size(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
+/*
+ * lru_trylock_first - the first range on 'list' whose area is not busy,
+ * returned with the area's mutex held, or NULL. Ranges of busy areas, which
+ * may be pinning those very ranges, are rotated to the tail of the list,
+ * and a full pass over them ends the search.
+ *
+ * Caller must hold ashmem_lru_lock.
+ */
+static struct ashmem_range *lru_trylock_first(struct list_head *list)
+{
+	struct ashmem_range *range, *skipped = NULL;
+
+	while (!list_empty(list)) {
+		range = list_first_entry(list, struct ashmem_range, lru);
+		if (mutex_trylock(&range->asma->mutex))
+			return range;
+		if (range == skipped)
+			break;
+		if (!skipped)
+			skipped = range;
+		list_move_tail(&range->lru, list);
+	}
+
+	return NULL;
+}
+
+/* range_truncate - drop the pages of a range from its backing file */
+static void range_truncate(struct ashmem_range *range)
+{
+	struct inode *inode = range->asma->file->f_dentry->d_inode;
+	loff_t start = range->pgstart * PAGE_SIZE;
+	loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+
+	vmtruncate_range(inode, start, end);
+}
+
+#ifdef CONFIG_ASHMEM_COMPRESS
+/*
+ * Compressed backing. With 'compress' set, the shrinker LZO compresses
+ * the pages of an unpinned range into a zsmalloc pool before truncating
+ * them, and pinning or merging the range decompresses them back into the
+ * file, so the range is not reported as purged. Compressed ranges sit on
+ * their own LRU; their copies are dropped, purging the ranges for real,
+ * once nothing is left to compress or the pool outgrows 'compress_max_mb'.
+ *
+ * debugfs ashmem/ counts compressed, restored and dropped ranges, the hit
+ * rate of the compressed copies is restored / (restored + dropped).
+ */
+
+/* larger ranges are purged rather than compressed */
+#define ASHMEM_COMPRESS_MAX_PAGES	256
+
+/* the shrinker must not dig into the emergency reserves */
+#define ASHMEM_ZGFP	(GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN | \
+			 __GFP_NOMEMALLOC)
+
+static bool ashmem_compress;
+module_param_named(compress, ashmem_compress, bool, S_IRUGO | S_IWUSR);
+
+static unsigned int ashmem_compress_max_mb = 32;
+module_param_named(compress_max_mb, ashmem_compress_max_mb, uint,
+		   S_IRUGO | S_IWUSR);
+
+static struct zs_pool *ashmem_zpool;
+
+/* statistics, protected by ashmem_lru_lock */
+static u64 ashmem_zstat_compressed;
+static u64 ashmem_zstat_restored;
+static u64 ashmem_zstat_dropped;
+static u64 ashmem_zstat_failed;
+
+/* the compression buffers, protected by ashmem_zbuf_mutex */
+static DEFINE_MUTEX(ashmem_zbuf_mutex);
+static void *ashmem_zwrkmem;
+static unsigned char *ashmem_zdst;
+
+static struct dentry *ashmem_debugfs_root;
+
+static void zdata_free(struct ashmem_zdata *zdata)
+{
+	size_t i;
+
+	if (!zdata)
+		return;
+	for (i = 0; i < zdata->nr; i++)
+		if (zdata->pages[i].handle)
+			zs_free(ashmem_zpool, zdata->pages[i].handle);
+	kfree(zdata);
+}
+
+/*
+ * zpage_store - compress page 'index' of 'mapping' into the pool
+ *
+ * A page that is not in the page cache is a hole and reads back as zeroes,
+ * a page that is swapped out cannot be compressed.
+ *
+ * Caller must hold ashmem_zbuf_mutex.
+ */
+static int zpage_store(struct address_space *mapping, pgoff_t index,
+		       unsigned long *handle, unsigned int *len)
+{
+	struct page *page;
+	unsigned char *src, *buf;
+	size_t dlen;
+	int ret = 0;
+
+	page = find_get_page(mapping, index);
+	if (!page)
+		return 0;
+	if (radix_tree_exceptional_entry(page))
+		return -EAGAIN;
+
+	if (!trylock_page(page)) {
+		ret = -EAGAIN;
+		goto out;
+	}
+	if (!PageUptodate(page)) {
+		ret = -EAGAIN;
+		goto unlock;
+	}
+
+	src = kmap_atomic(page);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, ashmem_zdst, &dlen,
+			       ashmem_zwrkmem);
+	kunmap_atomic(src);
+	if (ret != LZO_E_OK) {
+		ret = -EIO;
+		goto unlock;
+	}
+	if (dlen >= PAGE_SIZE)
+		dlen = PAGE_SIZE;
+
+	*handle = zs_malloc(ashmem_zpool, dlen, ASHMEM_ZGFP | __GFP_HIGHMEM);
+	if (!*handle) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	buf = zs_map_object(ashmem_zpool, *handle, ZS_MM_WO);
+	if (dlen == PAGE_SIZE) {
+		src = kmap_atomic(page);
+		memcpy(buf, src, PAGE_SIZE);
+		kunmap_atomic(src);
+	} else {
+		memcpy(buf, ashmem_zdst, dlen);
+	}
+	zs_unmap_object(ashmem_zpool, *handle);
+	*len = dlen;
+
+unlock:
+	unlock_page(page);
+out:
+	page_cache_release(page);
+	return ret;
 }
 
+/* zpage_load - decompress a page stored by zpage_store() into 'mapping' */
+static int zpage_load(struct address_space *mapping, pgoff_t index,
+		      unsigned long handle, unsigned int len)
+{
+	struct page *page;
+	unsigned char *src, *dst;
+	size_t dlen = PAGE_SIZE;
+	int ret = 0;
+
+	if (!handle)
+		return 0;
+
+	page = shmem_read_mapping_page(mapping, index);
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+
+	src = zs_map_object(ashmem_zpool, handle, ZS_MM_RO);
+	dst = kmap_atomic(page);
+	if (len == PAGE_SIZE)
+		memcpy(dst, src, PAGE_SIZE);
+	else if (lzo1x_decompress_safe(src, len, dst, &dlen) != LZO_E_OK ||
+		 dlen != PAGE_SIZE)
+		ret = -EIO;
+	kunmap_atomic(dst);
+	zs_unmap_object(ashmem_zpool, handle);
+
+	flush_dcache_page(page);
+	/* shmem only keeps dirty pages across reclaim */
+	set_page_dirty(page);
+	page_cache_release(page);
+	return ret;
+}
+
+/*
+ * range_compress - compress the pages of a range that is off the LRU and
+ * about to be truncated, and put it on the compressed LRU. Returns zero
+ * on success, the range must be purged otherwise.
+ *
+ * Caller must hold range->asma->mutex.
+ */
+static int range_compress(struct ashmem_range *range)
+{
+	struct address_space *mapping = range->asma->file->f_mapping;
+	size_t i, nr = range_size(range);
+	struct ashmem_zdata *zdata;
+	int ret = 0;
+
+	if (!ashmem_compress || !ashmem_zpool ||
+	    nr > ASHMEM_COMPRESS_MAX_PAGES ||
+	    ashmem_zbytes >= (u64)ashmem_compress_max_mb << 20)
+		return -EINVAL;
+
+	zdata = kzalloc(sizeof(*zdata) + nr * sizeof(zdata->pages[0]),
+			ASHMEM_ZGFP);
+	if (!zdata)
+		return -ENOMEM;
+	zdata->nr = nr;
+
+	mutex_lock(&ashmem_zbuf_mutex);
+	for (i = 0; i < nr && !ret; i++) {
+		ret = zpage_store(mapping, range->pgstart + i,
+				  &zdata->pages[i].handle,
+				  &zdata->pages[i].len);
+		zdata->zbytes += zdata->pages[i].len;
+	}
+	mutex_unlock(&ashmem_zbuf_mutex);
+
+	spin_lock(&ashmem_lru_lock);
+	if (ret) {
+		ashmem_zstat_failed++;
+	} else {
+		range->zdata = zdata;
+		list_add_tail(&range->lru, &ashmem_zlru_list);
+		ashmem_zbytes += zdata->zbytes;
+		ashmem_zstat_compressed++;
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	if (ret)
+		zdata_free(zdata);
+	return ret;
+}
+
+/*
+ * range_restore - decompress a compressed range back into its file and
+ * return it to the LRU, or purge it if that fails
+ *
+ * Caller must hold range->asma->mutex.
+ */
+static void range_restore(struct ashmem_range *range)
+{
+	struct address_space *mapping = range->asma->file->f_mapping;
+	struct ashmem_zdata *zdata = range->zdata;
+	size_t i;
+	int ret = 0;
+
+	spin_lock(&ashmem_lru_lock);
+	list_del(&range->lru);
+	ashmem_zbytes -= zdata->zbytes;
+	range->zdata = NULL;
+	spin_unlock(&ashmem_lru_lock);
+
+	for (i = 0; i < zdata->nr && !ret; i++)
+		ret = zpage_load(mapping, range->pgstart + i,
+				 zdata->pages[i].handle, zdata->pages[i].len);
+	zdata_free(zdata);
+
+	spin_lock(&ashmem_lru_lock);
+	if (ret) {
+		range->purged = ASHMEM_WAS_PURGED;
+		ashmem_zstat_failed++;
+	} else {
+		lru_add(range);
+		ashmem_zstat_restored++;
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	if (ret)
+		range_truncate(range);
+}
+
+static void __init ashmem_compress_init(void)
+{
+	ashmem_zwrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	ashmem_zdst = kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+	ashmem_zpool = zs_create_pool(GFP_KERNEL, NULL);
+	if (!ashmem_zwrkmem || !ashmem_zdst || !ashmem_zpool) {
+		printk(KERN_ERR "ashmem: no memory for compressed backing\n");
+		goto fail;
+	}
+
+	ashmem_debugfs_root = debugfs_create_dir("ashmem", NULL);
+	if (ashmem_debugfs_root) {
+		debugfs_create_u64("compressed_ranges", S_IRUGO,
+				   ashmem_debugfs_root,
+				   &ashmem_zstat_compressed);
+		debugfs_create_u64("restored_ranges", S_IRUGO,
+				   ashmem_debugfs_root, &ashmem_zstat_restored);
+		debugfs_create_u64("dropped_ranges", S_IRUGO,
+				   ashmem_debugfs_root, &ashmem_zstat_dropped);
+		debugfs_create_u64("compress_fail", S_IRUGO,
+				   ashmem_debugfs_root, &ashmem_zstat_failed);
+		debugfs_create_u64("compressed_bytes", S_IRUGO,
+				   ashmem_debugfs_root, &ashmem_zbytes);
+	}
+	return;
+
+fail:
+	if (ashmem_zpool)
+		zs_destroy_pool(ashmem_zpool);
+	ashmem_zpool = NULL;
+	kfree(ashmem_zdst);
+	vfree(ashmem_zwrkmem);
+}
+
+static void ashmem_compress_exit(void)
+{
+	debugfs_remove_recursive(ashmem_debugfs_root);
+	if (ashmem_zpool)
+		zs_destroy_pool(ashmem_zpool);
+	kfree(ashmem_zdst);
+	vfree(ashmem_zwrkmem);
+}
+
+/*
+ * ashmem_zshrink - drop compressed copies, oldest first, until 'nr_to_scan'
+ * pages are freed and the pool is within its limit. Only now are their
+ * ranges purged. Returns the number of pages freed.
+ */
+static unsigned long ashmem_zshrink(unsigned long nr_to_scan)
+{
+	struct ashmem_range *range;
+	struct ashmem_zdata *zdata;
+	unsigned long freed = 0;
+
+	spin_lock(&ashmem_lru_lock);
+	while ((freed < nr_to_scan ||
+		ashmem_zbytes > (u64)ashmem_compress_max_mb << 20) &&
+	       (range = lru_trylock_first(&ashmem_zlru_list))) {
+		zdata = range->zdata;
+		list_del(&range->lru);
+		ashmem_zbytes -= zdata->zbytes;
+		range->zdata = NULL;
+		range->purged = ASHMEM_WAS_PURGED;
+		ashmem_zstat_dropped++;
+		spin_unlock(&ashmem_lru_lock);
+
+		freed += max_t(unsigned long, zdata->zbytes >> PAGE_SHIFT, 1);
+		zdata_free(zdata);
+		mutex_unlock(&range->asma->mutex);
+
+		spin_lock(&ashmem_lru_lock);
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	return freed;
+}
+#else
+static inline void zdata_free(struct ashmem_zdata *zdata)
+{
+}
+
+static inline int range_compress(struct ashmem_range *range)
+{
+	return -EINVAL;
+}
+
+static inline void range_restore(struct ashmem_range *range)
+{
+}
+
+static inline void ashmem_compress_init(void)
+{
+}
+
+static inline void ashmem_compress_exit(void)
+{
+}
+
+static inline unsigned long ashmem_zshrink(unsigned long nr_to_scan)
+{
+	return 0;
+}
+#endif /* CONFIG_ASHMEM_COMPRESS */
+
 static int ashmem_open(struct inode *inode, struct file *file)
 {
 	struct ashmem_area *asma;
@@ -189,7 +665,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->mutex);
+	asma->unpinned_root = RB_ROOT;
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -200,12 +677,12 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *node;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+	while ((node = rb_first(&asma->unpinned_root)))
+		range_del(rb_entry(node, struct ashmem_range, node));
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -220,7 +697,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0)
@@ -239,7 +716,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -248,7 +725,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +745,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -284,7 +761,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,10 +805,54 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	asma->vm_start = vma->vm_start;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/* Number of pages the shrinker can give back */
+static unsigned long ashmem_nr_pages(void)
+{
+	return lru_count + (unsigned long)(ashmem_zbytes >> PAGE_SHIFT);
+}
+
+/*
+ * __ashmem_shrink - purge, or with 'compress' compress, unpinned ranges
+ * LRU-wise until 'sc->nr_to_scan' pages are freed
+ */
+static int __ashmem_shrink(struct shrink_control *sc, bool compress)
+{
+	struct ashmem_range *range;
+	unsigned long freed = 0;
+
+	/* We might recurse into filesystem code, so bail out if necessary */
+	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
+		return -1;
+	if (!sc->nr_to_scan)
+		return ashmem_nr_pages();
+
+	spin_lock(&ashmem_lru_lock);
+	while (freed < sc->nr_to_scan &&
+	       (range = lru_trylock_first(&ashmem_lru_list))) {
+		/* holding the area's mutex keeps the range alive */
+		lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+
+		freed += range_size(range);
+		if (!compress || range_compress(range))
+			range->purged = ASHMEM_WAS_PURGED;
+		range_truncate(range);
+		mutex_unlock(&range->asma->mutex);
+
+		spin_lock(&ashmem_lru_lock);
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	/* nothing left to compress, or the pool is full */
+	ashmem_zshrink(freed < sc->nr_to_scan ? sc->nr_to_scan - freed : 0);
+
+	return ashmem_nr_pages();
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -349,33 +870,7 @@ out:
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
-
-	/* We might recurse into filesystem code, so bail out if necessary */
-	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
-		return -1;
-	if (!sc->nr_to_scan)
-		return lru_count;
-
-	if (!mutex_trylock(&ashmem_mutex))
-		return lru_count;
-
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
-
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
-	}
-	mutex_unlock(&ashmem_mutex);
-
-	return lru_count;
+	return __ashmem_shrink(sc, true);
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -387,7 +882,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -402,7 +897,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -415,7 +910,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	 */
 	char local_name[ASHMEM_NAME_LEN];
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -424,27 +919,27 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	}
 
 	/*
-	 * Holding the ashmem_mutex while doing a copy_from_user might cause
+	 * Holding the asma->mutex while doing a copy_from_user might cause
 	 * an data abort which would try to access mmap_sem. If another
 	 * thread has invoked ashmem_mmap then it will be holding the
-	 * semaphore and will be waiting for ashmem_mutex, there by leading to
+	 * semaphore and will be waiting for asma->mutex, there by leading to
 	 * deadlock. We'll release the mutex  and take the name to a local
 	 * variable that does not need protection and later copy the local
 	 * variable to the structure member with lock held.
 	 */
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	if (unlikely(copy_from_user(local_name, name, ASHMEM_NAME_LEN))){
 		/* Lock is already dropped, just return */
 		ret = -EFAULT;
 		return ret;
 	}
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	memcpy(asma->name + ASHMEM_NAME_PREFIX_LEN,
 		local_name, ASHMEM_NAME_LEN);
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -461,7 +956,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 	 */
 	char local_name[ASHMEM_NAME_LEN];
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 
 		/*
@@ -474,7 +969,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 		len = sizeof(ASHMEM_NAME_DEF);
 		memcpy(local_name, ASHMEM_NAME_DEF, len);
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	/*
 	 * Now we are just copying from the stack variable to userland
@@ -489,17 +984,17 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	/* only the ranges overlapping [pgstart, pgend] are visited */
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
@@ -517,6 +1012,8 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    create a new range for the other side.
 		 */
 		if (page_range_in_range(range, pgstart, pgend)) {
+			if (range->zdata)
+				range_restore(range);
 			ret |= range->purged;
 
 			/* Case #1: Easy. Just nuke the whole thing. */
@@ -542,7 +1039,7 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 			 * more complicated, we allocate a new range for the
 			 * second half and adjust the first chunk's endpoint.
 			 */
-			range_alloc(asma, range, range->purged,
+			range_alloc(asma, range->purged,
 				    pgend + 1, range->pgend);
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
@@ -555,18 +1052,16 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to unpin pages that are already entirely
@@ -574,40 +1069,31 @@ restart:
 		 */
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+		if (range->zdata)
+			range_restore(range);
+		pgstart = min_t(size_t, range->pgstart, pgstart);
+		pgend = max_t(size_t, range->pgend, pgend);
+		purged |= range->purged;
+		range_del(range);
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
+	struct ashmem_range *range = range_first(asma, pgstart);
 
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
-
-	return ret;
+	if (range && range->pgstart <= pgend)
+		return ASHMEM_IS_UNPINNED;
+	return ASHMEM_IS_PINNED;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -639,7 +1125,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -653,7 +1139,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -790,9 +1276,10 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				.gfp_mask = GFP_KERNEL,
 				.nr_to_scan = 0,
 			};
-			ret = ashmem_shrink(&ashmem_shrinker, &sc);
-			sc.nr_to_scan = ret;
-			ashmem_shrink(&ashmem_shrinker, &sc);
+			ret = __ashmem_shrink(&sc, false);
+			/* compressed copies go too, however few pages each */
+			sc.nr_to_scan = ULONG_MAX;
+			__ashmem_shrink(&sc, false);
 		}
 		break;
 	case ASHMEM_CACHE_FLUSH_RANGE:
@@ -905,6 +1392,7 @@ static int __init ashmem_init(void)
 		return ret;
 	}
 
+	ashmem_compress_init();
 	register_shrinker(&ashmem_shrinker);
 
 	printk(KERN_INFO "ashmem: initialized\n");
@@ -917,6 +1405,7 @@ static void __exit ashmem_exit(void)
 	int ret;
 
 	unregister_shrinker(&ashmem_shrinker);
+	ashmem_compress_exit();
 
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
@@ -147,6 +147,35 @@ struct binder_transaction_data {
 	} data;
 };
 
+/*
+ * Scatter-gather transactions (BC_TRANSACTION_SG, BC_REPLY_SG) describe
+ * their data as a list of user buffers instead of one flat buffer. The
+ * driver copies every chunk straight into the target's transaction
+ * buffer; chunk i starts at the first pointer-aligned offset after chunk
+ * i - 1 and data_size must cover exactly the last chunk. offsets_size and
+ * the offsets array keep their usual meaning relative to the assembled
+ * data.
+ *
+ * If fixup_offset is not BINDER_SG_NO_FIXUP, the driver stores the
+ * receiver's address of the chunk at that offset of the assembled data,
+ * so that the receiver can follow embedded pointers without copying. The
+ * fixup slot must lie in an earlier chunk.
+ */
+#define BINDER_SG_NO_FIXUP	((size_t)-1)
+#define BINDER_SG_MAX_ENTRIES	64
+
+struct binder_sg_entry {
+	const void	*buffer;	/* chunk in the sender address space */
+	size_t		size;		/* bytes in the chunk */
+	size_t		fixup_offset;	/* where to store the chunk address */
+};
+
+struct binder_transaction_data_sg {
+	struct binder_transaction_data	transaction_data;
+	const struct binder_sg_entry	*sg_list;
+	size_t				sg_count;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +353,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, with its data
+	 * supplied as a scatter-gather list.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
@@ -25,30 +25,55 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/pagemap.h>
+#include <linux/atomic.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 #ifdef CONFIG_SEC_DEBUG
 #include <mach/sec_debug.h>
-static char klog_buf[256];
 #endif
 
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers do not take a lock. A writer claims space by advancing 'reserve'
+ * with cmpxchg, copies its entry in with preemption disabled and publishes
+ * it by advancing 'commit' once every earlier reservation is committed.
+ * Positions count bytes written since boot; logger_offset() maps them into
+ * the buffer. Readers only ever see entries below 'commit', and detect that
+ * a writer lapped them by comparing their position against 'reserve'.
+ *
+ * The mutex 'mutex' serializes readers and protects the readers list.
+ * 'w_off' and 'head' mirror 'commit' and 'head_pos' as buffer offsets for
+ * the crash dump tools.
  */
 struct logger_log {
 	unsigned char		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	struct mutex		mutex;	/* mutex protecting readers */
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	atomic64_t		reserve; /* end of the last reserved entry */
+	atomic64_t		commit;	/* end of the last committed entry */
+	atomic64_t		head_pos; /* oldest entry not overwritten */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	struct work_struct	hist_work; /* compresses the ring into hist */
+	atomic64_t		hist_pos; /* next position to compress */
+	struct list_head	hist;	/* compressed blocks, oldest first */
+	size_t			hist_bytes; /* compressed bytes on hist */
+	unsigned char		*hist_cache; /* hist_cached, decompressed */
+	struct logger_hist_block *hist_cached;
+#endif
 };
 
 /*
@@ -60,13 +85,16 @@ struct logger_log {
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	u64			r_pos;	/* position of the next entry */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
+	/* the entry at r_pos, copied out by logger_fetch_entry() */
+	unsigned char		r_buf[sizeof(struct logger_entry) +
+				      LOGGER_ENTRY_MAX_PAYLOAD];
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
-size_t logger_offset(struct logger_log *log, size_t n)
+size_t logger_offset(struct logger_log *log, u64 n)
 {
 	return n & (log->size-1);
 }
@@ -123,8 +151,6 @@ static struct logger_entry *get_entry_header(struct logger_log *log,
  * An entry length is 2 bytes (16 bits) in host endian order.
  * In the log, the length does not include the size of the log entry structure.
  * This function returns the size including the log entry structure.
- *
- * Caller needs to hold log->mutex.
  */
 static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
 {
@@ -168,79 +194,380 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * logger_copy_from_ring - copies 'count' bytes at position 'pos' in 'log'
+ * into 'buf', wrapping around the end of the buffer.
+ */
+static void logger_copy_from_ring(struct logger_log *log, void *buf,
+				  u64 pos, size_t count)
+{
+	size_t off = logger_offset(log, pos);
+	size_t len = min(count, log->size - off);
+
+	memcpy(buf, log->buffer + off, len);
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+/*
+ * logger_lapped - has a writer reserved the bytes at position 'pos' for a
+ * newer entry? Readers check this after copying an entry out of the ring;
+ * if it is true the copy may be torn.
+ */
+static inline bool logger_lapped(struct logger_log *log, u64 pos)
+{
+	return atomic64_read(&log->reserve) - pos > log->size;
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * Compressed history
+ *
+ * With 'compress' set, each log's committed entries are LZO compressed in
+ * chunks of whole entries of at least LOGGER_HIST_CHUNK bytes, on an
+ * ordered workqueue, before the writers overwrite them. The compressed
+ * blocks are kept oldest first on log->hist, up to 'history_size' bytes
+ * per log. Readers that fall behind the ring continue from the history,
+ * and new readers start at its oldest entry.
+ */
+#define LOGGER_HIST_CHUNK	(32 * 1024)
+#define LOGGER_HIST_BUF_SIZE	(LOGGER_HIST_CHUNK + \
+				 sizeof(struct logger_entry) + \
+				 LOGGER_ENTRY_MAX_PAYLOAD)
+
+struct logger_hist_block {
+	struct list_head	list;	/* entry in log->hist */
+	u64			start;	/* position of the first entry */
+	u64			end;	/* position past the last entry */
+	size_t			clen;	/* compressed length of data */
+	unsigned char		data[0];
+};
+
+static bool logger_compress;
+static unsigned int logger_history_size = 512 * 1024;
+module_param_named(compress, logger_compress, bool, S_IRUGO | S_IWUSR);
+module_param_named(history_size, logger_history_size, uint,
+		   S_IRUGO | S_IWUSR);
+
+/* used by logger_hist_work() only, which the ordered workqueue serializes */
+static struct workqueue_struct *logger_hist_wq;
+static unsigned char *logger_hist_src;
+static unsigned char *logger_hist_dst;
+static void *logger_hist_wrkmem;
+
+/*
+ * Logs without a hist_cache never compress, whatever logger_compress says:
+ * it is only allocated once logger_hist_setup() has succeeded.
+ */
+static inline void logger_hist_kick(struct logger_log *log)
+{
+	if (logger_compress && log->hist_cache &&
+	    atomic64_read(&log->commit) - atomic64_read(&log->hist_pos) >=
+	    LOGGER_HIST_CHUNK)
+		queue_work(logger_hist_wq, &log->hist_work);
+}
+
+/*
+ * logger_hist_copy - copies whole committed entries starting at 'start'
+ * into logger_hist_src until at least LOGGER_HIST_CHUNK bytes are copied.
+ * Returns the position past the last entry copied, or 'start' if the
+ * writers lapped us while copying.
+ */
+static u64 logger_hist_copy(struct logger_log *log, u64 start, u64 commit)
+{
+	struct logger_entry *entry;
+	u64 end = start;
+
+	while (end - start < LOGGER_HIST_CHUNK) {
+		entry = (struct logger_entry *) (logger_hist_src + end - start);
+		logger_copy_from_ring(log, entry, end,
+				      sizeof(struct logger_entry));
+		if (entry->len > LOGGER_ENTRY_MAX_PAYLOAD ||
+		    end + sizeof(struct logger_entry) + entry->len > commit)
+			return start;
+		logger_copy_from_ring(log, entry->msg,
+				      end + sizeof(struct logger_entry),
+				      entry->len);
+		end += sizeof(struct logger_entry) + entry->len;
+	}
+
+	smp_rmb();
+	if (logger_lapped(log, start))
+		return start;
+
+	return end;
+}
+
+/*
+ * logger_hist_flush - drops the history and restarts it at 'pos'
  *
  * Caller must hold log->mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void logger_hist_flush(struct logger_log *log, u64 pos)
 {
-	struct logger_entry scratch;
+	struct logger_hist_block *block, *tmp;
+
+	list_for_each_entry_safe(block, tmp, &log->hist, list) {
+		list_del(&block->list);
+		kfree(block);
+	}
+	log->hist_bytes = 0;
+	log->hist_cached = NULL;
+	atomic64_set(&log->hist_pos, pos);
+}
+
+static void logger_hist_work(struct work_struct *work)
+{
+	struct logger_log *log = container_of(work, struct logger_log,
+					      hist_work);
+	struct logger_hist_block *block, *oldest;
+	u64 start, end, commit;
+	size_t clen;
+
+	while (logger_compress) {
+		start = atomic64_read(&log->hist_pos);
+		commit = atomic64_read(&log->commit);
+		if (commit - start < LOGGER_HIST_CHUNK)
+			break;
+		/* pairs with the smp_wmb() in logger_commit() */
+		smp_rmb();
+
+		end = logger_hist_copy(log, start, commit);
+		if (end == start) {
+			/* fell behind the writers; what they overwrote is lost */
+			atomic64_set(&log->hist_pos,
+				     atomic64_read(&log->head_pos));
+			continue;
+		}
+
+		if (lzo1x_1_compress(logger_hist_src, end - start,
+				     logger_hist_dst, &clen,
+				     logger_hist_wrkmem) != LZO_E_OK)
+			break;
+
+		block = kmalloc(sizeof(*block) + clen, GFP_KERNEL);
+		if (!block)
+			break;
+		block->start = start;
+		block->end = end;
+		block->clen = clen;
+		memcpy(block->data, logger_hist_dst, clen);
+
+		mutex_lock(&log->mutex);
+		/* raced with LOGGER_FLUSH_LOG */
+		if (atomic64_read(&log->hist_pos) != start) {
+			mutex_unlock(&log->mutex);
+			kfree(block);
+			continue;
+		}
+		list_add_tail(&block->list, &log->hist);
+		log->hist_bytes += clen;
+		while (log->hist_bytes > logger_history_size) {
+			oldest = list_first_entry(&log->hist,
+						  struct logger_hist_block, list);
+			if (oldest == block)
+				break;
+			if (log->hist_cached == oldest)
+				log->hist_cached = NULL;
+			list_del(&oldest->list);
+			log->hist_bytes -= oldest->clen;
+			kfree(oldest);
+		}
+		atomic64_set(&log->hist_pos, end);
+		mutex_unlock(&log->mutex);
+	}
+}
+
+/*
+ * logger_hist_fetch - copies the entry at reader->r_pos out of the
+ * compressed history into reader->r_buf, moving r_pos forward to the next
+ * entry still in the history if its own was evicted. Returns false if the
+ * history holds nothing at or after r_pos.
+ *
+ * Caller must hold log->mutex.
+ */
+static bool logger_hist_fetch(struct logger_log *log,
+			      struct logger_reader *reader)
+{
+	struct logger_hist_block *block;
 	struct logger_entry *entry;
 	size_t len;
-	size_t msg_start;
 
-	/*
-	 * First, copy the header to userspace, using the version of
-	 * the header requested
-	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
-		return -EFAULT;
+again:
+	list_for_each_entry(block, &log->hist, list)
+		if (block->end > reader->r_pos)
+			goto found;
+	return false;
+
+found:
+	if (reader->r_pos < block->start)
+		reader->r_pos = block->start;
+
+	if (log->hist_cached != block) {
+		len = LOGGER_HIST_BUF_SIZE;
+		if (lzo1x_decompress_safe(block->data, block->clen,
+					  log->hist_cache, &len) != LZO_E_OK ||
+		    len != block->end - block->start) {
+			/* should not happen; drop it rather than stall readers */
+			log->hist_cached = NULL;
+			list_del(&block->list);
+			log->hist_bytes -= block->clen;
+			kfree(block);
+			goto again;
+		}
+		log->hist_cached = block;
+	}
 
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(log,
-		reader->r_off + sizeof(struct logger_entry));
+	entry = (struct logger_entry *)
+		(log->hist_cache + (reader->r_pos - block->start));
+	memcpy(reader->r_buf, entry, sizeof(struct logger_entry) + entry->len);
+	return true;
+}
 
-	/*
-	 * We read from the msg in two disjoint operations. First, we read from
-	 * the current msg head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
-		return -EFAULT;
+/* logger_hist_start - the oldest position readers can still read from */
+static u64 logger_hist_start(struct logger_log *log)
+{
+	struct logger_hist_block *block;
+	u64 head = atomic64_read(&log->head_pos);
 
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+	if (list_empty(&log->hist))
+		return head;
+	block = list_first_entry(&log->hist, struct logger_hist_block, list);
+	return min(block->start, head);
+}
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
+static void logger_hist_init(struct logger_log *log)
+{
+	INIT_LIST_HEAD(&log->hist);
+	INIT_WORK(&log->hist_work, logger_hist_work);
+	if (logger_hist_wq)
+		log->hist_cache = vmalloc(LOGGER_HIST_BUF_SIZE);
+	if (!log->hist_cache && logger_hist_wq)
+		printk(KERN_ERR "logger: no memory for compressed history "
+		       "of log '%s'\n", log->misc.name);
+}
 
-	return count + get_user_hdr_len(reader->r_ver);
+static int __init logger_hist_setup(void)
+{
+	logger_hist_wq = alloc_ordered_workqueue("logger_hist", 0);
+	logger_hist_src = vmalloc(LOGGER_HIST_BUF_SIZE);
+	logger_hist_dst = vmalloc(lzo1x_worst_compress(LOGGER_HIST_BUF_SIZE));
+	logger_hist_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (logger_hist_wq && logger_hist_src && logger_hist_dst &&
+	    logger_hist_wrkmem)
+		return 0;
+
+	vfree(logger_hist_wrkmem);
+	vfree(logger_hist_dst);
+	vfree(logger_hist_src);
+	if (logger_hist_wq)
+		destroy_workqueue(logger_hist_wq);
+	logger_hist_wq = NULL;
+	logger_compress = false;
+	printk(KERN_ERR "logger: no memory for compressed history\n");
+	return -ENOMEM;
+}
+#else
+static inline void logger_hist_kick(struct logger_log *log)
+{
+}
+
+static inline void logger_hist_flush(struct logger_log *log, u64 pos)
+{
+}
+
+static inline bool logger_hist_fetch(struct logger_log *log,
+				     struct logger_reader *reader)
+{
+	return false;
+}
+
+static inline u64 logger_hist_start(struct logger_log *log)
+{
+	return atomic64_read(&log->head_pos);
 }
+#endif
 
 /*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
+ * logger_fetch_entry - copies the next entry at or after reader->r_pos that
+ * this reader may see into reader->r_buf. Padding left by failed writes,
+ * and other users' entries if the reader is not allowed to see them, are
+ * skipped. A lapped reader continues from the compressed history if there
+ * is one, or is moved to the oldest entry still in the ring.
+ *
+ * Returns true if an entry was copied, false if the reader has caught up.
+ * Caller must hold log->mutex.
  */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
+static bool logger_fetch_entry(struct logger_log *log,
+			       struct logger_reader *reader)
 {
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
-
-		entry = get_entry_header(log, off, &scratch);
+	struct logger_entry *entry = (struct logger_entry *) reader->r_buf;
+
+	while (reader->r_pos != atomic64_read(&log->commit)) {
+		/* pairs with the smp_wmb() in logger_commit() */
+		smp_rmb();
+		if (logger_lapped(log, reader->r_pos)) {
+			if (!logger_hist_fetch(log, reader)) {
+				reader->r_pos = atomic64_read(&log->head_pos);
+				continue;
+			}
+		} else {
+			logger_copy_from_ring(log, entry, reader->r_pos,
+					      sizeof(struct logger_entry));
+			if (entry->len <= LOGGER_ENTRY_MAX_PAYLOAD)
+				logger_copy_from_ring(log, entry->msg,
+					reader->r_pos +
+					sizeof(struct logger_entry),
+					entry->len);
+			smp_rmb();
+			if (logger_lapped(log, reader->r_pos))
+				continue;
+
+			/* not lapped, yet garbage: skip all written so far */
+			if (unlikely(entry->len > LOGGER_ENTRY_MAX_PAYLOAD)) {
+				reader->r_pos = atomic64_read(&log->commit);
+				break;
+			}
+		}
 
-		if (entry->euid == euid)
-			return off;
+		if (entry->hdr_size && (reader->r_all ||
+					entry->euid == current_euid()))
+			return true;
 
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(log, off + next_len);
+		reader->r_pos += sizeof(struct logger_entry) + entry->len;
 	}
 
-	return off;
+	return false;
+}
+
+/*
+ * do_read_log_to_user - reads the entry fetched into reader->r_buf into the
+ * user-space buffer 'buf', which holds exactly 'count' bytes. Returns
+ * 'count' on success.
+ *
+ * Caller must hold log->mutex.
+ */
+static ssize_t do_read_log_to_user(struct logger_reader *reader,
+				   char __user *buf,
+				   size_t count)
+{
+	struct logger_entry *entry = (struct logger_entry *) reader->r_buf;
+
+	/*
+	 * First, copy the header to userspace, using the version of
+	 * the header requested
+	 */
+	if (copy_header_to_user(reader->r_ver, entry, buf))
+		return -EFAULT;
+
+	count -= get_user_hdr_len(reader->r_ver);
+	buf += get_user_hdr_len(reader->r_ver);
+
+	if (copy_to_user(buf, entry->msg, count))
+		return -EFAULT;
+
+	reader->r_pos += sizeof(struct logger_entry) + count;
+
+	return count + get_user_hdr_len(reader->r_ver);
 }
 
 /*
@@ -260,6 +587,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry *entry = (struct logger_entry *) reader->r_buf;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -269,7 +597,7 @@ start:
 
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		ret = (log->w_off == reader->r_off);
+		ret = (atomic64_read(&log->commit) == reader->r_pos);
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -293,26 +621,21 @@ start:
 
 	mutex_lock(&log->mutex);
 
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(!logger_fetch_entry(log, reader))) {
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + entry->len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(reader, buf, ret);
 
 out:
 	mutex_unlock(&log->mutex);
@@ -321,136 +644,154 @@ out:
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_advance_head - moves head_pos past every entry that a reservation
+ * ending at 'end' is going to overwrite.
  *
- * Caller must hold log->mutex.
+ * The entries at head_pos are intact when we read their length: a writer
+ * about to overwrite one must first move head_pos past it, in which case
+ * our cmpxchg fails and we retry from the new head_pos.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void logger_advance_head(struct logger_log *log, u64 end)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(log, off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
+	u64 head, next, old;
+
+	head = atomic64_read(&log->head_pos);
+	while (end - head > log->size) {
+		next = head + sizeof(struct logger_entry) +
+			get_entry_msg_len(log, logger_offset(log, head));
+		old = atomic64_cmpxchg(&log->head_pos, head, next);
+		if (old == head) {
+			log->head = logger_offset(log, next);
+			head = next;
+		} else
+			head = old;
+	}
 }
 
 /*
- * is_between - is a < c < b, accounting for wrapping of a, b, and c
- *    positions in the buffer
- *
- * That is, if a<b, check for c between a and b
- * and if a>b, check for c outside (not between) a and b
- *
- * |------- a xxxxxxxx b --------|
- *               c^
+ * logger_reserve - claims 'len' bytes of 'log' for a new entry and returns
+ * the position of the first one.
  *
- * |xxxxx b --------- a xxxxxxxxx|
- *    c^
- *  or                    c^
+ * The caller must have preemption disabled until logger_commit().
  */
-static inline int is_between(size_t a, size_t b, size_t c)
+static u64 logger_reserve(struct logger_log *log, size_t len)
 {
-	if (a < b) {
-		/* is c between a and b? */
-		if (a < c && c <= b)
-			return 1;
-	} else {
-		/* is c outside of b through a? */
-		if (c <= b || a < c)
-			return 1;
-	}
+	u64 pos, old;
 
-	return 0;
+	pos = atomic64_read(&log->reserve);
+	while ((old = atomic64_cmpxchg(&log->reserve, pos, pos + len)) != pos)
+		pos = old;
+
+	logger_advance_head(log, pos + len);
+
+	return pos;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
+ * logger_commit - publishes the 'len' bytes reserved at 'pos' to readers.
+ * Entries are committed in reservation order. Every writer between
+ * logger_reserve() and here runs with preemption disabled, so waiting for
+ * an earlier one is short.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_commit(struct logger_log *log, u64 pos, size_t len)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(log, old + len);
-	struct logger_reader *reader;
+	while (atomic64_read(&log->commit) != pos)
+		cpu_relax();
 
-	if (is_between(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (is_between(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	/* make the entry visible before the new commit position */
+	smp_wmb();
+	atomic64_set(&log->commit, pos + len);
+	log->w_off = logger_offset(log, pos + len);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'pos'
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, u64 pos, const void *buf,
+			 size_t count)
 {
+	size_t off = logger_offset(log, pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
 }
 
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * the log 'log' at position 'pos'
  *
- * The caller needs to hold log->mutex.
+ * The caller must have page faults disabled and 'buf' faulted in.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, u64 pos,
 				      const void __user *buf, size_t count)
 {
+	size_t off = logger_offset(log, pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && __copy_from_user_inatomic(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			/*
-			 * Note that by not updating w_off, this abandons the
-			 * portion of the new entry that *was* successfully
-			 * copied, just above.  This is intentional to avoid
-			 * message corruption from missing fragments.
-			 */
+		if (__copy_from_user_inatomic(log->buffer, buf + len,
+					      count - len))
 			return -EFAULT;
 
-#ifdef CONFIG_SEC_DEBUG
-	memset(klog_buf, 0, 255);
-	if (strncmp(log->buffer + log->w_off, "!@", 2) == 0) {
-		if (count < 255)
-			memcpy(klog_buf, log->buffer + log->w_off, count);
-		else
-			memcpy(klog_buf, log->buffer + log->w_off, 255);
-		klog_buf[255] = 0;
+	return count;
+}
+
+/*
+ * logger_copy_bounce - copies the first 'count' bytes of the payload in 'iov'
+ * to a new kernel buffer, which the caller must kfree().
+ *
+ * This is the slow path, for when the payload was faulted in but reclaimed
+ * again before it could be copied with page faults disabled.
+ */
+static void *logger_copy_bounce(const struct iovec *iov,
+				unsigned long nr_segs, size_t count)
+{
+	size_t off = 0;
+	char *buf;
+
+	buf = kmalloc(count, GFP_KERNEL);
+	if (!buf)
+		return ERR_PTR(-ENOMEM);
+
+	for (; nr_segs > 0 && off < count; nr_segs--, iov++) {
+		size_t len = min_t(size_t, iov->iov_len, count - off);
+
+		if (copy_from_user(buf + off, iov->iov_base, len)) {
+			kfree(buf);
+			return ERR_PTR(-EFAULT);
+		}
+		off += len;
 	}
-#endif
-	log->w_off = logger_offset(log, log->w_off + count);
 
-	return count;
+	return buf;
+}
+
+#ifdef CONFIG_SEC_DEBUG
+/* copy a "!@" boot event just written at 'pos' into 'klog' for printk */
+static void logger_sec_debug_klog(struct logger_log *log, u64 pos,
+				  size_t count, char *klog, size_t klog_size)
+{
+	if (klog[0] || count < 2)
+		return;
+
+	logger_copy_from_ring(log, klog, pos, 2);
+	if (strncmp(klog, "!@", 2) == 0)
+		logger_copy_from_ring(log, klog, pos,
+				      min(count, klog_size - 1));
+	else
+		klog[0] = '\0';
 }
+#endif
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
@@ -461,10 +802,16 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	unsigned long seg;
+	size_t count;
+	char *bounce = NULL;
+	ssize_t ret;
+	u64 pos;
+#ifdef CONFIG_SEC_DEBUG
+	char klog_buf[256] = { 0 };
+#endif
 
 	now = current_kernel_time();
 
@@ -480,38 +827,90 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * The payload is copied in with page faults disabled, so fault it in
+	 * first. An entry never spans more than two pages of a segment.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	for (seg = 0, count = 0; seg < nr_segs && count < header.len; seg++) {
+		size_t len = min_t(size_t, iov[seg].iov_len,
+				   header.len - count);
+
+		if (!access_ok(VERIFY_READ, iov[seg].iov_base, len) ||
+		    fault_in_pages_readable(iov[seg].iov_base, len))
+			return -EFAULT;
+		count += len;
+	}
+
+retry:
+	preempt_disable();
+	pos = logger_reserve(log, sizeof(struct logger_entry) + header.len);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	do_write_log(log, pos, &header, sizeof(struct logger_entry));
 
-	while (nr_segs-- > 0) {
+	pagefault_disable();
+	for (seg = 0, ret = 0; seg < nr_segs; seg++) {
 		size_t len;
 		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		len = min_t(size_t, iov[seg].iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		if (bounce) {
+			do_write_log(log, pos + sizeof(struct logger_entry) + ret,
+				     bounce + ret, len);
+			nr = len;
+		} else {
+			nr = do_write_log_from_user(log,
+				pos + sizeof(struct logger_entry) + ret,
+				iov[seg].iov_base, len);
+		}
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			ret = nr;
+			break;
 		}
+#ifdef CONFIG_SEC_DEBUG
+		logger_sec_debug_klog(log,
+			pos + sizeof(struct logger_entry) + ret, nr,
+			klog_buf, sizeof(klog_buf));
+#endif
 
-		iov++;
 		ret += nr;
 	}
+	pagefault_enable();
 
-	mutex_unlock(&log->mutex);
+	/*
+	 * The space is already claimed, so a failed copy cannot simply be
+	 * abandoned. Mark the entry as padding instead; readers skip it.
+	 */
+	if (unlikely(ret < 0)) {
+		header.hdr_size = 0;
+		do_write_log(log, pos, &header, sizeof(struct logger_entry));
+	}
+
+	logger_commit(log, pos, sizeof(struct logger_entry) + header.len);
+	preempt_enable();
+
+	/*
+	 * The payload may have been reclaimed since it was faulted in. Copy
+	 * it through a bounce buffer, where faulting is allowed, and write
+	 * the entry again; a real fault shows up there.
+	 */
+	if (unlikely(ret == -EFAULT && !bounce)) {
+		bounce = logger_copy_bounce(iov, nr_segs, header.len);
+		if (!IS_ERR(bounce)) {
+			header.hdr_size = sizeof(struct logger_entry);
+			goto retry;
+		}
+		ret = PTR_ERR(bounce);
+		bounce = NULL;
+	}
+	kfree(bounce);
+
+	logger_hist_kick(log);
+
+	if (unlikely(ret < 0))
+		return ret;
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
@@ -559,7 +958,7 @@ static int logger_open(struct inode *inode, struct file *file)
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
+		reader->r_pos = logger_hist_start(log);
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -615,11 +1014,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	if (logger_fetch_entry(log, reader))
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -643,8 +1038,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_entry *entry;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
+	u64 commit, head;
 
 	mutex_lock(&log->mutex);
 
@@ -658,10 +1055,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		ret = min_t(u64, atomic64_read(&log->commit) - reader->r_pos,
+			    INT_MAX);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -669,14 +1064,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
+		entry = (struct logger_entry *) reader->r_buf;
 
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
-			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
+		if (logger_fetch_entry(log, reader))
+			ret = get_user_hdr_len(reader->r_ver) + entry->len;
 		else
 			ret = 0;
 		break;
@@ -685,9 +1076,15 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
+		commit = atomic64_read(&log->commit);
 		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+			reader->r_pos = commit;
+		head = atomic64_read(&log->head_pos);
+		while (head < commit &&
+		       atomic64_cmpxchg(&log->head_pos, head, commit) != head)
+			head = atomic64_read(&log->head_pos);
+		log->head = logger_offset(log, commit);
+		logger_hist_flush(log, commit);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -745,6 +1142,9 @@ static struct logger_log VAR = { \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.reserve = ATOMIC64_INIT(0), \
+	.commit = ATOMIC64_INIT(0), \
+	.head_pos = ATOMIC64_INIT(0), \
 };
 
 #ifdef CONFIG_SEC_LOGGER_BUFFER_EXPANSION
@@ -773,6 +1173,9 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	logger_hist_init(log);
+#endif
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -821,6 +1224,10 @@ static int __init logger_init(void)
 {
 	int ret;
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	logger_hist_setup();
+#endif
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
 		goto out;
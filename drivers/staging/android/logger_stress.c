@@ -0,0 +1,208 @@
+/*
+ * drivers/staging/android/logger_stress.c
+ *
+ * Stress test for the Android logger. Loading the module starts 'threads'
+ * kernel threads which each write 'iterations' entries with a 'size' byte
+ * message to the log device 'dev', then reports the aggregate write rate
+ * and the median, 99th percentile and worst write latency, e.g.
+ *
+ *	insmod logger_stress.ko threads=8 iterations=20000 size=100
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include "logger.h"
+
+static int threads = 4;
+static int iterations = 10000;
+static int size = 100;
+static char *dev = "/dev/log/main";
+
+module_param(threads, int, S_IRUGO);
+module_param(iterations, int, S_IRUGO);
+module_param(size, int, S_IRUGO);
+module_param(dev, charp, S_IRUGO);
+
+#define LOGGER_STRESS_MAX_SAMPLES	(1024 * 1024)
+#define LOGGER_STRESS_TAG		"logger_stress"
+
+struct logger_stress_thread {
+	struct file		*filp;
+	u32			*lat;	/* per write latency in ns */
+	int			nr;	/* writes done */
+	int			err;
+	struct completion	done;
+};
+
+static DECLARE_COMPLETION(logger_stress_start);
+
+static int logger_stress_fn(void *data)
+{
+	struct logger_stress_thread *t = data;
+	size_t tag_len = sizeof(LOGGER_STRESS_TAG);
+	size_t len = 1 + tag_len + size;
+	mm_segment_t old_fs;
+	ktime_t start;
+	char *buf;
+	int i;
+
+	buf = kmalloc(len, GFP_KERNEL);
+	if (!buf) {
+		t->err = -ENOMEM;
+		goto out;
+	}
+	/* priority, tag and message, as liblog lays them out */
+	buf[0] = 4;
+	memcpy(buf + 1, LOGGER_STRESS_TAG, tag_len);
+	memset(buf + 1 + tag_len, 'x', size - 1);
+	buf[len - 1] = '\0';
+
+	wait_for_completion(&logger_stress_start);
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	for (i = 0; i < iterations; i++) {
+		loff_t pos = 0;
+		ssize_t ret;
+
+		start = ktime_get();
+		ret = vfs_write(t->filp, (const char __user *) buf, len, &pos);
+		t->lat[i] = min_t(s64, ktime_to_ns(ktime_sub(ktime_get(),
+							       start)), UINT_MAX);
+		if (ret < 0) {
+			t->err = ret;
+			break;
+		}
+		t->nr++;
+	}
+	set_fs(old_fs);
+	kfree(buf);
+out:
+	complete(&t->done);
+	return 0;
+}
+
+static int logger_stress_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void logger_stress_report(struct logger_stress_thread *t, s64 elapsed)
+{
+	u32 *all;
+	u64 rate;
+	int i, n = 0;
+
+	for (i = 0; i < threads; i++)
+		n += t[i].nr;
+	if (!n || elapsed <= 0)
+		return;
+
+	all = vmalloc(n * sizeof(u32));
+	if (!all)
+		return;
+	for (n = 0, i = 0; i < threads; i++) {
+		memcpy(all + n, t[i].lat, t[i].nr * sizeof(u32));
+		n += t[i].nr;
+	}
+	sort(all, n, sizeof(u32), logger_stress_cmp, NULL);
+
+	rate = div64_u64((u64) n * NSEC_PER_SEC, elapsed);
+	pr_info("logger_stress: %d threads, %d writes of %d bytes to %s\n",
+		threads, n, size, dev);
+	pr_info("logger_stress: %llu writes/sec, latency p50 %u ns, "
+		"p99 %u ns, max %u ns\n", rate, all[n / 2],
+		all[(int) div_u64((u64) n * 99, 100)], all[n - 1]);
+	vfree(all);
+}
+
+static int __init logger_stress_init(void)
+{
+	struct logger_stress_thread *t;
+	struct task_struct *task;
+	ktime_t start;
+	int i, ret = 0;
+
+	if (threads <= 0 || iterations <= 0 || size <= 0 ||
+	    size > LOGGER_ENTRY_MAX_PAYLOAD - 1 - sizeof(LOGGER_STRESS_TAG) ||
+	    (u64) threads * iterations > LOGGER_STRESS_MAX_SAMPLES)
+		return -EINVAL;
+
+	t = kcalloc(threads, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	for (i = 0; i < threads; i++) {
+		init_completion(&t[i].done);
+		t[i].lat = vmalloc(iterations * sizeof(u32));
+		if (!t[i].lat) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		t[i].filp = filp_open(dev, O_WRONLY, 0);
+		if (IS_ERR(t[i].filp)) {
+			ret = PTR_ERR(t[i].filp);
+			t[i].filp = NULL;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		task = kthread_run(logger_stress_fn, &t[i], "logger_stress/%d",
+				   i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			t[i].err = ret;
+			complete(&t[i].done);
+		}
+	}
+
+	start = ktime_get();
+	complete_all(&logger_stress_start);
+	for (i = 0; i < threads; i++) {
+		wait_for_completion(&t[i].done);
+		if (t[i].err)
+			pr_err("logger_stress: thread %d failed: %d\n", i,
+			       t[i].err);
+	}
+	logger_stress_report(t, ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+out:
+	for (i = 0; i < threads; i++) {
+		if (t[i].filp)
+			filp_close(t[i].filp, NULL);
+		vfree(t[i].lat);
+	}
+	kfree(t);
+	return ret;
+}
+
+static void __exit logger_stress_exit(void)
+{
+}
+
+module_init(logger_stress_init);
+module_exit(logger_stress_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Android logger stress test");
@@ -17,6 +17,12 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Reclaim only checks the thresholds; victims are selected and killed by
+ * the "lowmemorykiller" kernel thread, which waits for each victim to free
+ * its memory (at most victim_timeout_ms) before deciding whether to kill
+ * again. Kills per minfree level are in kill_count, and latency histograms
+ * in kill_latency and exit_latency.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -40,9 +46,16 @@
 #include <linux/mutex.h>
 #include <linux/delay.h>
 #include <linux/swap.h>
+#include <linux/rculist.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
 
 #include <linux/ratelimit.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/lowmemorykiller.h>
+
 #define LMK_COUNT_READ
 
 #ifdef CONFIG_ZSWAP
@@ -89,7 +102,33 @@ static int lowmem_minfree[6] = {
 static int lowmem_minfree_size = 4;
 static int lmk_fast_run = 1;
 
-static unsigned long lowmem_deathpending_timeout;
+/*
+ * Pressure reported by lowmem_shrink() and consumed by lowmem_kthread();
+ * lowmem_pending_start is when reclaim first reported it.
+ */
+static DEFINE_SPINLOCK(lowmem_pending_lock);
+static int lowmem_pending;
+static ktime_t lowmem_pending_start;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_wait);
+static struct task_struct *lowmem_task;
+
+/* Last victim, cleared by lmk_mm_released() once its mm is freed */
+static pid_t lowmem_victim_tgid;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_victim_wait);
+static unsigned int lowmem_victim_timeout_ms = 1000;
+
+/*
+ * Statistics, written only by lowmem_kthread(). Latency histogram bucket
+ * i counts events that took less than 2^i ms; the last bucket takes the
+ * rest. kill_latency is from reclaim reporting pressure to SIGKILL,
+ * exit_latency from SIGKILL to the victim's mm being released.
+ */
+#define LOWMEM_LATENCY_BUCKETS	12
+static uint32_t lowmem_kill_count[ARRAY_SIZE(lowmem_adj)];
+static uint32_t lowmem_kill_latency[LOWMEM_LATENCY_BUCKETS];
+static uint32_t lowmem_exit_latency[LOWMEM_LATENCY_BUCKETS];
+static uint32_t lowmem_exit_timeouts;
+static unsigned long lowmem_freed_pages;
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -147,7 +186,79 @@ static int test_task_flag(struct task_struct *p, int flag)
 	return 0;
 }
 
-static DEFINE_MUTEX(scan_mutex);
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+/*
+ * Thread group leaders bucketed by oom_score_adj. Writers serialize on
+ * lmk_adj_index_lock; lowmem_kill_one() walks the buckets under
+ * rcu_read_lock() only, so it never nests task_lock() inside the index
+ * lock (oom_score_adj writers take them in the opposite order). A task
+ * moved between buckets during a walk can be missed for that pass.
+ */
+#define LMK_ADJ_BUCKET_SHIFT	6
+#define LMK_ADJ_BUCKETS \
+	(((OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN) >> LMK_ADJ_BUCKET_SHIFT) + 1)
+
+static struct hlist_head lmk_adj_buckets[LMK_ADJ_BUCKETS];
+static DEFINE_SPINLOCK(lmk_adj_index_lock);
+
+static inline int lmk_adj_bucket(int oom_score_adj)
+{
+	return (oom_score_adj - OOM_SCORE_ADJ_MIN) >> LMK_ADJ_BUCKET_SHIFT;
+}
+
+static void __lmk_adj_index_add(struct task_struct *p)
+{
+	p->lmk_adj_bucket = lmk_adj_bucket(p->signal->oom_score_adj);
+	hlist_add_head_rcu(&p->lmk_adj_node,
+			   &lmk_adj_buckets[p->lmk_adj_bucket]);
+}
+
+void lmk_adj_index_add(struct task_struct *p)
+{
+	unsigned long flags;
+
+	if (p->flags & PF_KTHREAD)
+		return;
+	spin_lock_irqsave(&lmk_adj_index_lock, flags);
+	__lmk_adj_index_add(p);
+	spin_unlock_irqrestore(&lmk_adj_index_lock, flags);
+}
+
+void lmk_adj_index_del(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_adj_index_lock, flags);
+	hlist_del_init_rcu(&p->lmk_adj_node);
+	spin_unlock_irqrestore(&lmk_adj_index_lock, flags);
+}
+
+void lmk_adj_index_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_adj_index_lock, flags);
+	if (!hlist_unhashed(&old->lmk_adj_node)) {
+		hlist_del_init_rcu(&old->lmk_adj_node);
+		__lmk_adj_index_add(new);
+	}
+	spin_unlock_irqrestore(&lmk_adj_index_lock, flags);
+}
+
+void lmk_adj_index_update(struct task_struct *p)
+{
+	unsigned long flags;
+
+	p = p->group_leader;
+	spin_lock_irqsave(&lmk_adj_index_lock, flags);
+	if (!hlist_unhashed(&p->lmk_adj_node) &&
+	    p->lmk_adj_bucket != lmk_adj_bucket(p->signal->oom_score_adj)) {
+		hlist_del_init_rcu(&p->lmk_adj_node);
+		__lmk_adj_index_add(p);
+	}
+	spin_unlock_irqrestore(&lmk_adj_index_lock, flags);
+}
+#endif
 
 #if 0
 int can_use_cma_pages(gfp_t gfp_mask)
@@ -286,92 +397,117 @@ void tune_lmk_param(int *other_free, int *other_file, struct shrink_control *sc)
 }
 #endif
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+/*
+ * Return the minimum oom_score_adj to kill at for the current free and
+ * file page counts, or OOM_SCORE_ADJ_MAX + 1 if every watermark is met.
+ * *level is set to the index of the minfree watermark that was crossed.
+ */
+static int lowmem_min_score_adj(int *level, int *other_free, int *other_file)
 {
-	struct task_struct *tsk;
-	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
-	int i;
-	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_score_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
-	int other_free;
-	int other_file;
-	unsigned long nr_to_scan = sc->nr_to_scan;
-#ifdef CONFIG_SEC_DEBUG_LMK_MEMINFO
-	static DEFINE_RATELIMIT_STATE(lmk_rs, DEFAULT_RATELIMIT_INTERVAL, 1);
-#endif
-	if (nr_to_scan > 0) {
-		if (mutex_lock_interruptible(&scan_mutex) < 0)
-			return 0;
-	}
+	int i;
 
-	other_free = global_page_state(NR_FREE_PAGES);
-	other_file = global_page_state(NR_FILE_PAGES) -
+	*other_free = global_page_state(NR_FREE_PAGES);
+	*other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
 #ifdef CONFIG_ZSWAP
-	other_file -= total_swapcache_pages;
-#endif
-	/* we are not using lmk tune */
-#if 0
-	tune_lmk_param(&other_free, &other_file, sc);
+	*other_file -= total_swapcache_pages;
 #endif
 
-
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_score_adj = lowmem_adj[i];
-			break;
+		if (*other_free < lowmem_minfree[i] &&
+		    *other_file < lowmem_minfree[i]) {
+			*level = i;
+			return lowmem_adj[i];
 		}
 	}
-	if (nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
-				nr_to_scan, sc->gfp_mask, other_free,
-				other_file, min_score_adj);
-	rem = global_page_state(NR_ACTIVE_ANON) +
-		global_page_state(NR_ACTIVE_FILE) +
-		global_page_state(NR_INACTIVE_ANON) +
-		global_page_state(NR_INACTIVE_FILE);
-	if (nr_to_scan <= 0 || min_score_adj == OOM_SCORE_ADJ_MAX + 1) {
-		lowmem_print(5, "lowmem_shrink %lu, %x, return %d\n",
-			     nr_to_scan, sc->gfp_mask, rem);
+	return OOM_SCORE_ADJ_MAX + 1;
+}
+
+static void lowmem_latency_add(uint32_t *hist, ktime_t delta)
+{
+	s64 ms = ktime_to_ms(delta);
+	int i = 0;
 
-		if (nr_to_scan > 0)
-			mutex_unlock(&scan_mutex);
+	while (i < LOWMEM_LATENCY_BUCKETS - 1 && ms >= (1LL << i))
+		i++;
+	hist[i]++;
+}
 
-		return rem;
+void lmk_mm_released(struct task_struct *tsk)
+{
+	if (tsk->tgid == ACCESS_ONCE(lowmem_victim_tgid)) {
+		lowmem_victim_tgid = 0;
+		wake_up(&lowmem_victim_wait);
 	}
+}
+
+/*
+ * Select and kill one task if memory is still below a watermark, then wait
+ * for the victim to release its mm. Returns 1 if a task was killed.
+ */
+static int lowmem_kill_one(ktime_t pressure_start)
+{
+	struct task_struct *tsk;
+	struct task_struct *selected = NULL;
+	int tasksize;
+	int level = 0;
+	int min_score_adj;
+	int selected_tasksize = 0;
+	int selected_oom_score_adj;
+	int other_free;
+	int other_file;
+	int nr_scanned = 0;
+	ktime_t scan_start, kill_time;
+	long free_before, freed, released;
+	pid_t victim_pid;
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+	struct hlist_node *pos;
+	int bucket;
+#endif
+#ifdef CONFIG_SEC_DEBUG_LMK_MEMINFO
+	static DEFINE_RATELIMIT_STATE(lmk_rs, DEFAULT_RATELIMIT_INTERVAL, 1);
+#endif
+
+	min_score_adj = lowmem_min_score_adj(&level, &other_free, &other_file);
+	if (min_score_adj == OOM_SCORE_ADJ_MAX + 1)
+		return 0;
 	selected_oom_score_adj = min_score_adj;
 
+	scan_start = ktime_get();
 	rcu_read_lock();
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+	/*
+	 * Every task in a bucket has a higher oom_score_adj than any task in
+	 * the buckets below it, so stop at the first bucket with a victim.
+	 */
+	for (bucket = LMK_ADJ_BUCKETS - 1;
+	     bucket >= lmk_adj_bucket(min_score_adj) && !selected; bucket--)
+	hlist_for_each_entry_rcu(tsk, pos, &lmk_adj_buckets[bucket],
+				 lmk_adj_node) {
+#else
 	for_each_process(tsk) {
+#endif
 		struct task_struct *p;
 		int oom_score_adj;
 
 		if (tsk->flags & PF_KTHREAD)
 			continue;
 
+		nr_scanned++;
+
 		/* if task no longer has any memory ignore it */
 		if (test_task_flag(tsk, TIF_MM_RELEASED))
 			continue;
 
-		if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			if (test_task_flag(tsk, TIF_MEMDIE)) {
-				rcu_read_unlock();
-				/* give the system time to free up the memory */
-				msleep_interruptible(20);
-				mutex_unlock(&scan_mutex);
-				return 0;
-			}
-		}
+		/* an earlier victim that outlived lowmem_victim_timeout_ms */
+		if (test_task_flag(tsk, TIF_MEMDIE))
+			continue;
 
 		p = find_lock_task_mm(tsk);
 		if (!p)
@@ -400,38 +536,125 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
 			     p->pid, p->comm, oom_score_adj, tasksize);
 	}
-	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d(ofree %d %d, ma %d)\n",
-			selected->pid, selected->comm,
-			selected_oom_score_adj, selected_tasksize,
-			other_free, other_file, min_score_adj);
-		lowmem_deathpending_timeout = jiffies + HZ;
-		send_sig(SIGKILL, selected, 0);
-		set_tsk_thread_flag(selected, TIF_MEMDIE);
-		rem -= selected_tasksize;
+	trace_lowmemory_select(selected, selected_oom_score_adj,
+			       selected_tasksize, min_score_adj, nr_scanned,
+			       ktime_to_ns(ktime_sub(ktime_get(), scan_start)));
+	if (!selected) {
 		rcu_read_unlock();
+		return 0;
+	}
+
+	lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d(ofree %d %d, ma %d)\n",
+		selected->pid, selected->comm,
+		selected_oom_score_adj, selected_tasksize,
+		other_free, other_file, min_score_adj);
+	victim_pid = selected->pid;
+	lowmem_victim_tgid = selected->tgid;
+	send_sig(SIGKILL, selected, 0);
+	set_tsk_thread_flag(selected, TIF_MEMDIE);
+	rcu_read_unlock();
+
+	kill_time = ktime_get();
+	free_before = global_page_state(NR_FREE_PAGES);
+	lowmem_kill_count[level]++;
+	lowmem_latency_add(lowmem_kill_latency,
+			   ktime_sub(kill_time, pressure_start));
 #ifdef LMK_COUNT_READ
-		lmk_count++;
+	lmk_count++;
 #endif
 #ifdef CONFIG_SEC_DEBUG_LMK_MEMINFO
-		if (__ratelimit(&lmk_rs)) {
-			lowmem_print(1, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
-					nr_to_scan, sc->gfp_mask, other_free,
-					other_file, min_score_adj);
-			show_mem(SHOW_MEM_FILTER_NODES);
+	if (__ratelimit(&lmk_rs)) {
+		lowmem_print(1, "lowmem_kill ofree %d %d, ma %d\n",
+				other_free, other_file, min_score_adj);
+		show_mem(SHOW_MEM_FILTER_NODES);
 #ifdef CONFIG_SEC_DEBUG_LMK_MEMINFO_VERBOSE
-			dump_tasks_info();
+		dump_tasks_info();
 #endif
-		}
+	}
 #endif
-		/* give the system time to free up the memory */
-		msleep_interruptible(20);
-	} else
-		rcu_read_unlock();
 
-	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
-		     nr_to_scan, sc->gfp_mask, rem);
-	mutex_unlock(&scan_mutex);
+	released = wait_event_timeout(lowmem_victim_wait,
+			!ACCESS_ONCE(lowmem_victim_tgid),
+			msecs_to_jiffies(lowmem_victim_timeout_ms));
+	lowmem_victim_tgid = 0;
+	if (!released) {
+		lowmem_exit_timeouts++;
+		lowmem_print(2, "victim %d did not release its memory in %u ms\n",
+			     victim_pid, lowmem_victim_timeout_ms);
+		return 1;
+	}
+	lowmem_latency_add(lowmem_exit_latency,
+			   ktime_sub(ktime_get(), kill_time));
+	freed = global_page_state(NR_FREE_PAGES) - free_before;
+	if (freed > 0)
+		lowmem_freed_pages += freed;
+	return 1;
+}
+
+static int lowmem_kthread(void *unused)
+{
+	struct sched_param param = { .sched_priority = 1 };
+	ktime_t pressure_start;
+
+	sched_setscheduler(current, SCHED_FIFO, &param);
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(lowmem_wait,
+				lowmem_pending || kthread_should_stop());
+
+		spin_lock(&lowmem_pending_lock);
+		pressure_start = lowmem_pending_start;
+		lowmem_pending = 0;
+		spin_unlock(&lowmem_pending_lock);
+
+		/*
+		 * Keep going while each victim frees its memory and a
+		 * watermark is still crossed, rather than waiting for
+		 * reclaim to report pressure again.
+		 */
+		while (!kthread_should_stop() &&
+		       lowmem_kill_one(pressure_start))
+			pressure_start = ktime_get();
+	}
+	return 0;
+}
+
+/*
+ * Called from reclaim. Only compares the free and file page counts against
+ * the minfree watermarks and wakes lowmem_kthread(); direct reclaimers no
+ * longer scan tasks or sleep here.
+ */
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	int rem;
+	int level = 0;
+	int min_score_adj;
+	int other_free;
+	int other_file;
+	unsigned long nr_to_scan = sc->nr_to_scan;
+
+	rem = global_page_state(NR_ACTIVE_ANON) +
+		global_page_state(NR_ACTIVE_FILE) +
+		global_page_state(NR_INACTIVE_ANON) +
+		global_page_state(NR_INACTIVE_FILE);
+	if (nr_to_scan <= 0)
+		return rem;
+
+	min_score_adj = lowmem_min_score_adj(&level, &other_free, &other_file);
+	lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
+			nr_to_scan, sc->gfp_mask, other_free,
+			other_file, min_score_adj);
+	if (min_score_adj == OOM_SCORE_ADJ_MAX + 1)
+		return rem;
+
+	spin_lock(&lowmem_pending_lock);
+	if (!lowmem_pending) {
+		lowmem_pending = 1;
+		lowmem_pending_start = ktime_get();
+	}
+	spin_unlock(&lowmem_pending_lock);
+	wake_up(&lowmem_wait);
+
 	return rem;
 }
 
@@ -626,6 +849,9 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	lowmem_task = kthread_run(lowmem_kthread, NULL, "lowmemorykiller");
+	if (IS_ERR(lowmem_task))
+		return PTR_ERR(lowmem_task);
 	register_shrinker(&lowmem_shrinker);
 #ifdef CONFIG_SEC_OOM_KILLER
 	register_oom_notifier(&android_oom_notifier);
@@ -637,6 +863,7 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	kthread_stop(lowmem_task);
 }
 
 #ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_AUTODETECT_OOM_ADJ_VALUES
@@ -734,6 +961,15 @@ module_param_named(lmk_fast_run, lmk_fast_run, int, S_IRUGO | S_IWUSR);
 #ifdef LMK_COUNT_READ
 module_param_named(lmkcount, lmk_count, uint, S_IRUGO);
 #endif
+module_param_named(victim_timeout_ms, lowmem_victim_timeout_ms, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_array_named(kill_count, lowmem_kill_count, uint, NULL, S_IRUGO);
+module_param_array_named(kill_latency, lowmem_kill_latency, uint, NULL,
+			 S_IRUGO);
+module_param_array_named(exit_latency, lowmem_exit_latency, uint, NULL,
+			 S_IRUGO);
+module_param_named(exit_timeouts, lowmem_exit_timeouts, uint, S_IRUGO);
+module_param_named(freed_pages, lowmem_freed_pages, ulong, S_IRUGO);
 
 #ifdef OOM_COUNT_READ
 module_param_named(oomcount, oom_count, uint, S_IRUGO);
@@ -12,6 +12,29 @@
 #include "sdcardfs.h"
 #include "linux/ctype.h"
 
+/*
+ * Returns 1 if the lower dentry has been neither unhashed nor moved since
+ * it was last found valid: d_seq is bumped by both __d_drop() and d_move(),
+ * so its parent and name are still the ones we checked.  Safe in rcu-walk,
+ * the private data and the lower dentry are both freed by rcu.
+ */
+static int sdcardfs_lower_unchanged(struct dentry *dentry)
+{
+	struct sdcardfs_dentry_info *info = ACCESS_ONCE(dentry->d_fsdata);
+	struct dentry *lower_dentry;
+	int ret;
+
+	if (!info)
+		return 0;
+
+	spin_lock(&info->lock);
+	lower_dentry = info->lower_path.dentry;
+	ret = lower_dentry && !d_unhashed(lower_dentry) &&
+	      !read_seqcount_retry(&lower_dentry->d_seq, info->lower_seq);
+	spin_unlock(&info->lock);
+	return ret;
+}
+
 /*
  * returns: -ERRNO if error (returned to user)
  *          0: tell VFS to invalidate dentry
@@ -24,23 +47,24 @@ static int sdcardfs_d_revalidate(struct dentry *dentry, struct nameidata *nd)
 	struct dentry *parent_lower_dentry = NULL;
 	struct dentry *lower_cur_parent_dentry = NULL;
 	struct dentry *lower_dentry = NULL;
+	unsigned seq;
 	int err = 1;
 
-	if (nd && nd->flags & LOOKUP_RCU)
-		return -ECHILD;
+	if (IS_ROOT(dentry))
+		return 1;
 
-	spin_lock(&dentry->d_lock);
-	if (IS_ROOT(dentry)) {
-		spin_unlock(&dentry->d_lock);
+	if (sdcardfs_lower_unchanged(dentry))
 		return 1;
-	}
-	spin_unlock(&dentry->d_lock);
+
+	if (nd && nd->flags & LOOKUP_RCU)
+		return -ECHILD;
 
 	parent_dentry = dget_parent(dentry);
 	sdcardfs_get_lower_path(parent_dentry, &parent_lower_path);
 	sdcardfs_get_lower_path(dentry, &lower_path);
 	parent_lower_dentry = parent_lower_path.dentry;
 	lower_dentry = lower_path.dentry;
+	seq = read_seqcount_begin(&lower_dentry->d_seq);
 	lower_cur_parent_dentry = dget_parent(lower_dentry);
 
 	spin_lock(&lower_dentry->d_lock);
@@ -83,6 +107,14 @@ static int sdcardfs_d_revalidate(struct dentry *dentry, struct nameidata *nd)
 		spin_unlock(&lower_dentry->d_lock);
 	}
 
+	/* remember what we checked, so the next lookups can skip it */
+	if (err == 1) {
+		spin_lock(&SDCARDFS_D(dentry)->lock);
+		if (SDCARDFS_D(dentry)->lower_path.dentry == lower_dentry)
+			SDCARDFS_D(dentry)->lower_seq = seq;
+		spin_unlock(&SDCARDFS_D(dentry)->lock);
+	}
+
 out:
 	dput(parent_dentry);
 	dput(lower_cur_parent_dentry);
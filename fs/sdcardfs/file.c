@@ -230,10 +230,8 @@ static int sdcardfs_open(struct inode *inode, struct file *file)
 
 	if (err)
 		kfree(SDCARDFS_F(file));
-	else {
-		fsstack_copy_attr_all(inode, sdcardfs_lower_inode(inode));
-		fix_fat_permission(inode); 
-	}
+	else
+		sdcardfs_update_attr(inode);
 out_err:
 	return err;
 }
@@ -39,6 +39,51 @@ void revert_fsids(const struct cred * old_cred)
 	put_cred(cur_cred); 
 }
 
+/*
+ * Copy the attributes of the lower inode, deriving the FAT emulated owner
+ * and mode on the way so that nobody sees the lower ones in between.
+ */
+void sdcardfs_copy_attr(struct inode *inode, const struct inode *lower_inode)
+{
+	umode_t mode = lower_inode->i_mode;
+
+	fix_mode(mode);
+	inode->i_mode = mode;
+	inode->i_uid = AID_ROOT;
+	inode->i_gid = AID_SDCARD_RW;
+	inode->i_rdev = lower_inode->i_rdev;
+	inode->i_atime = lower_inode->i_atime;
+	inode->i_mtime = lower_inode->i_mtime;
+	inode->i_ctime = lower_inode->i_ctime;
+	inode->i_blkbits = lower_inode->i_blkbits;
+	inode->i_flags = lower_inode->i_flags;
+	set_nlink(inode, lower_inode->i_nlink);
+}
+
+/*
+ * Refresh the attributes of @inode from its lower inode, if anything the
+ * copy would change has changed there.  The derived owner and mode only
+ * depend on the file type, which cannot change, so the check only needs
+ * to cover what is copied verbatim.  This keeps stat() and lookup() of
+ * unchanged files from writing to the shared inode.
+ */
+void sdcardfs_update_attr(struct inode *inode)
+{
+	struct inode *lower_inode = sdcardfs_lower_inode(inode);
+
+	if (timespec_equal(&inode->i_mtime, &lower_inode->i_mtime) &&
+	    timespec_equal(&inode->i_ctime, &lower_inode->i_ctime) &&
+	    timespec_equal(&inode->i_atime, &lower_inode->i_atime) &&
+	    inode->i_nlink == lower_inode->i_nlink &&
+	    inode->i_flags == lower_inode->i_flags &&
+	    inode->i_blocks == lower_inode->i_blocks &&
+	    i_size_read(inode) == i_size_read(lower_inode))
+		return;
+
+	sdcardfs_copy_attr(inode, lower_inode);
+	fsstack_copy_inode_size(inode, lower_inode);
+}
+
 static int sdcardfs_create(struct inode *dir, struct dentry *dentry,
 			 umode_t mode, struct nameidata *nd)
 {
@@ -389,13 +434,11 @@ static int sdcardfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 		goto out_err;
 
 	/* Copy attrs from lower dir, but i_uid/i_gid */
-	fsstack_copy_attr_all(new_dir, lower_new_dir_dentry->d_inode);
+	sdcardfs_copy_attr(new_dir, lower_new_dir_dentry->d_inode);
 	fsstack_copy_inode_size(new_dir, lower_new_dir_dentry->d_inode);
-	fix_fat_permission(new_dir); 
 	if (new_dir != old_dir) {
-		fsstack_copy_attr_all(old_dir, lower_old_dir_dentry->d_inode);
+		sdcardfs_copy_attr(old_dir, lower_old_dir_dentry->d_inode);
 		fsstack_copy_inode_size(old_dir, lower_old_dir_dentry->d_inode);
-		fix_fat_permission(old_dir); 
 	}
 
 out_err:
@@ -523,22 +566,10 @@ static int sdcardfs_permission(struct inode *inode, int mask)
 static int sdcardfs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 		 struct kstat *stat)
 {
-	struct dentry *lower_dentry;
-	struct inode *inode;
-	struct inode *lower_inode;
-	struct path lower_path;
-
-	inode = dentry->d_inode;
-
-	sdcardfs_get_lower_path(dentry, &lower_path);
-	lower_dentry = lower_path.dentry;
-	lower_inode = sdcardfs_lower_inode(inode);
-
-	fsstack_copy_attr_all(inode, lower_inode);
-	fix_fat_permission(inode); 
+	struct inode *inode = dentry->d_inode;
 
+	sdcardfs_update_attr(inode);
 	generic_fillattr(inode, stat);
-	sdcardfs_put_lower_path(dentry, &lower_path);
 	return 0;
 }
 
@@ -621,9 +652,8 @@ static int sdcardfs_setattr(struct dentry *dentry, struct iattr *ia)
 		goto out;
 
 	/* get attributes from the lower inode */
-	fsstack_copy_attr_all(inode, lower_inode);
-	fix_fat_permission(inode); 
-	
+	sdcardfs_copy_attr(inode, lower_inode);
+
 	/*
 	 * Not running fsstack_copy_inode_size(inode, lower_inode), because
 	 * VFS should update our inode size, and notify_change on
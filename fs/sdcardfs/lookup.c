@@ -27,16 +27,33 @@ int sdcardfs_init_dentry_cache(void)
 
 void sdcardfs_destroy_dentry_cache(void)
 {
+	/* wait for the private data still queued for freeing */
+	rcu_barrier();
 	if (sdcardfs_dentry_cachep)
 		kmem_cache_destroy(sdcardfs_dentry_cachep);
 }
 
+static void sdcardfs_free_dentry_info(struct rcu_head *head)
+{
+	struct sdcardfs_dentry_info *info =
+		container_of(head, struct sdcardfs_dentry_info, rcu);
+
+	kmem_cache_free(sdcardfs_dentry_cachep, info);
+}
+
+/*
+ * The private data outlives the dentry by a grace period, as an rcu-walk
+ * d_revalidate may still be looking at it.
+ */
 void free_dentry_private_data(struct dentry *dentry)
 {
+	struct sdcardfs_dentry_info *info;
+
 	if (!dentry || !dentry->d_fsdata)
 		return;
-	kmem_cache_free(sdcardfs_dentry_cachep, dentry->d_fsdata);
+	info = dentry->d_fsdata;
 	dentry->d_fsdata = NULL;
+	call_rcu(&info->rcu, sdcardfs_free_dentry_info);
 }
 
 /* allocate new dentry private data */
@@ -141,11 +158,9 @@ static struct inode *sdcardfs_iget(struct super_block *sb,
 				   lower_inode->i_rdev);
 
 	/* all well, copy inode attributes */
-	fsstack_copy_attr_all(inode, lower_inode);
+	sdcardfs_copy_attr(inode, lower_inode);
 	fsstack_copy_inode_size(inode, lower_inode);
 
-	fix_fat_permission(inode);
-
 	unlock_new_inode(inode);
 	return inode;
 }
@@ -321,8 +336,7 @@ struct dentry *sdcardfs_lookup(struct inode *dir, struct dentry *dentry,
 	if (ret) 
 		dentry = ret;
 	if (dentry->d_inode)
-		fsstack_copy_attr_times(dentry->d_inode,
-					sdcardfs_lower_inode(dentry->d_inode));
+		sdcardfs_update_attr(dentry->d_inode);
 	/* update parent directory's atime */
 	fsstack_copy_attr_atime(parent->d_inode,
 				sdcardfs_lower_inode(parent->d_inode));
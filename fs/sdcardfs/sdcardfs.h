@@ -125,6 +125,9 @@ extern struct dentry *sdcardfs_lookup(struct inode *dir, struct dentry *dentry,
 				    struct nameidata *nd);
 extern int sdcardfs_interpose(struct dentry *dentry, struct super_block *sb,
 			    struct path *lower_path);
+extern void sdcardfs_copy_attr(struct inode *inode,
+			       const struct inode *lower_inode);
+extern void sdcardfs_update_attr(struct inode *inode);
 
 /* file private data */
 struct sdcardfs_file_info {
@@ -140,8 +143,10 @@ struct sdcardfs_inode_info {
 
 /* sdcardfs dentry data in memory */
 struct sdcardfs_dentry_info {
-	spinlock_t lock;	/* protects lower_path */
+	spinlock_t lock;	/* protects lower_path and lower_seq */
 	struct path lower_path;
+	unsigned lower_seq;	/* lower d_seq when last found valid */
+	struct rcu_head rcu;	/* d_revalidate may look at us in rcu-walk */
 };
 
 struct sdcardfs_mount_options {
@@ -243,6 +248,8 @@ static inline void sdcardfs_set_lower_path(const struct dentry *dent,
 {
 	spin_lock(&SDCARDFS_D(dent)->lock);
 	pathcpy(&SDCARDFS_D(dent)->lower_path, lower_path);
+	SDCARDFS_D(dent)->lower_seq =
+		read_seqcount_begin(&lower_path->dentry->d_seq);
 	spin_unlock(&SDCARDFS_D(dent)->lock);
 	return;
 }
@@ -0,0 +1,273 @@
+/*
+ * fs/sdcardfs/sdcardfs_bench.c
+ *
+ * Tree walk benchmark for sdcardfs. Loading the module walks the directory
+ * tree at 'lower' and the sdcardfs mount of it at 'path' the way a media
+ * scanner does, reading every directory and stat()ing every entry by full
+ * path, for 'passes' passes each. Each pass reports the walk rate and the
+ * median, 99th percentile and worst stat latency, e.g. for a tree of 100k
+ * files created from userspace under /data/media/bench:
+ *
+ *	insmod sdcardfs_bench.ko lower=/data/media/bench \
+ *		path=/storage/sdcard0/bench passes=3
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/err.h>
+#include <linux/list.h>
+#include <linux/namei.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/stat.h>
+
+static char *path = "/storage/sdcard0";
+static char *lower = "/data/media";
+static int passes = 2;
+static int max_entries = 200000;
+
+module_param(path, charp, S_IRUGO);
+module_param(lower, charp, S_IRUGO);
+module_param(passes, int, S_IRUGO);
+module_param(max_entries, int, S_IRUGO);
+
+#define SDCARDFS_BENCH_MAX_SAMPLES	(4 * 1024 * 1024)
+
+/* a directory still to be read, or an entry still to be stat()ed */
+struct sdcardfs_bench_ent {
+	struct list_head	list;
+	char			name[0];
+};
+
+struct sdcardfs_bench_dir {
+	const char		*name;
+	struct list_head	*ents;
+	int			err;
+};
+
+static struct sdcardfs_bench_ent *sdcardfs_bench_ent_alloc(const char *dir,
+		const char *name, int namlen)
+{
+	struct sdcardfs_bench_ent *ent;
+	size_t len = strlen(dir);
+
+	ent = kmalloc(sizeof(*ent) + len + namlen + 2, GFP_KERNEL);
+	if (!ent)
+		return NULL;
+	memcpy(ent->name, dir, len);
+	if (namlen) {
+		ent->name[len++] = '/';
+		memcpy(ent->name + len, name, namlen);
+		len += namlen;
+	}
+	ent->name[len] = '\0';
+	return ent;
+}
+
+static void sdcardfs_bench_ent_free(struct list_head *head)
+{
+	struct sdcardfs_bench_ent *ent, *tmp;
+
+	list_for_each_entry_safe(ent, tmp, head, list) {
+		list_del(&ent->list);
+		kfree(ent);
+	}
+}
+
+static int sdcardfs_bench_filldir(void *data, const char *name, int namlen,
+				  loff_t offset, u64 ino, unsigned int d_type)
+{
+	struct sdcardfs_bench_dir *dir = data;
+	struct sdcardfs_bench_ent *ent;
+
+	if ((namlen == 1 && name[0] == '.') ||
+	    (namlen == 2 && name[0] == '.' && name[1] == '.'))
+		return 0;
+
+	ent = sdcardfs_bench_ent_alloc(dir->name, name, namlen);
+	if (!ent) {
+		dir->err = -ENOMEM;
+		return -ENOMEM;
+	}
+	list_add_tail(&ent->list, dir->ents);
+	return 0;
+}
+
+/*
+ * Collect the entries of @name on @ents. They are stat()ed only once the
+ * directory is closed again, as readdir holds its i_mutex.
+ */
+static int sdcardfs_bench_readdir(const char *name, struct list_head *ents)
+{
+	struct sdcardfs_bench_dir dir = { .name = name, .ents = ents };
+	struct file *filp;
+	int ret;
+
+	filp = filp_open(name, O_RDONLY | O_DIRECTORY, 0);
+	if (IS_ERR(filp))
+		return PTR_ERR(filp);
+	ret = vfs_readdir(filp, sdcardfs_bench_filldir, &dir);
+	filp_close(filp, NULL);
+	return dir.err ? dir.err : ret;
+}
+
+/* lstat() by full path, so every component is looked up again */
+static int sdcardfs_bench_stat(const char *name, struct kstat *stat)
+{
+	struct path p;
+	int ret;
+
+	ret = kern_path(name, 0, &p);
+	if (ret)
+		return ret;
+	ret = vfs_getattr(p.mnt, p.dentry, stat);
+	path_put(&p);
+	return ret;
+}
+
+/* Walk the tree at @root breadth first, recording each stat latency in ns */
+static int sdcardfs_bench_walk(const char *root, u32 *lat, int *nr)
+{
+	struct sdcardfs_bench_ent *ent;
+	struct kstat stat;
+	LIST_HEAD(dirs);
+	LIST_HEAD(ents);
+	ktime_t start;
+	int ret = 0;
+
+	*nr = 0;
+	ent = sdcardfs_bench_ent_alloc(root, NULL, 0);
+	if (!ent)
+		return -ENOMEM;
+	list_add_tail(&ent->list, &dirs);
+
+	while (!list_empty(&dirs)) {
+		ent = list_first_entry(&dirs, struct sdcardfs_bench_ent, list);
+		list_del(&ent->list);
+		ret = sdcardfs_bench_readdir(ent->name, &ents);
+		kfree(ent);
+		if (ret)
+			goto out;
+
+		while (!list_empty(&ents)) {
+			ent = list_first_entry(&ents, struct sdcardfs_bench_ent,
+					       list);
+			list_del(&ent->list);
+			if (*nr >= max_entries) {
+				kfree(ent);
+				ret = -E2BIG;
+				goto out;
+			}
+
+			start = ktime_get();
+			ret = sdcardfs_bench_stat(ent->name, &stat);
+			lat[(*nr)++] = min_t(s64, ktime_to_ns(ktime_sub(
+						ktime_get(), start)), UINT_MAX);
+			if (ret) {
+				pr_err("sdcardfs_bench: stat %s: %d\n",
+				       ent->name, ret);
+				kfree(ent);
+				goto out;
+			}
+
+			if (S_ISDIR(stat.mode))
+				list_add_tail(&ent->list, &dirs);
+			else
+				kfree(ent);
+		}
+		cond_resched();
+	}
+out:
+	sdcardfs_bench_ent_free(&ents);
+	sdcardfs_bench_ent_free(&dirs);
+	return ret;
+}
+
+static int sdcardfs_bench_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Walk @root once and report it, @rate is set to entries/sec */
+static int sdcardfs_bench_pass(const char *root, int pass, u32 *lat,
+			       u64 *rate)
+{
+	ktime_t start;
+	s64 elapsed;
+	int ret, n;
+
+	start = ktime_get();
+	ret = sdcardfs_bench_walk(root, lat, &n);
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret)
+		return ret;
+	if (!n || elapsed <= 0)
+		return -ENOENT;
+
+	sort(lat, n, sizeof(u32), sdcardfs_bench_cmp, NULL);
+	*rate = div64_u64((u64) n * NSEC_PER_SEC, elapsed);
+	pr_info("sdcardfs_bench: %s pass %d: %d entries in %lld ms\n",
+		root, pass, n, div_s64(elapsed, NSEC_PER_MSEC));
+	pr_info("sdcardfs_bench: %s pass %d: %llu entries/sec, stat p50 %u ns, "
+		"p99 %u ns, max %u ns\n", root, pass, *rate, lat[n / 2],
+		lat[(int) div_u64((u64) n * 99, 100)], lat[n - 1]);
+	return 0;
+}
+
+static int __init sdcardfs_bench_init(void)
+{
+	u64 lower_rate = 0, rate = 0;
+	u32 *lat;
+	int i, ret = 0;
+
+	if (passes <= 0 || max_entries <= 0 ||
+	    max_entries > SDCARDFS_BENCH_MAX_SAMPLES)
+		return -EINVAL;
+
+	lat = vmalloc(max_entries * sizeof(u32));
+	if (!lat)
+		return -ENOMEM;
+
+	/* alternate between the two, so both see the same cache state */
+	for (i = 0; i < passes; i++) {
+		ret = sdcardfs_bench_pass(lower, i, lat, &lower_rate);
+		if (ret)
+			break;
+		ret = sdcardfs_bench_pass(path, i, lat, &rate);
+		if (ret)
+			break;
+	}
+
+	if (ret)
+		pr_err("sdcardfs_bench: walk failed: %d\n", ret);
+	else if (lower_rate)
+		pr_info("sdcardfs_bench: %s walks at %llu%% of the rate of %s\n",
+			path, div64_u64(rate * 100, lower_rate), lower);
+	vfree(lat);
+	return ret;
+}
+
+static void __exit sdcardfs_bench_exit(void)
+{
+}
+
+module_init(sdcardfs_bench_init);
+module_exit(sdcardfs_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("sdcardfs tree walk benchmark");
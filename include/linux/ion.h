@@ -89,6 +89,8 @@ struct ion_buffer;
  * @priv:	heap private data
  * @align:	required alignment in physical memory if applicable
  * @priv:	private info passed from the board file
+ * @defer_free:	set to 1 to free buffers from a kernel thread instead of
+ *		the context dropping the last reference
  *
  * Provided by the board file.
  */
@@ -103,6 +105,7 @@ struct ion_platform_heap {
 	void *extra_data;
 	ion_phys_addr_t align;
 	void *priv;
+	unsigned int defer_free;
 };
 
 /**
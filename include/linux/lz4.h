@@ -0,0 +1,62 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ * LZ4 Kernel Interface
+ *
+ * Compression and decompression of the LZ4 block format, see
+ * http://code.google.com/p/lz4/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define LZ4_MEM_COMPRESS	(16384)
+
+/*
+ * lz4_compressbound()
+ * Provides the maximum size that LZ4 may output in a "worst case" scenario
+ * (input data not compressible)
+ */
+static inline size_t lz4_compressbound(size_t isize)
+{
+	return isize + (isize / 255) + 16;
+}
+
+/*
+ * lz4_compress()
+ *	src     : source address of the original data
+ *	src_len : size of the original data
+ *	dst	: output buffer address of the compressed data
+ *	dst_len : in, the size of dst; out, the size of the compressed data
+ *	wrkmem  : address of the working memory, LZ4_MEM_COMPRESS bytes
+ *	return  : 0 on success, -1 if the output does not fit in dst, which it
+ *		always does if dst is lz4_compressbound(src_len) bytes
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4_decompress()
+ *	src     : source address of the compressed data
+ *	src_len : out, the number of bytes of src consumed
+ *	dest	: output buffer address of the decompressed data
+ *	actual_dest_len: the exact size of the original data
+ *	return  : 0 on success, -1 on error
+ *	note    : the input is not bounds checked, only use this on trusted
+ *		data whose decompressed size is known
+ */
+int lz4_decompress(const unsigned char *src, size_t *src_len,
+		unsigned char *dest, size_t actual_dest_len);
+
+/*
+ * lz4_decompress_unknownoutputsize()
+ *	src     : source address of the compressed data
+ *	src_len : size of the compressed data
+ *	dest	: output buffer address of the decompressed data
+ *	dest_len: in, the size of dest; out, the size of the decompressed data
+ *	return  : 0 on success, -1 on error, also for malformed input
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len);
+#endif
@@ -201,6 +201,8 @@ enum mmc_packed_stop_reasons {
 	LARGE_SEC_ALIGN,
 	RANDOM,
 	FUA,
+	URGENT_REQ,
+	TIME_BUDGET,
 	MAX_REASONS,
 };
 
@@ -221,6 +223,10 @@ enum mmc_blk_status {
 struct mmc_wr_pack_stats {
 	u32 *packing_events;
 	u32 pack_stop_reason[MAX_REASONS];
+	u32 contig_reqs;	/* packed requests contiguous with the previous */
+	u32 time_budget_us;	/* budget of the last packed command */
+	u32 wr_ns_per_sect;	/* observed write cost */
+	u32 rd_interval_us;	/* observed read inter-arrival time */
 	spinlock_t lock;
 	bool enabled;
 	bool print_in_read;
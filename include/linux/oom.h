@@ -67,6 +67,45 @@ static inline void oom_killer_enable(void)
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+/* Called when the last user of tsk's mm is gone, see exit_mm() */
+extern void lmk_mm_released(struct task_struct *tsk);
+#else
+static inline void lmk_mm_released(struct task_struct *tsk)
+{
+}
+#endif
+
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+/*
+ * Index of thread group leaders bucketed by oom_score_adj, maintained for
+ * the Android lowmemorykiller. Callers hold tasklist_lock (add, del,
+ * replace) or the task's siglock (update).
+ */
+extern void lmk_adj_index_add(struct task_struct *p);
+extern void lmk_adj_index_del(struct task_struct *p);
+extern void lmk_adj_index_replace(struct task_struct *old,
+				  struct task_struct *new);
+extern void lmk_adj_index_update(struct task_struct *p);
+#else
+static inline void lmk_adj_index_add(struct task_struct *p)
+{
+}
+
+static inline void lmk_adj_index_del(struct task_struct *p)
+{
+}
+
+static inline void lmk_adj_index_replace(struct task_struct *old,
+					 struct task_struct *new)
+{
+}
+
+static inline void lmk_adj_index_update(struct task_struct *p)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
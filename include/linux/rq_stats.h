@@ -30,3 +30,5 @@ struct rq_data {
 extern spinlock_t rq_lock;
 extern struct rq_data rq_info;
 extern struct workqueue_struct *rq_wq;
+
+unsigned int rq_stats_cpu_load(unsigned int cpu);
@@ -1320,6 +1320,10 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+	struct hlist_node lmk_adj_node;
+	int lmk_adj_bucket;
+#endif
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
@@ -70,6 +70,7 @@ static void __unhash_process(struct task_struct *p, bool group_dead)
 		detach_pid(p, PIDTYPE_SID);
 
 		list_del_rcu(&p->tasks);
+		lmk_adj_index_del(p);
 		list_del_init(&p->sibling);
 		__this_cpu_dec(process_counts);
 	}
@@ -686,8 +687,10 @@ static void exit_mm(struct task_struct * tsk)
 	mm_update_next_owner(mm);
 
 	mm_released = mmput(mm);
-	if (mm_released)
+	if (mm_released) {
 		set_tsk_thread_flag(tsk, TIF_MM_RELEASED);
+		lmk_mm_released(tsk);
+	}
 }
 
 /*
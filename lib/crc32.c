@@ -45,6 +45,16 @@
 
 #include "crc32table.h"
 
+#ifdef CONFIG_CRC32_NEON
+#include <linux/hrtimer.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <asm/crc32.h>
+
+/* set at init, once the NEON code has been checked and timed */
+static bool crc32_use_neon __read_mostly;
+#endif
+
 MODULE_AUTHOR("Matt Domsch <Matt_Domsch@dell.com>");
 MODULE_DESCRIPTION("Various CRC32 calculations");
 MODULE_LICENSE("GPL");
@@ -186,16 +196,102 @@ u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
 #else
 u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 {
+#ifdef CONFIG_CRC32_NEON
+	if (crc32_use_neon)
+		crc = crc32_neon(crc, &p, &len, __crc32_le_neon);
+#endif
 	return crc32_le_generic(crc, p, len, crc32table_le, CRCPOLY_LE);
 }
 u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
 {
+#ifdef CONFIG_CRC32_NEON
+	if (crc32_use_neon)
+		crc = crc32_neon(crc, &p, &len, __crc32c_le_neon);
+#endif
 	return crc32_le_generic(crc, p, len, crc32ctable_le, CRC32C_POLY_LE);
 }
 #endif
 EXPORT_SYMBOL(crc32_le);
 EXPORT_SYMBOL(__crc32c_le);
 
+#ifdef CONFIG_CRC32_NEON
+#define CRC32_NEON_TEST_LEN	(2 * CRC32_NEON_CHUNK + 64)
+
+static u32 __init crc32_neon_test(u32 crc, unsigned char const *p,
+		size_t len, u32 (*fn)(u32, unsigned char const *, unsigned int),
+		const u32 (*tab)[256], u32 polynomial)
+{
+	crc = crc32_neon(crc, &p, &len, fn);
+	return crc32_le_generic(crc, p, len, tab, polynomial);
+}
+
+/*
+ * Check the NEON crc32_le() and __crc32c_le() against the tables, for
+ * random seeds, alignments and lengths up to past two chunks, then time
+ * both on a page.  NEON is used if it gets every one right and is faster.
+ */
+static int __init crc32_neon_select(void)
+{
+	static u32 crc;
+	unsigned char *buf;
+	ktime_t start;
+	s64 ns[2];
+	int i, errors = 0;
+
+	if (!cpu_has_neon())
+		return 0;
+
+	buf = kmalloc(CRC32_NEON_TEST_LEN, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	for (i = 0; i < CRC32_NEON_TEST_LEN; i++)
+		buf[i] = random32();
+
+	for (i = 0; i < 256; i++) {
+		unsigned int off = i % 64;
+		size_t len = i < 128 ? i : random32() % (CRC32_NEON_TEST_LEN -
+							  off);
+
+		crc = random32();
+		if (crc32_neon_test(crc, buf + off, len, __crc32_le_neon,
+				    crc32table_le, CRCPOLY_LE) !=
+		    crc32_le_generic(crc, buf + off, len, crc32table_le,
+				     CRCPOLY_LE))
+			errors++;
+		if (crc32_neon_test(crc, buf + off, len, __crc32c_le_neon,
+				    crc32ctable_le, CRC32C_POLY_LE) !=
+		    crc32_le_generic(crc, buf + off, len, crc32ctable_le,
+				     CRC32C_POLY_LE))
+			errors++;
+	}
+	if (errors) {
+		pr_err("crc32: NEON self tests failed: %d\n", errors);
+		kfree(buf);
+		return -EINVAL;
+	}
+
+	/* chained, so that the compiler cannot drop or merge the calls */
+	start = ktime_get();
+	for (i = 0; i < 64; i++)
+		crc = crc32_le_generic(crc, buf, PAGE_SIZE, crc32table_le,
+				       CRCPOLY_LE);
+	ns[0] = ktime_to_ns(ktime_sub(ktime_get(), start));
+	start = ktime_get();
+	for (i = 0; i < 64; i++)
+		crc = crc32_neon_test(crc, buf, PAGE_SIZE, __crc32_le_neon,
+				      crc32table_le, CRCPOLY_LE);
+	ns[1] = ktime_to_ns(ktime_sub(ktime_get(), start));
+	kfree(buf);
+
+	crc32_use_neon = ns[1] < ns[0];
+	pr_info("crc32: tables %llu MB/s, NEON %llu MB/s, using %s\n",
+		div64_u64(64 * PAGE_SIZE * 1000ULL, max_t(s64, ns[0], 1)),
+		div64_u64(64 * PAGE_SIZE * 1000ULL, max_t(s64, ns[1], 1)),
+		crc32_use_neon ? "NEON" : "tables");
+	return 0;
+}
+#endif /* CONFIG_CRC32_NEON */
+
 /**
  * crc32_be() - Calculate bitwise big-endian Ethernet AUTODIN II CRC32
  * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
@@ -1099,10 +1195,19 @@ static int __init crc32_test(void)
 	return 0;
 }
 
-static int __init crc32test_init(void)
+#endif /* CONFIG_CRC32_SELFTEST */
+
+#if defined(CONFIG_CRC32_NEON) || defined(CONFIG_CRC32_SELFTEST)
+static int __init crc32_init(void)
 {
+#ifdef CONFIG_CRC32_NEON
+	/* first, so that the self test covers what was picked */
+	crc32_neon_select();
+#endif
+#ifdef CONFIG_CRC32_SELFTEST
 	crc32_test();
 	crc32c_test();
+#endif
 	return 0;
 }
 
@@ -1110,6 +1215,6 @@ static void __exit crc32_exit(void)
 {
 }
 
-module_init(crc32test_init);
+module_init(crc32_init);
 module_exit(crc32_exit);
-#endif /* CONFIG_CRC32_SELFTEST */
+#endif
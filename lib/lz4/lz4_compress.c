@@ -0,0 +1,226 @@
+/*
+ * LZ4 compressor for the kernel
+ *
+ * Produces the LZ4 block format, see http://code.google.com/p/lz4/, with
+ * the single pass hash chain-less search of the reference LZ4 compressor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const u8 *p, int hash_log)
+{
+	return (LZ4_GETLE32(p) * 2654435761U) >> (MINMATCH * 8 - hash_log);
+}
+
+/* number of bytes from ip on that match those from ref, up to limit */
+static inline size_t lz4_count(const u8 *ip, const u8 *ref, const u8 *limit)
+{
+	const u8 *start = ip;
+
+	while (ip < limit - (sizeof(u32) - 1)) {
+		u32 diff = LZ4_GET32(ref) ^ LZ4_GET32(ip);
+
+		if (!diff) {
+			ip += sizeof(u32);
+			ref += sizeof(u32);
+			continue;
+		}
+#if defined(__LITTLE_ENDIAN)
+		ip += __builtin_ctz(diff) >> 3;
+#else
+		ip += __builtin_clz(diff) >> 3;
+#endif
+		return ip - start;
+	}
+	if (ip < limit - 1 && LZ4_GETLE16(ref) == LZ4_GETLE16(ip)) {
+		ip += 2;
+		ref += 2;
+	}
+	if (ip < limit && *ref == *ip)
+		ip++;
+	return ip - start;
+}
+
+/* a literal or match length field beyond the token, @len past the mask */
+static inline u8 *lz4_put_length(u8 *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/*
+ * Compress @isize bytes at @src into at most @osize bytes at @dst, with
+ * 16 bit offsets in the hash table @ctx if @small.  Returns the size of
+ * the output, 0 if it did not fit.
+ */
+static __always_inline int lz4_compress_generic(void *ctx, const u8 *src,
+		u8 *dst, size_t isize, size_t osize, bool small)
+{
+	const int hash_log = small ? HASH_LOG_64K : HASH_LOG;
+	u16 * const htab16 = ctx;
+	u32 * const htab32 = ctx;
+	const u8 *ip = src;
+	const u8 *anchor = src;
+	const u8 * const iend = src + isize;
+	const u8 * const mflimit = iend - MFLIMIT;
+	const u8 * const matchlimit = iend - LASTLITERALS;
+	u8 *op = dst;
+	u8 * const oend = dst + osize;
+	size_t lastrun;
+	u32 fwd_h;
+
+#define LZ4_HGET(h)	(src + (small ? htab16[h] : htab32[h]))
+#define LZ4_HPUT(h, p)	do {					\
+		if (small)					\
+			htab16[h] = (u16)((p) - src);		\
+		else						\
+			htab32[h] = (u32)((p) - src);		\
+	} while (0)
+
+	if (isize < MIN_LENGTH)
+		goto last_literals;
+
+	LZ4_HPUT(lz4_hash(ip, hash_log), ip);
+	ip++;
+	fwd_h = lz4_hash(ip, hash_log);
+
+	for (;;) {
+		const u8 *fwd_ip = ip;
+		unsigned int step = 1;
+		unsigned int search = 1 << SKIPSTRENGTH;
+		const u8 *ref;
+		u8 *token;
+		size_t len;
+
+		/* find a match */
+		do {
+			u32 h = fwd_h;
+
+			ip = fwd_ip;
+			fwd_ip += step;
+			step = search++ >> SKIPSTRENGTH;
+			if (unlikely(fwd_ip > mflimit))
+				goto last_literals;
+
+			ref = LZ4_HGET(h);
+			fwd_h = lz4_hash(fwd_ip, hash_log);
+			LZ4_HPUT(h, ip);
+		} while (ip - ref > MAX_DISTANCE ||
+			 LZ4_GET32(ref) != LZ4_GET32(ip));
+
+		/* extend it backwards */
+		while (ip > anchor && ref > src && unlikely(ip[-1] == ref[-1])) {
+			ip--;
+			ref--;
+		}
+
+		/* literals, with room for the offset and the last literals */
+		len = ip - anchor;
+		token = op++;
+		if (unlikely(op + len + (2 + 1 + LASTLITERALS) + len / 255 >
+			     oend))
+			return 0;
+		if (len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, len - RUN_MASK);
+		} else {
+			*token = len << ML_BITS;
+		}
+		memcpy(op, anchor, len);
+		op += len;
+
+next_match:
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		ip += MINMATCH;
+		ref += MINMATCH;
+		len = lz4_count(ip, ref, matchlimit);
+		ip += len;
+
+		if (unlikely(op + (1 + LASTLITERALS) + (len >> 8) > oend))
+			return 0;
+		if (len >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token += len;
+		}
+
+		anchor = ip;
+		if (ip > mflimit)
+			break;
+
+		LZ4_HPUT(lz4_hash(ip - 2, hash_log), ip - 2);
+
+		/* a match right away needs no literals */
+		ref = LZ4_HGET(lz4_hash(ip, hash_log));
+		LZ4_HPUT(lz4_hash(ip, hash_log), ip);
+		if (ip - ref <= MAX_DISTANCE &&
+		    LZ4_GET32(ref) == LZ4_GET32(ip)) {
+			token = op++;
+			*token = 0;
+			goto next_match;
+		}
+
+		ip++;
+		fwd_h = lz4_hash(ip, hash_log);
+	}
+
+last_literals:
+	lastrun = iend - anchor;
+	if (op + 1 + lastrun + (lastrun + 255 - RUN_MASK) / 255 > oend)
+		return 0;
+	if (lastrun >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lastrun - RUN_MASK);
+	} else {
+		*op++ = lastrun << ML_BITS;
+	}
+	memcpy(op, anchor, lastrun);
+	op += lastrun;
+
+	return op - dst;
+#undef LZ4_HGET
+#undef LZ4_HPUT
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	int out_len;
+
+	BUILD_BUG_ON((1 << HASH_LOG) * sizeof(u32) > LZ4_MEM_COMPRESS);
+	BUILD_BUG_ON((1 << HASH_LOG_64K) * sizeof(u16) > LZ4_MEM_COMPRESS);
+
+	if (src_len > INT_MAX)
+		return -1;
+
+	memset(wrkmem, 0, LZ4_MEM_COMPRESS);
+	if (src_len < LZ4_64KLIMIT)
+		out_len = lz4_compress_generic(wrkmem, src, dst, src_len,
+					       *dst_len, true);
+	else
+		out_len = lz4_compress_generic(wrkmem, src, dst, src_len,
+					       *dst_len, false);
+	if (!out_len)
+		return -1;
+
+	*dst_len = out_len;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
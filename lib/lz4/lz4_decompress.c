@@ -0,0 +1,193 @@
+/*
+ * LZ4 decompressor for the kernel
+ *
+ * Decodes the LZ4 block format, see http://code.google.com/p/lz4/.  Like
+ * the reference decoder, literals and matches are copied 8 bytes at a
+ * time, relying on the format keeping the last LASTLITERALS bytes
+ * literals and every match MFLIMIT bytes clear of the end.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+/* for offsets under 8, where the match overlaps its first 8 bytes */
+static const int dec32table[] = {0, 1, 2, 1, 4, 4, 4, 4};
+static const int dec64table[] = {0, 0, 0, -1, 0, 1, 2, 3};
+
+/*
+ * With @bounded, decode exactly @isize bytes of untrusted input at @src
+ * into at most @osize bytes at @dst and return the size of the output.
+ * Otherwise decode until exactly @osize bytes have been output and return
+ * the size of the input consumed, which is not bounds checked.  Either
+ * returns -1 on malformed input.
+ */
+static __always_inline int lz4_decompress_generic(const u8 *src, u8 *dst,
+		size_t isize, size_t osize, bool bounded)
+{
+	const u8 *ip = src;
+	const u8 * const iend = src + isize;
+	u8 *op = dst;
+	u8 * const oend = dst + osize;
+	u8 *cpy;
+
+	if (bounded && unlikely(isize == 0))
+		return -1;
+	if (unlikely(osize == 0)) {
+		if (bounded)
+			return (isize == 1 && *ip == 0) ? 0 : -1;
+		return *ip == 0 ? 1 : -1;
+	}
+
+	for (;;) {
+		unsigned int token;
+		size_t length, offset;
+		const u8 *ref;
+
+		/* literals */
+		token = *ip++;
+		length = token >> ML_BITS;
+		if (length == RUN_MASK) {
+			unsigned int s;
+
+			do {
+				if (bounded && unlikely(ip >= iend))
+					return -1;
+				s = *ip++;
+				length += s;
+			} while (s == 255);
+			if (bounded && unlikely((uintptr_t)op + length <
+						(uintptr_t)op ||
+						(uintptr_t)ip + length <
+						(uintptr_t)ip))
+				return -1;
+		}
+
+		cpy = op + length;
+		if ((bounded && (cpy > oend - MFLIMIT ||
+				 ip + length > iend - (2 + 1 + LASTLITERALS))) ||
+		    (!bounded && cpy > oend - COPYLENGTH)) {
+			/* only the last literals may come this close to the end */
+			if (bounded) {
+				if (ip + length != iend || cpy > oend)
+					return -1;
+			} else if (cpy != oend) {
+				return -1;
+			}
+			memcpy(op, ip, length);
+			ip += length;
+			op += length;
+			break;
+		}
+		LZ4_WILDCOPY(op, ip, cpy);
+		ip -= op - cpy;
+		op = cpy;
+
+		/* match */
+		offset = LZ4_GETLE16(ip);
+		ip += 2;
+		ref = op - offset;
+		if (unlikely(offset == 0 || ref < dst))
+			return -1;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK) {
+			unsigned int s;
+
+			do {
+				if (bounded && unlikely(ip > iend - LASTLITERALS))
+					return -1;
+				s = *ip++;
+				length += s;
+			} while (s == 255);
+			if (bounded && unlikely((uintptr_t)op + length <
+						(uintptr_t)op))
+				return -1;
+		}
+		length += MINMATCH;
+
+		cpy = op + length;
+		if (unlikely(offset < 8)) {
+			const int dec64 = dec64table[offset];
+
+			op[0] = ref[0];
+			op[1] = ref[1];
+			op[2] = ref[2];
+			op[3] = ref[3];
+			ref += dec32table[offset];
+			LZ4_COPY4(op + 4, ref);
+			ref -= dec64;
+		} else {
+			LZ4_COPY8(op, ref);
+			ref += 8;
+		}
+		op += 8;
+
+		if (unlikely(cpy > oend - MFLIMIT)) {
+			if (cpy > oend - LASTLITERALS)
+				return -1;
+			if (op < oend - COPYLENGTH) {
+				u8 * const olimit = oend - COPYLENGTH;
+
+				LZ4_WILDCOPY(op, ref, olimit);
+				ref -= op - olimit;
+				op = olimit;
+			}
+			while (op < cpy)
+				*op++ = *ref++;
+		} else if (op < cpy) {
+			LZ4_WILDCOPY(op, ref, cpy);
+		}
+		op = cpy;
+	}
+
+	if (bounded)
+		return op - dst;
+	return ip - src;
+}
+
+int lz4_decompress(const unsigned char *src, size_t *src_len,
+		unsigned char *dest, size_t actual_dest_len)
+{
+	int ret;
+
+	if (actual_dest_len > INT_MAX)
+		return -1;
+	ret = lz4_decompress_generic(src, dest, 0, actual_dest_len, false);
+	if (ret < 0)
+		return -1;
+	*src_len = ret;
+	return 0;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress);
+#endif
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	int ret;
+
+	if (src_len > INT_MAX || *dest_len > INT_MAX)
+		return -1;
+	ret = lz4_decompress_generic(src, dest, src_len, *dest_len, true);
+	if (ret < 0)
+		return -1;
+	*dest_len = ret;
+	return 0;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+#endif
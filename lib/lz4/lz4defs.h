@@ -0,0 +1,66 @@
+/*
+ * lz4defs.h -- architecture specific defines and format constants
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * As for LZO, see lib/lzo/lzodefs.h: ARMv6 and later take unaligned
+ * words in hardware, which asm/unaligned.h does not make use of.
+ */
+#if defined(__arm__) && __LINUX_ARM_ARCH__ >= 6 && \
+	defined(__LITTLE_ENDIAN) && !defined(STATIC)
+#include <linux/unaligned/packed_struct.h>
+#define LZ4_GETLE16(p)		__get_unaligned_cpu16(p)
+#define LZ4_GETLE32(p)		__get_unaligned_cpu32(p)
+#define LZ4_GET32(p)		__get_unaligned_cpu32(p)
+#define LZ4_PUT32(p, v)		__put_unaligned_cpu32(v, p)
+#else
+#define LZ4_GETLE16(p)		get_unaligned_le16(p)
+#define LZ4_GETLE32(p)		get_unaligned_le32(p)
+#define LZ4_GET32(p)		get_unaligned((const u32 *)(p))
+#define LZ4_PUT32(p, v)		put_unaligned(v, (u32 *)(p))
+#endif
+
+#define LZ4_COPY4(d, s)		LZ4_PUT32(d, LZ4_GET32(s))
+#if defined(__x86_64__)
+#define LZ4_COPY8(d, s)	\
+	put_unaligned(get_unaligned((const u64 *)(s)), (u64 *)(d))
+#else
+#define LZ4_COPY8(d, s)	\
+	do { LZ4_COPY4(d, s); LZ4_COPY4((d) + 4, (s) + 4); } while (0)
+#endif
+
+/* copy 8 bytes at a time from s to d until d reaches e, may overrun by 7 */
+#define LZ4_WILDCOPY(d, s, e)			\
+	do {					\
+		LZ4_COPY8(d, s);		\
+		d += 8;				\
+		s += 8;				\
+	} while (d < e)
+
+#define MINMATCH	4
+#define COPYLENGTH	8
+#define LASTLITERALS	5
+#define MFLIMIT		(COPYLENGTH + MINMATCH)
+#define MIN_LENGTH	(MFLIMIT + 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+/* the longer no match is found, the faster the input is skipped */
+#define SKIPSTRENGTH	6
+
+/*
+ * The hash table takes LZ4_MEM_COMPRESS bytes: 32 bit offsets in general,
+ * 16 bit offsets, twice as many, for inputs whose offsets fit.
+ */
+#define HASH_LOG	12
+#define HASH_LOG_64K	13
+#define LZ4_64KLIMIT	((1 << 16) + (MFLIMIT - 1))
@@ -1,7 +1,7 @@
 /*
  *  lzodefs.h -- architecture, OS and compiler specific defines
  *
- *  Copyright (C) 1996-2005 Markus F.X.J. Oberhumer <markus@oberhumer.com>
+ *  Copyright (C) 1996-2012 Markus F.X.J. Oberhumer <markus@oberhumer.com>
  *
  *  The full LZO package can be found at:
  *  http://www.oberhumer.com/opensource/lzo/
@@ -11,9 +11,47 @@
  *  Richard Purdie <rpurdie@openedhand.com>
  */
 
-#define LZO_VERSION		0x2020
-#define LZO_VERSION_STRING	"2.02"
-#define LZO_VERSION_DATE	"Oct 17 2005"
+/*
+ * ARMv6 and later load and store unaligned words in hardware, but
+ * asm/unaligned.h puts them together byte by byte for the older cores.
+ * Use packed accesses there, which the compiler turns into single ldr/str.
+ * Not in the pre-boot decompressor, which may run with the MMU off, where
+ * unaligned accesses fault.
+ */
+#if defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS) || \
+	(defined(__arm__) && __LINUX_ARM_ARCH__ >= 6 && \
+	 defined(__LITTLE_ENDIAN) && !defined(STATIC))
+#define LZO_UNALIGNED_OK	1
+#endif
+
+#if defined(LZO_UNALIGNED_OK) && defined(__arm__)
+#include <linux/unaligned/packed_struct.h>
+#define LZO_GET32(p)		__get_unaligned_cpu32(p)
+#define LZO_PUT32(p, v)		__put_unaligned_cpu32(v, p)
+#else
+#define LZO_GET32(p)		get_unaligned((const u32 *)(p))
+#define LZO_PUT32(p, v)		put_unaligned(v, (u32 *)(p))
+#endif
+
+#define COPY4(dst, src)		LZO_PUT32(dst, LZO_GET32(src))
+#if defined(__x86_64__)
+#define COPY8(dst, src)	\
+		put_unaligned(get_unaligned((const u64 *)(src)), (u64 *)(dst))
+#else
+#define COPY8(dst, src)	\
+		do { COPY4(dst, src); COPY4((dst) + 4, (src) + 4); } while (0)
+#endif
+
+#if defined(__BIG_ENDIAN) && defined(__LITTLE_ENDIAN)
+#error "conflicting endian definitions"
+#elif defined(__x86_64__)
+#define LZO_USE_CTZ64	1
+#define LZO_USE_CTZ32	1
+#elif defined(__i386__) || defined(__powerpc__)
+#define LZO_USE_CTZ32	1
+#elif defined(__arm__) && (__LINUX_ARM_ARCH__ >= 5)
+#define LZO_USE_CTZ32	1
+#endif
 
 #define M1_MAX_OFFSET	0x0400
 #define M2_MAX_OFFSET	0x0800
@@ -34,10 +72,8 @@
 #define M3_MARKER	32
 #define M4_MARKER	16
 
-#define D_BITS		14
-#define D_MASK		((1u << D_BITS) - 1)
+#define lzo_dict_t      unsigned short
+#define D_BITS		13
+#define D_SIZE		(1u << D_BITS)
+#define D_MASK		(D_SIZE - 1)
 #define D_HIGH		((D_MASK >> 1) + 1)
-
-#define DX2(p, s1, s2)	(((((size_t)((p)[2]) << (s2)) ^ (p)[1]) \
-							<< (s1)) ^ (p)[0])
-#define DX3(p, s1, s2, s3)	((DX2((p)+1, s2, s3) << (s1)) ^ (p)[0])
@@ -0,0 +1,56 @@
+/*
+ * linux/lib/raid6/neon.c - RAID6 syndrome calculation using ARM NEON
+ *
+ * Copyright (c) 2013, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/raid/pq.h>
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+#include <asm/neon.h>
+
+/*
+ * The syndromes are worked out in neon$#.c, which are built with
+ * -mfpu=neon, and called from here between kernel_neon_begin() and
+ * kernel_neon_end().  RAID6 does not compute syndromes in interrupt
+ * context.
+ */
+#define RAID6_NEON_WRAPPER(_n)						\
+	void raid6_neon ## _n ## _gen_syndrome_real(int disks,		\
+			unsigned long bytes, void **ptrs);		\
+	static void raid6_neon ## _n ## _gen_syndrome(int disks,	\
+			size_t bytes, void **ptrs)			\
+	{								\
+		kernel_neon_begin();					\
+		raid6_neon ## _n ## _gen_syndrome_real(disks,		\
+				(unsigned long)bytes, ptrs);		\
+		kernel_neon_end();					\
+	}								\
+	const struct raid6_calls raid6_neonx ## _n = {			\
+		raid6_neon ## _n ## _gen_syndrome,			\
+		raid6_have_neon,					\
+		"neonx" #_n,						\
+		0							\
+	}
+
+static int raid6_have_neon(void)
+{
+	return cpu_has_neon();
+}
+
+RAID6_NEON_WRAPPER(1);
+RAID6_NEON_WRAPPER(2);
+RAID6_NEON_WRAPPER(4);
+RAID6_NEON_WRAPPER(8);
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
@@ -49,6 +49,8 @@
 static atomic_t zswap_pool_pages = ATOMIC_INIT(0);
 /* The number of compressed pages currently stored in zswap */
 static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+/* The number of stored pages that are filled with one repeated word */
+static atomic_t zswap_same_filled_pages = ATOMIC_INIT(0);
 /* The number of outstanding pages awaiting writeback */
 static atomic_t zswap_outstanding_writebacks = ATOMIC_INIT(0);
 
@@ -67,6 +69,9 @@ static u64 zswap_reject_zsmalloc_fail;
 static u64 zswap_reject_kmemcache_fail;
 static u64 zswap_saved_by_writeback;
 static u64 zswap_duplicate_entry;
+static u64 zswap_recompress_poor;
+/* Loads of pages that had been written back to the swap device */
+static u64 zswap_writeback_refaults;
 
 /*********************************
 * tunables
@@ -80,6 +85,17 @@ module_param_named(enabled, zswap_enabled, bool, 0);
 static char *zswap_compressor = ZSWAP_COMPRESSOR_DEFAULT;
 module_param_named(compressor, zswap_compressor, charp, 0);
 
+/*
+ * Denser, slower compressor that entries which have stayed in zswap for
+ * zswap_recompress_age seconds are recompressed with (fixed at boot).
+ * Empty, or the same as the compressor above, disables recompression.
+ */
+static char *zswap_dense_compressor = "deflate";
+module_param_named(dense_compressor, zswap_dense_compressor, charp, 0);
+
+static unsigned int zswap_recompress_age = 60;
+module_param_named(recompress_age, zswap_recompress_age, uint, 0644);
+
 /* The maximum percentage of memory that the compressed pool can occupy */
 static unsigned int zswap_max_pool_percent = 20;
 module_param_named(max_pool_percent,
@@ -103,23 +119,70 @@ module_param_named(max_compression_ratio,
 #define ZSWAP_MAX_OUTSTANDING_FLUSHES 64
 
 /*********************************
-* compression functions
+* pools
 **********************************/
-/* per-cpu compression transforms */
-static struct crypto_comp * __percpu *zswap_comp_pcpu_tfms;
+/*
+ * struct zswap_pool
+ *
+ * A compressor and the zsmalloc pool holding what it compressed.  New
+ * pages go to the fast pool; zswap_recompress_work() moves entries that
+ * have aged into the dense pool, if there is one.
+ *
+ * compressor - crypto compressor name
+ * tfms - per-cpu compression transforms
+ * zpool - zsmalloc pool for the compressed pages, shared by all swap types
+ * lru - entries whose data is in this pool, least recently stored or
+ *       loaded first, across all swap types
+ * lru_lock - protects lru; nests inside the tree lock of the entries
+ * stored_pages - number of entries whose data is in this pool
+ * recompressed_pages - number of entries moved into this pool
+ */
+struct zswap_pool {
+	char *compressor;
+	struct crypto_comp * __percpu *tfms;
+	struct zs_pool *zpool;
+	struct list_head lru;
+	spinlock_t lru_lock;
+	atomic_t stored_pages;
+	u64 recompressed_pages;
+};
+
+enum {
+	ZSWAP_POOL_FAST,
+	ZSWAP_POOL_DENSE,
+	ZSWAP_MAX_POOLS
+};
+
+static struct zswap_pool zswap_pools[ZSWAP_MAX_POOLS];
+static int zswap_nr_pools;
 
+#define zswap_fast_pool (&zswap_pools[ZSWAP_POOL_FAST])
+static inline struct zswap_pool *zswap_dense_pool(void)
+{
+	if (zswap_nr_pools <= ZSWAP_POOL_DENSE)
+		return NULL;
+	return &zswap_pools[ZSWAP_POOL_DENSE];
+}
+
+#define for_each_zswap_pool(pool) \
+	for (pool = zswap_pools; pool < zswap_pools + zswap_nr_pools; pool++)
+
+/*********************************
+* compression functions
+**********************************/
 enum comp_op {
 	ZSWAP_COMPOP_COMPRESS,
 	ZSWAP_COMPOP_DECOMPRESS
 };
 
-static int zswap_comp_op(enum comp_op op, const u8 *src, unsigned int slen,
-				u8 *dst, unsigned int *dlen)
+static int zswap_comp_op(struct zswap_pool *pool, enum comp_op op,
+			const u8 *src, unsigned int slen,
+			u8 *dst, unsigned int *dlen)
 {
 	struct crypto_comp *tfm;
 	int ret;
 
-	tfm = *per_cpu_ptr(zswap_comp_pcpu_tfms, get_cpu());
+	tfm = *per_cpu_ptr(pool->tfms, get_cpu());
 	switch (op) {
 	case ZSWAP_COMPOP_COMPRESS:
 		ret = crypto_comp_compress(tfm, src, slen, dst, dlen);
@@ -137,6 +200,8 @@ static int zswap_comp_op(enum comp_op op, const u8 *src, unsigned int slen,
 
 static int __init zswap_comp_init(void)
 {
+	struct zswap_pool *pool;
+
 	if (!crypto_has_comp(zswap_compressor, 0, 0)) {
 		pr_info("%s compressor not available\n", zswap_compressor);
 		/* fall back to default compressor */
@@ -146,19 +211,39 @@ static int __init zswap_comp_init(void)
 			return -ENODEV;
 	}
 	pr_info("using %s compressor\n", zswap_compressor);
+	zswap_pools[ZSWAP_POOL_FAST].compressor = zswap_compressor;
+	zswap_nr_pools = 1;
+
+	if (zswap_dense_compressor && *zswap_dense_compressor &&
+	    strcmp(zswap_dense_compressor, zswap_compressor)) {
+		if (crypto_has_comp(zswap_dense_compressor, 0, 0)) {
+			pr_info("recompressing aged pages with %s\n",
+				zswap_dense_compressor);
+			zswap_pools[ZSWAP_POOL_DENSE].compressor =
+				zswap_dense_compressor;
+			zswap_nr_pools++;
+		} else
+			pr_info("%s compressor not available\n",
+				zswap_dense_compressor);
+	}
 
 	/* alloc percpu transforms */
-	zswap_comp_pcpu_tfms = alloc_percpu(struct crypto_comp *);
-	if (!zswap_comp_pcpu_tfms)
-		return -ENOMEM;
+	for_each_zswap_pool(pool) {
+		pool->tfms = alloc_percpu(struct crypto_comp *);
+		if (!pool->tfms)
+			return -ENOMEM;
+	}
 	return 0;
 }
 
 static void zswap_comp_exit(void)
 {
+	struct zswap_pool *pool;
+
 	/* free percpu transforms */
-	if (zswap_comp_pcpu_tfms)
-		free_percpu(zswap_comp_pcpu_tfms);
+	for_each_zswap_pool(pool)
+		if (pool->tfms)
+			free_percpu(pool->tfms);
 }
 
 /*********************************
@@ -172,7 +257,7 @@ static void zswap_comp_exit(void)
  * page within zswap.
  *
  * rbnode - links the entry into red-black tree for the appropriate swap type
- * lru - links the entry into the lru list for the appropriate swap type
+ * lru - links the entry into the lru list of its pool
  * refcount - the number of outstanding reference to the entry. This is needed
  *            to protect against premature freeing of the entry by code
  *            concurent calls to load, invalidate, and writeback.  The lock
@@ -182,30 +267,39 @@ static void zswap_comp_exit(void)
  * type - the swap type for the entry.  Used to map back to the zswap_tree
  *        structure that contains the entry.
  * offset - the swap offset for the entry.  Index into the red-black tree.
+ * pool - the pool holding the compressed page data, NULL for a same-filled
+ *        page
  * handle - zsmalloc allocation handle that stores the compressed page data
+ * value - the word a same-filled page is filled with
  * length - the length in bytes of the compressed page data.  Needed during
-            decompression
+            decompression.  0 for a same-filled page.
+ * stored - jiffies when the page was stored or last loaded, for aging into
+ *          the dense pool
  */
 struct zswap_entry {
 	struct rb_node rbnode;
 	struct list_head lru;
 	int refcount;
+	unsigned type;
 	pgoff_t offset;
-	unsigned long handle;
+	struct zswap_pool *pool;
+	union {
+		unsigned long handle;
+		unsigned long value;
+	};
 	unsigned int length;
+	unsigned long stored;
 };
 
 /*
  * The tree lock in the zswap_tree struct protects a few things:
  * - the rbtree
- * - the lru list
+ * - the lru and pool fields of each entry in the tree
  * - the refcount field of each entry in the tree
  */
 struct zswap_tree {
 	struct rb_root rbroot;
-	struct list_head lru;
 	spinlock_t lock;
-	struct zs_pool *pool;
 	unsigned type;
 };
 
@@ -237,6 +331,7 @@ static inline struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
 	if (!entry)
 		return NULL;
 	INIT_LIST_HEAD(&entry->lru);
+	RB_CLEAR_NODE(&entry->rbnode);
 	entry->refcount = 1;
 	return entry;
 }
@@ -304,6 +399,18 @@ static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
 	return 0;
 }
 
+/*
+ * Unlinks the entry from the tree, if it still is in it.  Whoever holds
+ * a reference can then tell it was written back or invalidated meanwhile.
+ */
+static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
+{
+	if (!RB_EMPTY_NODE(&entry->rbnode)) {
+		rb_erase(&entry->rbnode, root);
+		RB_CLEAR_NODE(&entry->rbnode);
+	}
+}
+
 /*********************************
 * per-cpu code
 **********************************/
@@ -311,32 +418,37 @@ static DEFINE_PER_CPU(u8 *, zswap_dstmem);
 
 static int __zswap_cpu_notifier(unsigned long action, unsigned long cpu)
 {
+	struct zswap_pool *pool;
 	struct crypto_comp *tfm;
 	u8 *dst;
 
 	switch (action) {
 	case CPU_UP_PREPARE:
-		tfm = crypto_alloc_comp(zswap_compressor, 0, 0);
-		if (IS_ERR(tfm)) {
-			pr_err("can't allocate compressor transform\n");
-			return NOTIFY_BAD;
+		for_each_zswap_pool(pool) {
+			tfm = crypto_alloc_comp(pool->compressor, 0, 0);
+			if (IS_ERR(tfm)) {
+				pr_err("can't allocate compressor transform\n");
+				__zswap_cpu_notifier(CPU_UP_CANCELED, cpu);
+				return NOTIFY_BAD;
+			}
+			*per_cpu_ptr(pool->tfms, cpu) = tfm;
 		}
-		*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = tfm;
 		dst = (u8 *)__get_free_pages(GFP_KERNEL, 1);
 		if (!dst) {
 			pr_err("can't allocate compressor buffer\n");
-			crypto_free_comp(tfm);
-			*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = NULL;
+			__zswap_cpu_notifier(CPU_UP_CANCELED, cpu);
 			return NOTIFY_BAD;
 		}
 		per_cpu(zswap_dstmem, cpu) = dst;
 		break;
 	case CPU_DEAD:
 	case CPU_UP_CANCELED:
-		tfm = *per_cpu_ptr(zswap_comp_pcpu_tfms, cpu);
-		if (tfm) {
-			crypto_free_comp(tfm);
-			*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = NULL;
+		for_each_zswap_pool(pool) {
+			tfm = *per_cpu_ptr(pool->tfms, cpu);
+			if (tfm) {
+				crypto_free_comp(tfm);
+				*per_cpu_ptr(pool->tfms, cpu) = NULL;
+			}
 		}
 		dst = per_cpu(zswap_dstmem, cpu);
 		if (dst) {
@@ -404,11 +516,11 @@ static inline void zswap_page_pool_destroy(void)
 	mempool_destroy(zswap_page_pool);
 }
 
-static struct page *zswap_alloc_page(gfp_t flags)
+static struct page *__zswap_alloc_page(gfp_t flags, unsigned int limit)
 {
 	struct page *page;
 
-	if (atomic_read(&zswap_pool_pages) >= zswap_max_pool_pages()) {
+	if (atomic_read(&zswap_pool_pages) >= limit) {
 		zswap_pool_limit_hit++;
 		return NULL;
 	}
@@ -418,6 +530,24 @@ static struct page *zswap_alloc_page(gfp_t flags)
 	return page;
 }
 
+static struct page *zswap_alloc_page(gfp_t flags)
+{
+	return __zswap_alloc_page(flags, zswap_max_pool_pages());
+}
+
+/*
+ * Recompression has to allocate in the dense pool before the fast pool
+ * copy is freed, so let the dense pool go a little over the limit;
+ * otherwise a full pool could never be made denser.
+ */
+#define ZSWAP_DENSE_SLACK_PAGES 32
+
+static struct page *zswap_alloc_dense_page(gfp_t flags)
+{
+	return __zswap_alloc_page(flags,
+			zswap_max_pool_pages() + ZSWAP_DENSE_SLACK_PAGES);
+}
+
 static void zswap_free_page(struct page *page)
 {
 	if (!page)
@@ -431,22 +561,182 @@ static struct zs_ops zswap_zs_ops = {
 	.free = zswap_free_page
 };
 
+static struct zs_ops zswap_dense_zs_ops = {
+	.alloc = zswap_alloc_dense_page,
+	.free = zswap_free_page
+};
+
+static int __init zswap_pool_init(void)
+{
+	struct zswap_pool *pool;
+
+	for_each_zswap_pool(pool) {
+		INIT_LIST_HEAD(&pool->lru);
+		spin_lock_init(&pool->lru_lock);
+		pool->zpool = zs_create_pool(GFP_KERNEL,
+				pool == zswap_fast_pool ? &zswap_zs_ops :
+				&zswap_dense_zs_ops);
+		if (!pool->zpool)
+			goto fail;
+	}
+	return 0;
+fail:
+	while (pool-- > zswap_pools)
+		zs_destroy_pool(pool->zpool);
+	return -ENOMEM;
+}
+
 
 /*********************************
 * helpers
 **********************************/
 
+/*
+ * Checks whether the page is one word repeated, which is common for
+ * anonymous memory (mostly zero pages).  Such pages are stored as the
+ * word alone, without compressing them or allocating from a pool.
+ */
+static int zswap_is_page_same_filled(void *ptr, unsigned long *value)
+{
+	unsigned long *words = ptr;
+	unsigned int pos, last = PAGE_SIZE / sizeof(*words) - 1;
+
+	/* most pages that are not same-filled differ at the end already */
+	if (words[0] != words[last])
+		return 0;
+	for (pos = 1; pos < last; pos++) {
+		if (words[pos] != words[0])
+			return 0;
+	}
+	*value = words[0];
+	return 1;
+}
+
+static void zswap_fill_page(struct page *page, unsigned long value)
+{
+	unsigned long *words;
+	unsigned int pos;
+
+	words = kmap_atomic(page);
+	if (!value) {
+		memset(words, 0, PAGE_SIZE);
+	} else {
+		for (pos = 0; pos < PAGE_SIZE / sizeof(*words); pos++)
+			words[pos] = value;
+	}
+	kunmap_atomic(words);
+}
+
 /*
  * Carries out the common pattern of freeing and entry's zsmalloc allocation,
  * freeing the entry itself, and decrementing the number of stored pages.
  */
 static void zswap_free_entry(struct zswap_tree *tree, struct zswap_entry *entry)
 {
-	zs_free(tree->pool, entry->handle);
+	if (!entry->length) {
+		atomic_dec(&zswap_same_filled_pages);
+	} else {
+		zs_free(entry->pool->zpool, entry->handle);
+		atomic_dec(&entry->pool->stored_pages);
+	}
 	zswap_entry_cache_free(entry);
 	atomic_dec(&zswap_stored_pages);
 }
 
+/*
+ * Decompresses the data of an entry into page.  The caller must hold a
+ * reference on the entry.
+ */
+static int zswap_decompress_entry(struct zswap_entry *entry, struct page *page)
+{
+	unsigned int dlen = PAGE_SIZE;
+	u8 *src, *dst;
+	int ret;
+
+	if (!entry->length) {
+		zswap_fill_page(page, entry->value);
+		return 0;
+	}
+
+	src = zs_map_object(entry->pool->zpool, entry->handle, ZS_MM_RO);
+	dst = kmap_atomic(page);
+	ret = zswap_comp_op(entry->pool, ZSWAP_COMPOP_DECOMPRESS, src,
+			entry->length, dst, &dlen);
+	kunmap_atomic(dst);
+	zs_unmap_object(entry->pool->zpool, entry->handle);
+	if (!ret && dlen != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
+
+/*
+ * Adds the entry to the tail of its pool's lru, unless it is already on
+ * it or no longer in the tree.  Same-filled entries have no pool memory
+ * to free and are never on an lru.  The caller must hold the tree lock.
+ */
+static void zswap_lru_add(struct zswap_entry *entry)
+{
+	struct zswap_pool *pool = entry->pool;
+
+	if (!pool || RB_EMPTY_NODE(&entry->rbnode))
+		return;
+	spin_lock(&pool->lru_lock);
+	if (list_empty(&entry->lru))
+		list_add_tail(&entry->lru, &pool->lru);
+	spin_unlock(&pool->lru_lock);
+}
+
+/* The caller must hold the tree lock */
+static void zswap_lru_del(struct zswap_entry *entry)
+{
+	struct zswap_pool *pool = entry->pool;
+
+	if (!pool)
+		return;
+	spin_lock(&pool->lru_lock);
+	if (!list_empty(&entry->lru))
+		list_del_init(&entry->lru);
+	spin_unlock(&pool->lru_lock);
+}
+
+/*
+ * Returns the least recently used entry of pool with its tree locked,
+ * or NULL if there is none.  The tree lock can't be taken under the
+ * lru_lock, so the entry is looked up again by its swap offset once the
+ * lru_lock is dropped; if it went away meanwhile, the new head is tried.
+ */
+static struct zswap_entry *zswap_lru_lock_first(struct zswap_pool *pool,
+					struct zswap_tree **treep)
+{
+	struct zswap_entry *entry;
+	struct zswap_tree *tree;
+	unsigned type;
+	pgoff_t offset;
+	int retries = 8;
+
+	while (retries--) {
+		spin_lock(&pool->lru_lock);
+		if (list_empty(&pool->lru)) {
+			spin_unlock(&pool->lru_lock);
+			return NULL;
+		}
+		entry = list_first_entry(&pool->lru, struct zswap_entry, lru);
+		type = entry->type;
+		offset = entry->offset;
+		spin_unlock(&pool->lru_lock);
+
+		tree = zswap_trees[type];
+		spin_lock(&tree->lock);
+		entry = zswap_rb_search(&tree->rbroot, offset);
+		if (entry && entry->pool == pool && !list_empty(&entry->lru)) {
+			*treep = tree;
+			return entry;
+		}
+		spin_unlock(&tree->lock);
+	}
+	return NULL;
+}
+
 /*********************************
 * writeback code
 **********************************/
@@ -571,8 +861,6 @@ static int zswap_writeback_entry(struct zswap_tree *tree, struct zswap_entry *en
 	unsigned long type = tree->type;
 	struct page *page;
 	swp_entry_t swpentry;
-	u8 *src, *dst;
-	unsigned int dlen;
 	int ret;
 	struct writeback_control wbc = {
 		.sync_mode = WB_SYNC_NONE,
@@ -595,15 +883,8 @@ static int zswap_writeback_entry(struct zswap_tree *tree, struct zswap_entry *en
 
 	case ZSWAP_SWAPCACHE_NEW: /* page is locked */
 		/* decompress */
-		dlen = PAGE_SIZE;
-		src = zs_map_object(tree->pool, entry->handle, ZS_MM_RO);
-		dst = kmap_atomic(page);
-		ret = zswap_comp_op(ZSWAP_COMPOP_DECOMPRESS, src, entry->length,
-				dst, &dlen);
-		kunmap_atomic(dst);
-		zs_unmap_object(tree->pool, entry->handle);
+		ret = zswap_decompress_entry(entry, page);
 		BUG_ON(ret);
-		BUG_ON(dlen != PAGE_SIZE);
 
 		/* page is up to date */
 		SetPageUptodate(page);
@@ -623,13 +904,15 @@ static int zswap_writeback_entry(struct zswap_tree *tree, struct zswap_entry *en
 }
 
 /*
- * Attempts to free nr of entries via writeback to the swap device.
- * The number of entries that were actually freed is returned.
+ * Attempts to free nr of entries via writeback to the swap device,
+ * least recently used first.  The number of entries that were actually
+ * freed is returned.
  */
-static int zswap_writeback_entries(struct zswap_tree *tree, int nr)
+static int zswap_writeback_entries(int nr)
 {
+	struct zswap_tree *tree;
 	struct zswap_entry *entry;
-	int i, ret, refcount, freed_nr = 0;
+	int i, p, ret, refcount, freed_nr = 0;
 
 	/*
 	 * This limits is arbitrary for now until a better
@@ -641,16 +924,15 @@ static int zswap_writeback_entries(struct zswap_tree *tree, int nr)
 		return 0;
 
 	for (i = 0; i < nr; i++) {
-		spin_lock(&tree->lock);
+		/* the dense pool only holds pages that have aged */
+		entry = NULL;
+		for (p = zswap_nr_pools - 1; p >= 0 && !entry; p--)
+			entry = zswap_lru_lock_first(&zswap_pools[p], &tree);
+		if (!entry)
+			break;
 
 		/* dequeue from lru */
-		if (list_empty(&tree->lru)) {
-			spin_unlock(&tree->lock);
-			break;
-		}
-		entry = list_first_entry(&tree->lru,
-				struct zswap_entry, lru);
-		list_del_init(&entry->lru);
+		zswap_lru_del(entry);
 
 		/* so invalidate doesn't free the entry from under us */
 		zswap_entry_get(entry);
@@ -665,28 +947,22 @@ static int zswap_writeback_entries(struct zswap_tree *tree, int nr)
 		/* drop reference from above */
 		refcount = zswap_entry_put(entry);
 
-		if (!ret)
-			 /* drop the initial reference from entry creation */
-			refcount = zswap_entry_put(entry);
-
 		/*
-		 * There are three possible values for refcount here:
-		 * (1) refcount is 1, load is in progress or writeback failed;
-		 *     do not free entry, add back to LRU
-		 * (2) refcount is 0, (usual case) not invalidate yet;
-		 *     free entry
-		 * (3) refcount is -1, invalidate happened during writeback;
-		 *     free entry
+		 * Once written back the data is in the swap cache, so the
+		 * entry leaves the tree, whoever else still holds it, and
+		 * the tree's reference goes with it unless an invalidate
+		 * already took both.  Otherwise it goes back to the LRU
+		 * tail, so the next attempt doesn't pick it again.  The
+		 * last reference frees the entry.
 		 */
-		if (refcount > 0)
-			list_add(&entry->lru, &tree->lru);
-
-		if (refcount == 0) {
-			/* no invalidate yet, remove from rbtree */
-			rb_erase(&entry->rbnode, &tree->rbroot);
+		if (!ret && !RB_EMPTY_NODE(&entry->rbnode)) {
+			zswap_rb_erase(&tree->rbroot, entry);
+			refcount = zswap_entry_put(entry);
 		}
+		if (refcount)
+			zswap_lru_add(entry);
 		spin_unlock(&tree->lock);
-		if (refcount <= 0) {
+		if (!refcount) {
 			/* free the entry */
 			zswap_free_entry(tree, entry);
 			freed_nr++;
@@ -759,6 +1035,151 @@ static inline void zswap_tmppage_free(struct page *page)
 	spin_unlock(&zswap_tmppage_lock);
 }
 
+/*********************************
+* recompression
+**********************************/
+/*
+ * Pages that stay in zswap for zswap_recompress_age seconds without being
+ * loaded are cold; they are decompressed and stored again with the dense
+ * compressor, trading a slower fault for a smaller pool.  The work runs in
+ * the background in batches and is kicked right away when the pool limit
+ * is hit.
+ */
+#define ZSWAP_RECOMPRESS_BATCH 64
+
+static void zswap_recompress_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(zswap_recompress_dwork, zswap_recompress_work);
+/* set when the pool is full: recompress without waiting for entries to age */
+static bool zswap_recompress_urgent;
+
+static void zswap_recompress_schedule(bool urgent)
+{
+	if (!zswap_dense_pool())
+		return;
+	if (urgent) {
+		if (zswap_recompress_urgent)
+			return;
+		zswap_recompress_urgent = 1;
+		cancel_delayed_work(&zswap_recompress_dwork);
+		schedule_delayed_work(&zswap_recompress_dwork, 0);
+	} else
+		schedule_delayed_work(&zswap_recompress_dwork,
+				zswap_recompress_age * HZ);
+}
+
+/*
+ * Moves the data of entry into the dense pool, using page as scratch.
+ * The caller took the entry off the LRU and holds a reference on it,
+ * which is dropped here.
+ */
+static void zswap_recompress_entry(struct zswap_tree *tree,
+				struct zswap_entry *entry, struct page *page)
+{
+	struct zswap_pool *dense = zswap_dense_pool(), *old_pool = NULL;
+	unsigned long handle = 0, old_handle = 0;
+	unsigned int dlen = PAGE_SIZE;
+	int ret, refcount;
+	char *buf;
+	u8 *src, *dst;
+
+	if (zswap_decompress_entry(entry, page))
+		goto put;
+
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page);
+	ret = zswap_comp_op(dense, ZSWAP_COMPOP_COMPRESS, src, PAGE_SIZE,
+			dst, &dlen);
+	kunmap_atomic(src);
+	if (ret || dlen >= entry->length) {
+		zswap_recompress_poor++;
+	} else {
+		handle = zs_malloc(dense->zpool, dlen,
+			__GFP_NORETRY | __GFP_HIGHMEM | __GFP_NOMEMALLOC |
+				__GFP_NOWARN);
+		if (handle) {
+			buf = zs_map_object(dense->zpool, handle, ZS_MM_WO);
+			memcpy(buf, dst, dlen);
+			zs_unmap_object(dense->zpool, handle);
+		}
+	}
+	put_cpu_var(zswap_dstmem);
+
+put:
+	spin_lock(&tree->lock);
+	/* only swap the data if nobody but the tree and us holds the entry */
+	if (handle && entry->refcount == 2 &&
+	    !RB_EMPTY_NODE(&entry->rbnode)) {
+		zswap_lru_del(entry);
+		old_pool = entry->pool;
+		old_handle = entry->handle;
+		entry->pool = dense;
+		entry->handle = handle;
+		entry->length = dlen;
+		zswap_lru_add(entry);
+		handle = 0;
+	} else {
+		/* not worth it, or busy; don't look at it again for a while */
+		zswap_lru_del(entry);
+		entry->stored = jiffies;
+		zswap_lru_add(entry);
+	}
+	refcount = zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+
+	if (handle)
+		zs_free(dense->zpool, handle);
+	if (old_pool) {
+		zs_free(old_pool->zpool, old_handle);
+		atomic_dec(&old_pool->stored_pages);
+		atomic_inc(&dense->stored_pages);
+		dense->recompressed_pages++;
+	}
+	if (!refcount)
+		zswap_free_entry(tree, entry);
+}
+
+static void zswap_recompress_work(struct work_struct *work)
+{
+	unsigned long age = zswap_recompress_age * HZ, next = age;
+	struct zswap_tree *tree;
+	struct zswap_entry *entry;
+	struct page *page;
+	int done;
+
+	if (zswap_recompress_urgent)
+		age = 0;
+	zswap_recompress_urgent = 0;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		goto resched;
+	for (done = 0; done < ZSWAP_RECOMPRESS_BATCH; done++) {
+		entry = zswap_lru_lock_first(zswap_fast_pool, &tree);
+		if (!entry)
+			break;
+		if (time_before(jiffies, entry->stored + age)) {
+			next = entry->stored + age - jiffies;
+			spin_unlock(&tree->lock);
+			break;
+		}
+		/* an entry on the LRU holds only the tree's reference */
+		zswap_lru_del(entry);
+		zswap_entry_get(entry);
+		spin_unlock(&tree->lock);
+
+		zswap_recompress_entry(tree, entry, page);
+		cond_resched();
+	}
+	__free_page(page);
+
+	/* a full batch means there is more to do right away */
+	if (done >= ZSWAP_RECOMPRESS_BATCH)
+		next = 1;
+resched:
+	if (atomic_read(&zswap_fast_pool->stored_pages))
+		schedule_delayed_work(&zswap_recompress_dwork, max(next, 1UL));
+}
+
 /*********************************
 * frontswap hooks
 **********************************/
@@ -792,10 +1213,21 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		goto reject;
 	}
 
+	src = kmap_atomic(page);
+	if (zswap_is_page_same_filled(src, &entry->value)) {
+		kunmap_atomic(src);
+		entry->pool = NULL;
+		entry->length = 0;
+		atomic_inc(&zswap_same_filled_pages);
+		goto insert;
+	}
+	kunmap_atomic(src);
+
 	/* compress */
 	dst = get_cpu_var(zswap_dstmem);
 	src = kmap_atomic(page);
-	ret = zswap_comp_op(ZSWAP_COMPOP_COMPRESS, src, PAGE_SIZE, dst, &dlen);
+	ret = zswap_comp_op(zswap_fast_pool, ZSWAP_COMPOP_COMPRESS, src,
+			PAGE_SIZE, dst, &dlen);
 	kunmap_atomic(src);
 	if (ret) {
 		ret = -EINVAL;
@@ -808,16 +1240,12 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	}
 
 	/* store */
-	handle = zs_malloc(tree->pool, dlen,
+	handle = zs_malloc(zswap_fast_pool->zpool, dlen,
 		__GFP_NORETRY | __GFP_HIGHMEM | __GFP_NOMEMALLOC |
 			__GFP_NOWARN);
 	if (!handle) {
-		ret = -ENOMEM;
-		goto freepage;
-	}
-
+		zswap_recompress_schedule(true);
 #ifdef CONFIG_ZSWAP_ENABLE_WRITEBACK
-	if (!handle) {
 		zswap_writeback_attempted++;
 		/*
 		 * Copy compressed buffer out of per-cpu storage so
@@ -835,11 +1263,10 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		dst = tmpdst;
 		put_cpu_var(zswap_dstmem);
 
-		/* try to free up some space */
-		/* TODO: replace with more targeted policy */
-		zswap_writeback_entries(tree, 16);
+		/* try to free up some space, coldest pages first */
+		zswap_writeback_entries(16);
 		/* try again, allowing wait */
-		handle = zs_malloc(tree->pool, dlen,
+		handle = zs_malloc(zswap_fast_pool->zpool, dlen,
 			__GFP_NORETRY | __GFP_HIGHMEM | __GFP_NOMEMALLOC |
 				__GFP_NOWARN);
 		if (!handle) {
@@ -849,21 +1276,32 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 			goto freepage;
 		}
 		zswap_saved_by_writeback++;
-	}
+#else
+		zswap_reject_zsmalloc_fail++;
+		ret = -ENOMEM;
+		goto freepage;
 #endif /* CONFIG_ZSWAP_ENABLE_WRITEBACK */
+	}
 
-	buf = zs_map_object(tree->pool, handle, ZS_MM_WO);
+	buf = zs_map_object(zswap_fast_pool->zpool, handle, ZS_MM_WO);
 	memcpy(buf, dst, dlen);
-	zs_unmap_object(tree->pool, handle);
+	zs_unmap_object(zswap_fast_pool->zpool, handle);
 	if (writeback_attempted)
 		zswap_tmppage_free(tmppage);
 	else
 		put_cpu_var(zswap_dstmem);
 
 	/* populate entry */
-	entry->offset = offset;
+	entry->pool = zswap_fast_pool;
 	entry->handle = handle;
 	entry->length = dlen;
+	atomic_inc(&zswap_fast_pool->stored_pages);
+	zswap_recompress_schedule(false);
+
+insert:
+	entry->type = type;
+	entry->offset = offset;
+	entry->stored = jiffies;
 
 	/* map */
 	spin_lock(&tree->lock);
@@ -872,16 +1310,15 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		if (ret == -EEXIST) {
 			zswap_duplicate_entry++;
 			/* remove from rbtree and lru */
-			rb_erase(&dupentry->rbnode, &tree->rbroot);
-			if (!list_empty(&dupentry->lru))
-				list_del_init(&dupentry->lru);
+			zswap_rb_erase(&tree->rbroot, dupentry);
+			zswap_lru_del(dupentry);
 			if (!zswap_entry_put(dupentry)) {
 				/* free */
 				zswap_free_entry(tree, dupentry);
 			}
 		}
 	} while (ret == -EEXIST);
-	list_add_tail(&entry->lru, &tree->lru);
+	zswap_lru_add(entry);
 	spin_unlock(&tree->lock);
 
 	/* update stats */
@@ -908,38 +1345,34 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 {
 	struct zswap_tree *tree = zswap_trees[type];
 	struct zswap_entry *entry;
-	u8 *src, *dst;
-	unsigned int dlen;
 	int refcount;
 
 	/* find */
 	spin_lock(&tree->lock);
 	entry = zswap_rb_search(&tree->rbroot, offset);
 	if (!entry) {
-		/* entry was written_back */
+		/*
+		 * entry was written_back: frontswap only calls us for
+		 * offsets it saw stored and not invalidated
+		 */
+		zswap_writeback_refaults++;
 		spin_unlock(&tree->lock);
 		return -1;
 	}
 	zswap_entry_get(entry);
 
 	/* remove from lru */
-	if (!list_empty(&entry->lru))
-		list_del_init(&entry->lru);
+	zswap_lru_del(entry);
 	spin_unlock(&tree->lock);
 
 	/* decompress */
-	dlen = PAGE_SIZE;
-	src = zs_map_object(tree->pool, entry->handle, ZS_MM_RO);
-	dst = kmap_atomic(page);
-	zswap_comp_op(ZSWAP_COMPOP_DECOMPRESS, src, entry->length,
-		dst, &dlen);
-	kunmap_atomic(dst);
-	zs_unmap_object(tree->pool, entry->handle);
+	zswap_decompress_entry(entry, page);
 
 	spin_lock(&tree->lock);
 	refcount = zswap_entry_put(entry);
 	if (likely(refcount)) {
-		list_add_tail(&entry->lru, &tree->lru);
+		entry->stored = jiffies;
+		zswap_lru_add(entry);
 		spin_unlock(&tree->lock);
 		return 0;
 	}
@@ -974,9 +1407,8 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 	}
 
 	/* remove from rbtree and lru */
-	rb_erase(&entry->rbnode, &tree->rbroot);
-	if (!list_empty(&entry->lru))
-		list_del_init(&entry->lru);
+	zswap_rb_erase(&tree->rbroot, entry);
+	zswap_lru_del(entry);
 
 	/* drop the initial reference from entry creation */
 	refcount = zswap_entry_put(entry);
@@ -984,7 +1416,7 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 	spin_unlock(&tree->lock);
 
 	if (refcount) {
-		/* writeback in progress, writeback will free */
+		/* load, writeback or recompress in progress, it will free */
 		return;
 	}
 
@@ -1015,13 +1447,11 @@ static void zswap_frontswap_invalidate_area(unsigned type)
 	 */
 	while ((node = rb_first(&tree->rbroot))) {
 		entry = rb_entry(node, struct zswap_entry, rbnode);
-		rb_erase(&entry->rbnode, &tree->rbroot);
-		zs_free(tree->pool, entry->handle);
-		zswap_entry_cache_free(entry);
-		atomic_dec(&zswap_stored_pages);
+		zswap_rb_erase(&tree->rbroot, entry);
+		zswap_lru_del(entry);
+		zswap_free_entry(tree, entry);
 	}
 	tree->rbroot = RB_ROOT;
-	INIT_LIST_HEAD(&tree->lru);
 	spin_unlock(&tree->lock);
 }
 
@@ -1033,18 +1463,12 @@ static void zswap_frontswap_init(unsigned type)
 	tree = kzalloc(sizeof(struct zswap_tree), GFP_NOWAIT);
 	if (!tree)
 		goto err;
-	tree->pool = zs_create_pool(GFP_NOWAIT, &zswap_zs_ops);
-	if (!tree->pool)
-		goto freetree;
 	tree->rbroot = RB_ROOT;
-	INIT_LIST_HEAD(&tree->lru);
 	spin_lock_init(&tree->lock);
 	tree->type = type;
 	zswap_trees[type] = tree;
 	return;
 
-freetree:
-	kfree(tree);
 err:
 	pr_err("alloc failed, zswap disabled for swap type %d\n", type);
 }
@@ -1065,8 +1489,21 @@ static struct frontswap_ops zswap_frontswap_ops = {
 
 static struct dentry *zswap_debugfs_root;
 
+static int zswap_pool_bytes_get(void *data, u64 *val)
+{
+	struct zswap_pool *pool = data;
+
+	*val = zs_get_total_size_bytes(pool->zpool);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_bytes_fops, zswap_pool_bytes_get, NULL,
+			"%llu\n");
+
 static int __init zswap_debugfs_init(void)
 {
+	struct zswap_pool *pool;
+	struct dentry *dir;
+
 	if (!debugfs_initialized())
 		return -ENODEV;
 
@@ -1090,14 +1527,32 @@ static int __init zswap_debugfs_init(void)
 			zswap_debugfs_root, &zswap_reject_compress_poor);
 	debugfs_create_u64("written_back_pages", S_IRUGO,
 			zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("writeback_refaults", S_IRUGO,
+			zswap_debugfs_root, &zswap_writeback_refaults);
 	debugfs_create_u64("duplicate_entry", S_IRUGO,
 			zswap_debugfs_root, &zswap_duplicate_entry);
 	debugfs_create_atomic_t("pool_pages", S_IRUGO,
 			zswap_debugfs_root, &zswap_pool_pages);
 	debugfs_create_atomic_t("stored_pages", S_IRUGO,
 			zswap_debugfs_root, &zswap_stored_pages);
+	debugfs_create_atomic_t("same_filled_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_same_filled_pages);
 	debugfs_create_atomic_t("outstanding_writebacks", S_IRUGO,
 			zswap_debugfs_root, &zswap_outstanding_writebacks);
+	debugfs_create_u64("recompress_poor", S_IRUGO,
+			zswap_debugfs_root, &zswap_recompress_poor);
+
+	for_each_zswap_pool(pool) {
+		dir = debugfs_create_dir(pool->compressor, zswap_debugfs_root);
+		if (!dir)
+			return -ENOMEM;
+		debugfs_create_atomic_t("stored_pages", S_IRUGO, dir,
+				&pool->stored_pages);
+		debugfs_create_u64("recompressed_pages", S_IRUGO, dir,
+				&pool->recompressed_pages);
+		debugfs_create_file("pool_bytes", S_IRUGO, dir, pool,
+				&zswap_pool_bytes_fops);
+	}
 
 	return 0;
 }
@@ -1120,6 +1575,8 @@ static inline void __exit zswap_debugfs_exit(void) { }
 **********************************/
 static int __init init_zswap(void)
 {
+	struct zswap_pool *pool;
+
 	if (!zswap_enabled)
 		return 0;
 
@@ -1140,6 +1597,10 @@ static int __init init_zswap(void)
 		pr_err("compressor initialization failed\n");
 		goto compfail;
 	}
+	if (zswap_pool_init()) {
+		pr_err("pool initialization failed\n");
+		goto zpoolfail;
+	}
 	if (zswap_cpu_init()) {
 		pr_err("per-cpu initialization failed\n");
 		goto pcpufail;
@@ -1149,6 +1610,9 @@ static int __init init_zswap(void)
 		pr_warn("debugfs initialization failed\n");
 	return 0;
 pcpufail:
+	for_each_zswap_pool(pool)
+		zs_destroy_pool(pool->zpool);
+zpoolfail:
 	zswap_comp_exit();
 compfail:
 	zswap_tmppage_pool_destroy();
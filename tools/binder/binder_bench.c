@@ -0,0 +1,312 @@
+/*
+ * binder_bench.c - binder transaction throughput benchmark
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * Sweeps payload sizes and measures round trip transactions between a
+ * client and a server process, once the way libbinder does it today
+ * (flatten the parcel header and payload into one buffer, then
+ * BC_TRANSACTION) and once with BC_TRANSACTION_SG, where the driver
+ * gathers the chunks itself.
+ *
+ * The server registers itself as context manager, so the benchmark has to
+ * run while no servicemanager is registered with the driver.
+ *
+ * Usage: binder_bench [-i iterations] [-m max_payload_bytes]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(1024 * 1024)
+#define HEADER_SIZE	64
+#define CODE_PING	1
+#define CODE_QUIT	2
+
+static int binder_open_dev(void)
+{
+	int fd = open("/dev/binder", O_RDWR);
+
+	if (fd < 0) {
+		perror("open /dev/binder");
+		exit(1);
+	}
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) ==
+	    MAP_FAILED) {
+		perror("mmap /dev/binder");
+		exit(1);
+	}
+	return fd;
+}
+
+static int binder_rw(int fd, void *wbuf, size_t wsize, void *rbuf,
+		     size_t rsize, size_t *rconsumed)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = wsize;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+	do {
+		ret = ioctl(fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		perror("BINDER_WRITE_READ");
+		return -1;
+	}
+	if (rconsumed)
+		*rconsumed = bwr.read_consumed;
+	return 0;
+}
+
+static int binder_free_buffer(int fd, const void *data)
+{
+	struct {
+		uint32_t cmd;
+		const void *data;
+	} __attribute__((packed)) w = { BC_FREE_BUFFER, data };
+
+	return binder_rw(fd, &w, sizeof(w), NULL, 0, NULL);
+}
+
+/* Skip over one return command and its payload, returning its size */
+static size_t binder_br_size(uint32_t cmd)
+{
+	return sizeof(uint32_t) + _IOC_SIZE(cmd);
+}
+
+static void server(int fd, int ready_fd)
+{
+	uint32_t rbuf[256];
+	uint32_t cmd = BC_ENTER_LOOPER;
+	int quit = 0;
+
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		exit(1);
+	}
+	if (binder_rw(fd, &cmd, sizeof(cmd), NULL, 0, NULL))
+		exit(1);
+	if (write(ready_fd, "r", 1) != 1)
+		exit(1);
+	close(ready_fd);
+
+	while (!quit) {
+		size_t consumed, pos = 0;
+
+		if (binder_rw(fd, NULL, 0, rbuf, sizeof(rbuf), &consumed))
+			exit(1);
+		while (pos < consumed) {
+			struct binder_transaction_data tr;
+			struct {
+				uint32_t free_cmd;
+				const void *data;
+				uint32_t reply_cmd;
+				struct binder_transaction_data reply;
+			} __attribute__((packed)) w;
+
+			memcpy(&cmd, (char *)rbuf + pos, sizeof(cmd));
+			if (cmd != BR_TRANSACTION) {
+				pos += binder_br_size(cmd);
+				continue;
+			}
+			memcpy(&tr, (char *)rbuf + pos + sizeof(cmd),
+			       sizeof(tr));
+			pos += binder_br_size(cmd);
+			quit = tr.code == CODE_QUIT;
+
+			memset(&w, 0, sizeof(w));
+			w.free_cmd = BC_FREE_BUFFER;
+			w.data = tr.data.ptr.buffer;
+			w.reply_cmd = BC_REPLY;
+			if (binder_rw(fd, &w, sizeof(w), NULL, 0, NULL))
+				exit(1);
+		}
+	}
+	exit(0);
+}
+
+/* Send one transaction to the context manager and wait for the reply */
+static int transact(int fd, uint32_t code, const void *data, size_t size,
+		    const struct binder_sg_entry *sg, size_t sg_count)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data_sg tr;
+	} __attribute__((packed)) w;
+	size_t wsize = sizeof(uint32_t) + sizeof(w.tr.transaction_data);
+	uint32_t rbuf[64];
+	uint32_t cmd;
+
+	memset(&w, 0, sizeof(w));
+	w.cmd = BC_TRANSACTION;
+	w.tr.transaction_data.target.handle = 0;
+	w.tr.transaction_data.code = code;
+	w.tr.transaction_data.data_size = size;
+	w.tr.transaction_data.data.ptr.buffer = data;
+	if (sg) {
+		w.cmd = BC_TRANSACTION_SG;
+		w.tr.sg_list = sg;
+		w.tr.sg_count = sg_count;
+		wsize = sizeof(w);
+	}
+
+	for (;;) {
+		size_t consumed, pos = 0;
+
+		if (binder_rw(fd, &w, wsize, rbuf, sizeof(rbuf), &consumed))
+			return -1;
+		wsize = 0;
+		while (pos < consumed) {
+			struct binder_transaction_data tr;
+
+			memcpy(&cmd, (char *)rbuf + pos, sizeof(cmd));
+			switch (cmd) {
+			case BR_REPLY:
+				memcpy(&tr, (char *)rbuf + pos + sizeof(cmd),
+				       sizeof(tr));
+				return binder_free_buffer(fd,
+							  tr.data.ptr.buffer);
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				fprintf(stderr, "transaction failed: %x\n",
+					cmd);
+				return -1;
+			default:
+				pos += binder_br_size(cmd);
+				break;
+			}
+		}
+	}
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void client(int fd, int iterations, size_t max_payload)
+{
+	char header[HEADER_SIZE];
+	char *payload = malloc(max_payload);
+	char *flat = malloc(HEADER_SIZE + max_payload);
+	struct binder_sg_entry sg[2];
+	size_t size;
+	int i;
+
+	if (!payload || !flat) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memset(header, 0, sizeof(header));
+	memset(payload, 0x5a, max_payload);
+
+	printf("%10s %14s %14s %12s %12s\n", "payload", "flat us/txn",
+	       "sg us/txn", "flat MB/s", "sg MB/s");
+	for (size = 64; size <= max_payload; size *= 2) {
+		double t0, flat_us, sg_us;
+
+		t0 = now_us();
+		for (i = 0; i < iterations; i++) {
+			/* what Parcel does: flatten, then hand to the driver */
+			memcpy(flat, header, HEADER_SIZE);
+			memcpy(flat + HEADER_SIZE, payload, size);
+			if (transact(fd, CODE_PING, flat, HEADER_SIZE + size,
+				     NULL, 0))
+				exit(1);
+		}
+		flat_us = (now_us() - t0) / iterations;
+
+		sg[0].buffer = header;
+		sg[0].size = HEADER_SIZE;
+		sg[0].fixup_offset = BINDER_SG_NO_FIXUP;
+		sg[1].buffer = payload;
+		sg[1].size = size;
+		sg[1].fixup_offset = 0;
+		t0 = now_us();
+		for (i = 0; i < iterations; i++) {
+			if (transact(fd, CODE_PING, NULL, HEADER_SIZE + size,
+				     sg, 2))
+				exit(1);
+		}
+		sg_us = (now_us() - t0) / iterations;
+
+		printf("%10zu %14.2f %14.2f %12.1f %12.1f\n", size, flat_us,
+		       sg_us, size / flat_us, size / sg_us);
+	}
+	transact(fd, CODE_QUIT, NULL, 0, NULL, 0);
+	free(flat);
+	free(payload);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 1000;
+	size_t max_payload = 256 * 1024;
+	int ready[2];
+	char c;
+	pid_t pid;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:m:")) != -1) {
+		switch (opt) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'm':
+			max_payload = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i iterations] "
+				"[-m max_payload_bytes]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations <= 0 || max_payload < 64 ||
+	    max_payload + HEADER_SIZE > MAP_SIZE / 2) {
+		fprintf(stderr, "invalid arguments\n");
+		return 1;
+	}
+
+	if (pipe(ready)) {
+		perror("pipe");
+		return 1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(ready[0]);
+		server(binder_open_dev(), ready[1]);
+	}
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		return 1;
+	}
+	client(binder_open_dev(), iterations, max_payload);
+	waitpid(pid, NULL, 0);
+	return 0;
+}